@@ -0,0 +1,201 @@
+// Compares the handler table of Executor with the nested switch it replaced.
+// Every program is run functionally once to record its dynamic instruction
+// stream with the operand values, then both executors replay the stream.
+//
+// Usage: dispatch_bench <elf>...
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "DecodeCache.h"
+#include "RegisterFile.h"
+#include "CsrFile.h"
+#include "Executor.h"
+
+static constexpr size_t maxTraceLength = 4 * 1024 * 1024;
+static constexpr size_t repetitions = 20;
+
+// The previous executor: switch on the type, then on the function
+class SwitchExecutor
+{
+public:
+    static Word Execute(Instruction& instr, Word ip)
+    {
+        switch (instr._type) {
+            case IType::Alu:
+                aluFunc(instr, (instr._flags & flagImm) ? instr._imm : instr._src2Val);
+                return ip + 4;
+            case IType::Br:
+                switch (instr._brFunc) {
+                    case BrFunc::Eq:  return instr._src1Val == instr._src2Val ? ip + instr._imm : ip + 4;
+                    case BrFunc::Neq: return instr._src1Val != instr._src2Val ? ip + instr._imm : ip + 4;
+                    case BrFunc::Lt:  return signedLessThan(instr._src1Val, instr._src2Val) ? ip + instr._imm : ip + 4;
+                    case BrFunc::Ltu: return instr._src1Val < instr._src2Val ? ip + instr._imm : ip + 4;
+                    case BrFunc::Ge:  return !signedLessThan(instr._src1Val, instr._src2Val) ? ip + instr._imm : ip + 4;
+                    case BrFunc::Geu: return instr._src1Val >= instr._src2Val ? ip + instr._imm : ip + 4;
+                    case BrFunc::AT:  return ip + instr._imm;
+                    default:          return ip + 4;
+                }
+            case IType::St:
+                instr._data = instr._src2Val;
+                return ip + 4;
+            case IType::Csrw:
+                instr._data = instr._src1Val;
+                return ip + 4;
+            case IType::J:
+                instr._data = ip + 4;
+                return ip + instr._imm;
+            case IType::Jr:
+                instr._data = ip + 4;
+                return instr._src1Val + instr._imm;
+            case IType::Auipc:
+                instr._data = ip + instr._imm;
+                return ip + 4;
+            default:
+                return ip + 4;
+        }
+    }
+
+private:
+    static bool checkIsNegative(Word w)
+    {
+        return (w & (1u << 31u)) != 0;
+    }
+
+    static bool signedLessThan(Word fi, Word sec)
+    {
+        if (checkIsNegative(fi) && !checkIsNegative(sec))
+            return true;
+        if (!checkIsNegative(fi) && checkIsNegative(sec))
+            return false;
+        if (!checkIsNegative(fi) && !checkIsNegative(sec))
+            return fi < sec;
+        return (~fi + 1) > (~sec + 1);
+    }
+
+    static void aluFunc(Instruction& instr, Word secondOperand)
+    {
+        switch (instr._aluFunc) {
+            case AluFunc::Add:  instr._data = instr._src1Val + secondOperand; break;
+            case AluFunc::Sub:  instr._data = instr._src1Val + (~secondOperand + 1); break;
+            case AluFunc::And:  instr._data = instr._src1Val & secondOperand; break;
+            case AluFunc::Or:   instr._data = instr._src1Val | secondOperand; break;
+            case AluFunc::Xor:  instr._data = instr._src1Val ^ secondOperand; break;
+            case AluFunc::Slt:  instr._data = signedLessThan(instr._src1Val, secondOperand); break;
+            case AluFunc::Sltu: instr._data = instr._src1Val < secondOperand; break;
+            case AluFunc::Sll:  instr._data = instr._src1Val << (secondOperand % 32); break;
+            case AluFunc::Srl:  instr._data = instr._src1Val >> (secondOperand % 32); break;
+            case AluFunc::Sra:
+                if (checkIsNegative(instr._src1Val)) {
+                    Word unsignedShift = instr._src1Val >> (secondOperand % 32);
+                    Word addedBits = (1u << 31u) - (1u << (31 - secondOperand % 32));
+                    instr._data = unsignedShift | addedBits | (1u << 31u);
+                } else
+                    instr._data = instr._src1Val >> (secondOperand % 32);
+                break;
+            default: break;
+        }
+    }
+};
+
+struct TraceEntry
+{
+    Instruction instr;      // with the source operands already read
+    Word ip;
+};
+
+static std::vector<TraceEntry> RecordTrace(const std::string& elf)
+{
+    std::vector<TraceEntry> trace;
+
+    MemoryStorage mem;
+    if (!mem.LoadElf(elf))
+        return trace;
+
+    DecodeCache decodeCache;
+    RegisterFile rf;
+    CsrFile csrf;
+    csrf.Reset();
+
+    Word ip = 0x200;
+    while (trace.size() < maxTraceLength)
+    {
+        Instruction instr = decodeCache.Decode(ip, mem.Read(ip));
+        csrf.Read(instr);
+        rf.Read(instr);
+        trace.push_back({instr, ip});
+
+        Word nextIp = Executor::Execute(instr, ip);
+        Word addr = instr.Addr();
+        if (instr._type == IType::Ld)
+            instr._data = LoadLane(addr, instr._flags, mem.Read(addr));
+        else if (instr._type == IType::St)
+            mem.Write(addr, StoreLane(addr, instr._flags, instr._data), AccessMask(addr, instr._flags));
+
+        rf.Write(instr);
+        csrf.Write(instr);
+        csrf.InstructionExecuted();
+        csrf.Clock();
+        ip = nextIp;
+
+        auto msg = csrf.GetMessage();
+        if (msg && msg.value().unpacked.type == CpuToHostType::ExitCode)
+            break;
+    }
+
+    return trace;
+}
+
+// Returns nanoseconds per instruction and a checksum of all results
+template <typename Execute>
+static std::pair<double, Word> Replay(const std::vector<TraceEntry>& trace, Execute execute)
+{
+    Word checksum = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    for (size_t rep = 0; rep < repetitions; rep++)
+    {
+        for (const TraceEntry& entry : trace)
+        {
+            Instruction instr = entry.instr;
+            checksum += execute(instr, entry.ip) ^ instr._data;
+        }
+    }
+
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return {elapsed.count() / double(trace.size() * repetitions), checksum};
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: %s <elf>...\n", argv[0]);
+        return 1;
+    }
+
+    printf("%-48s %10s %12s %12s %8s\n", "program", "insts", "switch ns", "table ns", "speedup");
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::vector<TraceEntry> trace = RecordTrace(argv[i]);
+        if (trace.empty())
+            return 1;
+
+        auto switched = Replay(trace, SwitchExecutor::Execute);
+        auto table = Replay(trace, Executor::Execute);
+
+        if (switched.second != table.second)
+        {
+            fprintf(stderr, "%s: results differ\n", argv[i]);
+            return 1;
+        }
+
+        printf("%-48s %10zu %12.2f %12.2f %7.2fx\n", argv[i], trace.size(),
+               switched.first, table.first, switched.first / table.first);
+    }
+
+    return 0;
+}
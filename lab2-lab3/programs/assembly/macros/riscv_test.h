@@ -29,19 +29,19 @@ _start:
 //-----------------------------------------------------------------------
 
 #define PRINT_NEWLINE(tmp_reg)                                          \
-        la tmp_reg, 0x0001000A;                                         \
-        csrw mtohost, tmp_reg
+        li tmp_reg, 0x0001000A;                                         \
+        csrw CSR_MTOHOST, tmp_reg
 
 #define PRINT_INT(arg_reg, tmp_reg_1, tmp_reg_2)                        \
         slli tmp_reg_1, arg_reg, 16;                                    \
         srli tmp_reg_1, tmp_reg_1, 16;                                  \
-        la tmp_reg_2, 0x00020000;                                       \
+        li tmp_reg_2, 0x00020000;                                       \
         or tmp_reg_2, tmp_reg_1, tmp_reg_2;                             \
-        csrw mtohost, tmp_reg_2;                                        \
+        csrw CSR_MTOHOST, tmp_reg_2;                                    \
         srli tmp_reg_1, arg_reg, 16;                                    \
-        la tmp_reg_2, 0x00030000;                                       \
+        li tmp_reg_2, 0x00030000;                                       \
         or tmp_reg_2, tmp_reg_1, tmp_reg_2;                             \
-        csrw mtohost, tmp_reg_2                                         \
+        csrw CSR_MTOHOST, tmp_reg_2                                     \
 
 //-----------------------------------------------------------------------
 // End Macro (return value in TESTNUM)
@@ -56,7 +56,7 @@ exit:   csrr a0, cycle;                                                 \
         PRINT_NEWLINE(a2);                                              \
         PRINT_INT(a1, a2, x3);                                          \
         PRINT_NEWLINE(a2);                                              \
-        csrw mtohost, TESTNUM;                                          \
+        csrw CSR_MTOHOST, TESTNUM;                                      \
 1:      j 1b
 
 //-----------------------------------------------------------------------
@@ -43,16 +43,8 @@ void printChar(uint32_t c) {
 }
 
 void printStr(char* x) {
-  while(1) {
-	 // get 4B aligned addr
-     uint32_t* y = (uint32_t*)(((uint32_t)x) & ~0x03);
-     uint32_t fullC = *y;
-     uint32_t mod = ((uint32_t)x) & 0x3;
-     uint32_t shift = mod << 3;
-     uint32_t c = (fullC & (0x0FF << shift)) >> shift;
-     if(c == (uint32_t)'\0')
-       break;
-     printChar(c);
+  while(*x != '\0') {
+     printChar((uint8_t)*x);
      x++;
   }
 }
@@ -74,7 +66,14 @@ int __attribute__((weak)) main(int argc, char** argv) {
   return -1;
 }
 
+void __attribute__((weak)) thread_entry(int cid, int nc) {
+  // multi-threaded programs override this function.
+  // for the case of single-threaded programs, only let core 0 proceed.
+  while (cid != 0);
+}
+
 void _init(int cid, int nc) {
+  thread_entry(cid, nc);
   int ret = main(0, 0); // call main function
   toHostExit((uint32_t)ret);
 }
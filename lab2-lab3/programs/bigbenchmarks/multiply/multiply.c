@@ -7,6 +7,10 @@
 int multiply( int x, int y )
 {
 
+#ifdef __riscv_mul
+ // Built with -march=rv32im: a single mul
+ return x * y;
+#else
  int i;
  int result = 0;
 
@@ -19,6 +23,7 @@ int multiply( int x, int y )
  } 
  
  return result;
+#endif
 
 }
 
@@ -16,6 +16,13 @@
 
 #include <stdint.h>
 
+// Events for setHpmEvent, the same numbers as PerfEvent in the simulator
+#define HPM_ICACHE_MISS       1
+#define HPM_DCACHE_MISS       2
+#define HPM_WRITEBACK         3
+#define HPM_BRANCH_MISPREDICT 4
+#define HPM_STALL_CYCLE       5
+
 #if HOST_DEBUG
 
 #include <stdio.h>
@@ -29,6 +36,10 @@
 	static uint32_t getInsts() { return 0; }
 	static uint32_t getCycle() { return 0; }
 	static uint32_t getCoreId() { return 0; }
+	static uint64_t getCycle64() { return 0; }
+	static uint64_t getInsts64() { return 0; }
+#define setHpmEvent(n, event)
+#define getHpmCounter(n) 0
 
 #else // HOST_DEBUG = 0
 
@@ -50,8 +61,60 @@
 		return id;
 	}
 
+	// The high half is read again in case the low one has wrapped in between
+	static uint64_t getCycle64() {
+		uint32_t hi, lo, hi2;
+		do {
+			asm volatile ("csrr %0, cycleh" : "=r"(hi) : );
+			asm volatile ("csrr %0, cycle" : "=r"(lo) : );
+			asm volatile ("csrr %0, cycleh" : "=r"(hi2) : );
+		} while (hi != hi2);
+		return ((uint64_t)hi << 32) | lo;
+	}
+
+	static uint64_t getInsts64() {
+		uint32_t hi, lo, hi2;
+		do {
+			asm volatile ("csrr %0, instreth" : "=r"(hi) : );
+			asm volatile ("csrr %0, instret" : "=r"(lo) : );
+			asm volatile ("csrr %0, instreth" : "=r"(hi2) : );
+		} while (hi != hi2);
+		return ((uint64_t)hi << 32) | lo;
+	}
+
+// n is 3..31, CSR numbers have to be constants
+#define setHpmEvent(n, event) \
+	asm volatile ("csrw mhpmevent" #n ", %0" : : "r"((uint32_t)(event)))
+
+#define getHpmCounter(n) ({ \
+	uint32_t value; \
+	asm volatile ("csrr %0, mhpmcounter" #n : "=r"(value) : ); \
+	value; })
+
 #endif // HOST_DEBUG
 
+// Built with RISCV_ARCH=rv32ima, harts can share counters and locks
+#ifdef __riscv_atomic
+
+	static uint32_t atomicAdd(volatile uint32_t* addr, uint32_t value) {
+		uint32_t old;
+		asm volatile ("amoadd.w %0, %2, (%1)" : "=r"(old) : "r"(addr), "r"(value) : "memory");
+		return old;
+	}
+
+	static void spinLock(volatile uint32_t* lock) {
+		uint32_t old;
+		do {
+			asm volatile ("amoswap.w.aq %0, %2, (%1)" : "=r"(old) : "r"(lock), "r"(1) : "memory");
+		} while (old != 0);
+	}
+
+	static void spinUnlock(volatile uint32_t* lock) {
+		asm volatile ("amoswap.w.rl zero, zero, (%0)" : : "r"(lock) : "memory");
+	}
+
+#endif // __riscv_atomic
+
 
 void printInt(uint32_t c);
 void printChar(uint32_t c);
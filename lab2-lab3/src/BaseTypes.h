@@ -3,7 +3,7 @@
 #define RISCV_SIM_BASETYPES_H
 
 using Reg32 = uint32_t;
-using RId = uint16_t;
+using RId = uint8_t;
 using Word = uint32_t;
 using SignedWord = int32_t;
 
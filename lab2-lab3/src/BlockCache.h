@@ -0,0 +1,183 @@
+#ifndef RISCV_SIM_BLOCKCACHE_H
+#define RISCV_SIM_BLOCKCACHE_H
+
+#include <algorithm>
+#include <unordered_map>
+
+#include "Decoder.h"
+#include "Memory.h"
+
+struct JitContext;
+
+// Native code of a translated block, takes the register file and returns the next ip
+using JitFunc = Word (*)(Word* regs, JitContext* ctx);
+
+static constexpr size_t maxBlockInstructions = 64;
+static constexpr size_t maxSuperblockInstructions = 4 * maxBlockInstructions;
+static constexpr size_t superblockThreshold = 32;      // executions of a block before a superblock starts with it
+static constexpr size_t superblockMinSamples = 8;      // exits of a block seen before its usual successor is trusted
+static constexpr size_t memSizeLines = memSize * sizeof(Word) / lineSizeBytes;
+
+// Straight-line run of decoded instructions. Only the last one may change
+// the control flow, so the whole block is executed without looking anything up.
+// A superblock stitches hot blocks along the successors they usually go to. The
+// control transfers inside it are guards: when one goes elsewhere, it is left early.
+struct BasicBlock
+{
+    Word startIp = 0;
+    std::vector<Instruction> ops;
+    std::vector<Word> ips;                      // of every op, not contiguous in a superblock
+    std::array<BasicBlock*, 2> successors{};    // chained blocks, filled lazily
+    std::array<size_t, 2> exits{};              // how often the block has gone to each successor
+    size_t execCount = 0;
+    size_t sideExits = 0;                       // superblock left before its last op
+    bool superblock = false;
+    bool traced = false;                        // a superblock has been formed from it or can't be
+    std::unique_ptr<BasicBlock> trace;          // superblock starting with this block
+    JitFunc native = nullptr;
+};
+
+class BlockCache
+{
+public:
+    explicit BlockCache(MemoryStorage& amem)
+            : _mem(amem)
+    {
+
+    }
+
+    BasicBlock* Lookup(Word ip)
+    {
+        auto found = _blocks.find(ip);
+        if (found != _blocks.end())
+            return found->second.get();
+
+        return Translate(ip);
+    }
+
+    // Follows the chain of the block that has just been executed and links
+    // the successor to it, so hot loops never go back to the block map
+    BasicBlock* Next(BasicBlock* from, Word ip)
+    {
+        for (size_t i = 0; i < from->successors.size(); i++)
+        {
+            BasicBlock* successor = from->successors[i];
+            if (successor != nullptr && successor->startIp == ip)
+            {
+                from->exits[i]++;
+                return successor;
+            }
+        }
+
+        BasicBlock* next = Lookup(ip);
+        size_t slot = from->successors[0] == nullptr ? 0 : 1;
+        from->successors[slot] = next;
+        from->exits[slot] = 1;
+        return next;
+    }
+
+    // Stitches the blocks the profile says usually follow the head, until the trace loops
+    // back into itself, the way on is not predictable or a CSR write may stop the program.
+    // Returns nullptr if no block follows the head predictably.
+    BasicBlock* FormSuperblock(BasicBlock* head)
+    {
+        head->traced = true;
+
+        auto trace = std::make_unique<BasicBlock>();
+        trace->startIp = head->startIp;
+        trace->superblock = true;
+        trace->traced = true;
+
+        std::vector<const BasicBlock*> stitched;
+        for (const BasicBlock* block = head; block != nullptr; block = UsualSuccessor(*block))
+        {
+            if (std::find(stitched.begin(), stitched.end(), block) != stitched.end() ||
+                trace->ops.size() + block->ops.size() > maxSuperblockInstructions)
+                break;
+
+            trace->ops.insert(trace->ops.end(), block->ops.begin(), block->ops.end());
+            trace->ips.insert(trace->ips.end(), block->ips.begin(), block->ips.end());
+            stitched.push_back(block);
+        }
+
+        if (stitched.size() < 2)
+            return nullptr;
+
+        head->trace = std::move(trace);
+        return head->trace.get();
+    }
+
+    // Must be called for every store. Returns true if the store hit translated
+    // code, in which case all blocks (and pointers to them) become invalid.
+    bool Invalidate(Word addr)
+    {
+        if (!_codeLines[ToLineIdx(addr)])
+            return false;
+
+        _blocks.clear();
+        std::fill(_codeLines.begin(), _codeLines.end(), false);
+        return true;
+    }
+
+private:
+    BasicBlock* Translate(Word ip)
+    {
+        auto block = std::make_unique<BasicBlock>();
+        block->startIp = ip;
+
+        Word pc = ip;
+        while (block->ops.size() < maxBlockInstructions)
+        {
+            block->ops.push_back(_decoder.Decode(_mem.Fetch(pc)));
+            block->ips.push_back(pc);
+            pc += block->ops.back().Length();
+
+            if (EndsBlock(block->ops.back()._type))
+                break;
+        }
+
+        for (Word line = ToLineIdx(ip); line <= ToLineIdx(pc - 1); line++)
+            _codeLines[line] = true;
+
+        BasicBlock* ret = block.get();
+        _blocks[ip] = std::move(block);
+        return ret;
+    }
+
+    static const BasicBlock* UsualSuccessor(const BasicBlock& block)
+    {
+        // Messages, traps and waits stay at the end of a trace
+        size_t total = block.exits[0] + block.exits[1];
+        IType last = block.ops.back()._type;
+        if (last == IType::Csrw || last == IType::Csrrw || last == IType::Trap || last == IType::Mret ||
+            last == IType::Wfi || total < superblockMinSamples)
+            return nullptr;
+
+        // Taken at least 7 times out of 8
+        for (size_t i = 0; i < block.successors.size(); i++)
+        {
+            if (block.successors[i] != nullptr && block.exits[i] * 8 >= total * 7)
+                return block.successors[i];
+        }
+        return nullptr;
+    }
+
+    // A CSR write may produce a message for the host, so it ends the block as well
+    static bool EndsBlock(IType type)
+    {
+        return type == IType::Br || type == IType::J || type == IType::Jr || type == IType::Csrw ||
+               type == IType::Csrrw || type == IType::Trap || type == IType::Mret || type == IType::Wfi;
+    }
+
+    static size_t ToLineIdx(Word addr)
+    {
+        return (addr / lineSizeBytes) % memSizeLines;
+    }
+
+    MemoryStorage& _mem;
+    Decoder _decoder;
+    std::unordered_map<Word, std::unique_ptr<BasicBlock>> _blocks;
+    std::vector<bool> _codeLines = std::vector<bool>(memSizeLines);
+};
+
+#endif //RISCV_SIM_BLOCKCACHE_H
@@ -0,0 +1,307 @@
+#ifndef RISCV_SIM_BRANCHPREDICTOR_H
+#define RISCV_SIM_BRANCHPREDICTOR_H
+
+#include "Instruction.h"
+
+#include <vector>
+
+static constexpr size_t bhtEntries = 1024;
+static constexpr size_t btbEntries = 256;
+static constexpr size_t rasDepth = 8;
+
+// Speculative state of the predictor before a prediction, restored on a mispredict
+struct PredictorCheckpoint
+{
+    Word history = 0;
+    size_t rasTop = 0;
+    Word rasValue = 0;
+};
+
+struct Prediction
+{
+    Word nextIp;
+    PredictorCheckpoint checkpoint;
+};
+
+class IBranchPredictor
+{
+public:
+    IBranchPredictor() = default;
+    virtual ~IBranchPredictor() = default;
+    IBranchPredictor(const IBranchPredictor &) = delete;
+    IBranchPredictor(IBranchPredictor &&) = delete;
+
+    IBranchPredictor& operator=(const IBranchPredictor&) = delete;
+    IBranchPredictor& operator=(IBranchPredictor&&) = delete;
+
+    // Called at fetch, only the address and the length predecoded from the fetched bits are known at that point
+    virtual Prediction Predict(Word ip, Word length = 4) = 0;
+
+    // Called as soon as a mispredict is found, restores the speculative state
+    virtual void Recover(Word ip, const Instruction& instr, Word nextIp, const Prediction& prediction) = 0;
+
+    // Trains the tables, called for every instruction in program order
+    virtual void Update(Word ip, const Instruction& instr, Word nextIp, const Prediction& prediction) = 0;
+};
+
+
+class NotTakenPredictor : public IBranchPredictor
+{
+public:
+    Prediction Predict(Word ip, Word length = 4) override
+    {
+        return {ip + length, {}};
+    }
+
+    void Recover(Word, const Instruction&, Word, const Prediction&) override
+    {
+
+    }
+
+    void Update(Word, const Instruction&, Word, const Prediction&) override
+    {
+
+    }
+};
+
+
+// Finds control transfers with the BTB, predicts returns with the RAS and
+// leaves the direction of conditional branches to the derived class.
+// The global history and the RAS are updated speculatively at fetch.
+class BtbPredictor : public IBranchPredictor
+{
+public:
+    explicit BtbPredictor(bool useRas = true)
+            : _useRas(useRas)
+    {
+
+    }
+
+    Prediction Predict(Word ip, Word length = 4) override
+    {
+        Prediction prediction{ip + length, {_history, _rasTop, _ras[_rasTop]}};
+
+        const BtbEntry& entry = _btb[btbIdx(ip)];
+        if (!entry.valid || entry.ip != ip)
+            return prediction;
+
+        switch (entry.kind)
+        {
+            case Kind::Branch:
+            {
+                bool taken = PredictDirection(ip, _history);
+                pushHistory(taken);
+                if (taken)
+                    prediction.nextIp = entry.target;
+                break;
+            }
+            case Kind::Call:
+                pushRas(ip + length);
+                prediction.nextIp = entry.target;
+                break;
+            case Kind::Return:
+                prediction.nextIp = _useRas ? popRas() : entry.target;
+                break;
+            default:
+                prediction.nextIp = entry.target;
+                break;
+        }
+
+        return prediction;
+    }
+
+    // Undoes everything predicted after this instruction, then applies its real outcome
+    void Recover(Word ip, const Instruction& instr, Word nextIp, const Prediction& prediction) override
+    {
+        _history = prediction.checkpoint.history;
+        _rasTop = prediction.checkpoint.rasTop;
+        _ras[_rasTop] = prediction.checkpoint.rasValue;
+
+        if (!isControl(instr))
+            return;
+
+        if (instr._type == IType::Br)
+            pushHistory(nextIp != ip + instr.Length());
+        else if (kindOf(instr) == Kind::Call)
+            pushRas(ip + instr.Length());
+        else if (kindOf(instr) == Kind::Return)
+            popRas();
+    }
+
+    void Update(Word ip, const Instruction& instr, Word nextIp, const Prediction& prediction) override
+    {
+        bool taken = nextIp != ip + instr.Length();
+        BtbEntry& entry = _btb[btbIdx(ip)];
+
+        if (!isControl(instr))
+        {
+            if (entry.valid && entry.ip == ip)
+                entry.valid = false;
+            return;
+        }
+
+        if (instr._type == IType::Br)
+        {
+            TrainDirection(ip, prediction.checkpoint.history, taken);
+
+            // Branches that have never been taken are predicted by the BTB miss
+            if (!taken && !(entry.valid && entry.ip == ip))
+                return;
+        }
+
+        entry.valid = true;
+        entry.ip = ip;
+        entry.kind = kindOf(instr);
+        entry.target = instr._type == IType::Br ? ip + instr._imm : nextIp;
+    }
+
+protected:
+    virtual bool PredictDirection(Word ip, Word history) = 0;
+    virtual void TrainDirection(Word ip, Word history, bool taken) = 0;
+
+    // Saturating 2-bit counters
+    static bool IsTaken(uint8_t counter)
+    {
+        return counter >= 2;
+    }
+
+    static void Count(uint8_t& counter, bool taken)
+    {
+        if (taken && counter < 3)
+            counter++;
+        else if (!taken && counter > 0)
+            counter--;
+    }
+
+private:
+    enum class Kind : uint8_t
+    {
+        Branch,
+        Jump,
+        Call,
+        Return,
+    };
+
+    struct BtbEntry
+    {
+        Word ip = 0;
+        Word target = 0;
+        Kind kind = Kind::Branch;
+        bool valid = false;
+    };
+
+    bool _useRas;
+    std::vector<BtbEntry> _btb = std::vector<BtbEntry>(btbEntries);
+    std::array<Word, rasDepth> _ras{};
+    size_t _rasTop = 0;
+    Word _history = 0;
+
+    static bool isControl(const Instruction& instr)
+    {
+        return instr._type == IType::Br || instr._type == IType::J || instr._type == IType::Jr;
+    }
+
+    // x1 and x5 are the link registers of the calling convention
+    static bool isLink(RId reg)
+    {
+        return reg == 1 || reg == 5;
+    }
+
+    static Kind kindOf(const Instruction& instr)
+    {
+        if (instr._type == IType::Br)
+            return Kind::Branch;
+        if (isLink(instr._dst))
+            return Kind::Call;
+        if (instr._type == IType::Jr && isLink(instr._src1))
+            return Kind::Return;
+        return Kind::Jump;
+    }
+
+    static size_t btbIdx(Word ip)
+    {
+        return (ip >> 2u) % btbEntries;
+    }
+
+    void pushHistory(bool taken)
+    {
+        _history = (_history << 1u) | (taken ? 1 : 0);
+    }
+
+    void pushRas(Word ip)
+    {
+        _rasTop = (_rasTop + 1) % rasDepth;
+        _ras[_rasTop] = ip;
+    }
+
+    Word popRas()
+    {
+        Word ip = _ras[_rasTop];
+        _rasTop = (_rasTop + rasDepth - 1) % rasDepth;
+        return ip;
+    }
+};
+
+
+// A 2-bit counter per branch address
+class BhtPredictor : public BtbPredictor
+{
+public:
+    explicit BhtPredictor(bool useRas = true)
+            : BtbPredictor(useRas)
+    {
+
+    }
+
+protected:
+    bool PredictDirection(Word ip, Word) override
+    {
+        return IsTaken(_counters[idx(ip)]);
+    }
+
+    void TrainDirection(Word ip, Word, bool taken) override
+    {
+        Count(_counters[idx(ip)], taken);
+    }
+
+private:
+    std::vector<uint8_t> _counters = std::vector<uint8_t>(bhtEntries, 1);
+
+    static size_t idx(Word ip)
+    {
+        return (ip >> 2u) % bhtEntries;
+    }
+};
+
+
+// 2-bit counters indexed by the address xor the global branch history
+class GsharePredictor : public BtbPredictor
+{
+public:
+    explicit GsharePredictor(bool useRas = true)
+            : BtbPredictor(useRas)
+    {
+
+    }
+
+protected:
+    bool PredictDirection(Word ip, Word history) override
+    {
+        return IsTaken(_counters[idx(ip, history)]);
+    }
+
+    void TrainDirection(Word ip, Word history, bool taken) override
+    {
+        Count(_counters[idx(ip, history)], taken);
+    }
+
+private:
+    std::vector<uint8_t> _counters = std::vector<uint8_t>(bhtEntries, 1);
+
+    static size_t idx(Word ip, Word history)
+    {
+        return ((ip >> 2u) ^ history) % bhtEntries;
+    }
+};
+
+#endif //RISCV_SIM_BRANCHPREDICTOR_H
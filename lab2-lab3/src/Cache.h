@@ -0,0 +1,182 @@
+#ifndef RISCV_SIM_CACHE_H
+#define RISCV_SIM_CACHE_H
+
+#include "BaseTypes.h"
+#include "Coherence.h"
+#include "Replacement.h"
+
+#include <cassert>
+#include <memory>
+#include <vector>
+
+struct CacheConfig
+{
+    size_t sizeBytes = 0;
+    size_t ways = 0;            // 0 for fully associative
+    size_t lineBytes = 0;
+    size_t hitLatency = 0;
+    ReplacementPolicy policy = ReplacementPolicy::Fifo;
+    uint32_t seed = 1;          // for the policies with random choices
+
+    size_t Lines() const
+    {
+        return lineBytes == 0 ? 0 : sizeBytes / lineBytes;
+    }
+
+    size_t Ways() const
+    {
+        return ways == 0 ? Lines() : ways;
+    }
+
+    size_t Sets() const
+    {
+        return Ways() == 0 ? 0 : Lines() / Ways();
+    }
+
+    // The line size and the number of sets are powers of two, a line holds at least a word.
+    // The tree of pseudo-LRU needs a power of two ways too, at most PlruPolicy::maxWays.
+    bool IsValid() const
+    {
+        return lineBytes >= sizeof(Word) && isPowerOfTwo(lineBytes) && Lines() > 0 &&
+               Lines() % Ways() == 0 && isPowerOfTwo(Sets()) &&
+               (policy != ReplacementPolicy::Plru || (isPowerOfTwo(Ways()) && Ways() <= PlruPolicy::maxWays));
+    }
+
+private:
+    static bool isPowerOfTwo(size_t value)
+    {
+        return value != 0 && (value & (value - 1)) == 0;
+    }
+};
+
+// Tags, states and data of a set-associative cache. An address splits into the
+// offset in the line, the index of the set above it and the tag above that, so
+// a lookup only compares the ways of one set. The line replaced within its set
+// is chosen by the replacement policy of the configuration, which the owner
+// tells about hits and invalidations. An invalidated line keeps its tag until
+// it is replaced.
+class Cache
+{
+public:
+    struct Way
+    {
+        Word tag = ~Word(0);        // no line address has this tag
+        LineState state = LineState::Invalid;
+        Word* words = nullptr;      // the data of the line
+    };
+
+    explicit Cache(const CacheConfig& config)
+            : _config(config), _ways(config.Ways()), _sets(config.Sets()),
+              _lines(config.Lines()), _data(config.Lines() * config.lineBytes / sizeof(Word)),
+              _policy(MakeReplacementPolicy(config.policy, config.Sets(), config.Ways(), config.seed))
+    {
+        assert(config.IsValid());
+        while ((size_t(1) << _offsetBits) < config.lineBytes)
+            _offsetBits++;
+        while ((size_t(1) << _indexBits) < _sets)
+            _indexBits++;
+        for (size_t i = 0; i < _lines.size(); i++)
+            _lines[i].words = &_data[i * LineWords()];
+    }
+
+    Cache(const Cache&) = delete;
+    Cache& operator=(const Cache&) = delete;
+
+    const CacheConfig& Config() const
+    {
+        return _config;
+    }
+
+    size_t LineWords() const
+    {
+        return _config.lineBytes / sizeof(Word);
+    }
+
+    Word LineAddr(Word addr) const
+    {
+        return addr & ~Word(_config.lineBytes - 1);
+    }
+
+    size_t SetIndex(Word addr) const
+    {
+        return (addr >> _offsetBits) & (_sets - 1);
+    }
+
+    Word Tag(Word addr) const
+    {
+        return Word(uint64_t(addr) >> (_offsetBits + _indexBits));
+    }
+
+    // The valid line holding addr, nullptr on a miss
+    Way* Find(Word addr)
+    {
+        Way* set = &_lines[SetIndex(addr) * _ways];
+        Word tag = Tag(addr);
+        for (size_t i = 0; i < _ways; i++)
+        {
+            if (set[i].tag == tag && set[i].state != LineState::Invalid)
+                return &set[i];
+        }
+        return nullptr;
+    }
+
+    // Whether the line of addr has been invalidated and is still waiting to be replaced
+    bool IsInvalidated(Word addr) const
+    {
+        const Way* set = &_lines[SetIndex(addr) * _ways];
+        Word tag = Tag(addr);
+        for (size_t i = 0; i < _ways; i++)
+        {
+            if (set[i].tag == tag && set[i].state == LineState::Invalid)
+                return true;
+        }
+        return false;
+    }
+
+    // The way the line of addr goes to. Its old line, if any, is still there.
+    Way& Victim(Word addr)
+    {
+        size_t set = SetIndex(addr);
+        size_t way = _policy->Victim(set);
+        _policy->Insert(set, way);
+        return _lines[set * _ways + way];
+    }
+
+    // A hit by the core, snoops don't count
+    void Touch(const Way& way)
+    {
+        size_t index = size_t(&way - _lines.data());
+        _policy->Touch(index / _ways, index % _ways);
+    }
+
+    // The line of the way has just been invalidated by a snoop
+    void Invalidated(const Way& way)
+    {
+        size_t index = size_t(&way - _lines.data());
+        _policy->Invalidate(index / _ways, index % _ways);
+    }
+
+    // The address of the line held by a way
+    Word LineAddr(const Way& way) const
+    {
+        size_t set = size_t(&way - _lines.data()) / _ways;
+        return Word((uint64_t(way.tag) << (_offsetBits + _indexBits)) | (set << _offsetBits));
+    }
+
+    Word& WordAt(Way& way, Word addr)
+    {
+        return way.words[(addr & (_config.lineBytes - 1)) / sizeof(Word)];
+    }
+
+private:
+    CacheConfig _config;
+    size_t _ways;
+    size_t _sets;
+    unsigned _offsetBits = 0;
+    unsigned _indexBits = 0;
+    std::vector<Way> _lines;        // the ways of set i start at i * _ways
+    std::vector<Word> _data;
+    std::unique_ptr<IReplacementPolicy> _policy;
+};
+
+#endif //RISCV_SIM_CACHE_H
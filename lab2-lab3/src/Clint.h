@@ -0,0 +1,135 @@
+#ifndef RISCV_SIM_CLINT_H
+#define RISCV_SIM_CLINT_H
+
+#include "BaseTypes.h"
+#include "Instruction.h"
+
+#include <algorithm>
+#include <limits>
+#include <optional>
+#include <vector>
+
+// Core-local interruptor at the usual address: a software interrupt bit and a timer
+// compare register per hart, and the machine timer shared by all of them.
+// The timer counts cycles. Accesses are uncached and take clintLatency cycles.
+static constexpr Word clintBase = 0x02000000;
+static constexpr Word clintSize = 0x10000;
+static constexpr Word clintMsip = clintBase;                // a word per hart
+static constexpr Word clintMtimecmp = clintBase + 0x4000;   // two words per hart
+static constexpr Word clintMtime = clintBase + 0xbff8;
+static constexpr size_t clintLatency = 10;
+
+class Clint
+{
+public:
+    explicit Clint(size_t harts = 1)
+            : _msip(harts), _mtimecmp(harts, std::numeric_limits<uint64_t>::max())
+    {
+
+    }
+
+    static bool Contains(Word addr)
+    {
+        return addr - clintBase < clintSize;
+    }
+
+    Word Read(Word addr) const
+    {
+        if (const uint64_t* reg = timeRegister(addr))
+            return Word(*reg >> (addr & 4u ? 32u : 0u));
+        if (auto hart = msipHart(addr))
+            return _msip[*hart];
+        return 0;
+    }
+
+    // Only the bytes in mask are written
+    void Write(Word addr, Word data, Word mask = ~Word(0))
+    {
+        if (uint64_t* reg = timeRegister(addr))
+        {
+            unsigned shift = addr & 4u ? 32u : 0u;
+            uint64_t bits = uint64_t(mask) << shift;
+            *reg = (*reg & ~bits) | ((uint64_t(data) << shift) & bits);
+        }
+        else if (auto hart = msipHart(addr))
+        {
+            _msip[*hart] = (_msip[*hart] & ~mask & 1u) | (data & mask & 1u);
+        }
+    }
+
+    // A load, store or atomic of a core. A device can't be reserved, SC to it always fails.
+    void Access(Instruction& instr)
+    {
+        Word addr = instr.Addr();
+        if (instr._type == IType::St)
+        {
+            Write(addr, StoreLane(addr, instr._flags, instr._data), AccessMask(addr, instr._flags));
+            return;
+        }
+
+        Word loaded = Read(addr);
+        if (instr._type == IType::Amo)
+            Write(addr, AmoValue(instr._aluFunc, loaded, instr._data));
+        instr._data = instr._type == IType::Sc ? 1 : LoadLane(addr, instr._flags, loaded);
+    }
+
+    void Clock(uint64_t cycles = 1)
+    {
+        _mtime += cycles;
+    }
+
+    uint64_t Time() const
+    {
+        return _mtime;
+    }
+
+    bool TimerPending(size_t hart) const
+    {
+        return hart < _mtimecmp.size() && _mtime >= _mtimecmp[hart];
+    }
+
+    bool SoftwarePending(size_t hart) const
+    {
+        return hart < _msip.size() && _msip[hart] != 0;
+    }
+
+    // Until the first timer that is not pending yet goes off
+    size_t CyclesToTimer() const
+    {
+        uint64_t cycles = std::numeric_limits<size_t>::max();
+        for (uint64_t cmp : _mtimecmp)
+        {
+            if (cmp > _mtime)
+                cycles = std::min(cycles, cmp - _mtime);
+        }
+        return size_t(cycles);
+    }
+
+private:
+    uint64_t _mtime = 0;
+    std::vector<Word> _msip;
+    std::vector<uint64_t> _mtimecmp;
+
+    const uint64_t* timeRegister(Word addr) const
+    {
+        return const_cast<Clint*>(this)->timeRegister(addr);
+    }
+
+    uint64_t* timeRegister(Word addr)
+    {
+        if ((addr & ~7u) == clintMtime)
+            return &_mtime;
+        Word hart = (addr - clintMtimecmp) / 8;
+        if (addr >= clintMtimecmp && hart < _mtimecmp.size())
+            return &_mtimecmp[hart];
+        return nullptr;
+    }
+
+    std::optional<size_t> msipHart(Word addr) const
+    {
+        Word hart = (addr - clintMsip) / 4;
+        return hart < _msip.size() ? std::optional<size_t>(hart) : std::nullopt;
+    }
+};
+
+#endif //RISCV_SIM_CLINT_H
@@ -0,0 +1,101 @@
+#ifndef RISCV_SIM_COHERENCE_H
+#define RISCV_SIM_COHERENCE_H
+
+#include "BaseTypes.h"
+
+#include <array>
+#include <vector>
+
+// Extra cycles of a store to a shared line, the other copies have to be invalidated
+static constexpr size_t upgradeLatency = 20;
+
+enum class LineState : uint8_t
+{
+    Invalid,
+    Shared,
+    Exclusive,      // MESI only, clean and not in any other cache
+    Modified,
+    Count,
+};
+
+enum class Protocol : uint8_t
+{
+    Msi,
+    Mesi,
+};
+
+struct CoherenceStats
+{
+    static constexpr size_t states = static_cast<size_t>(LineState::Count);
+
+    std::array<std::array<uint64_t, states>, states> transitions{};     // [from][to]
+    uint64_t busReads = 0;
+    uint64_t busReadsExclusive = 0;
+    uint64_t busUpgrades = 0;
+    uint64_t snoopFlushes = 0;          // dirty lines written back for another cache
+    uint64_t snoopInvalidations = 0;
+    uint64_t coherenceMisses = 0;       // misses on lines another cache has invalidated
+};
+
+// A cache attached to the bus
+class ISnooper
+{
+public:
+    virtual ~ISnooper() = default;
+
+    // Another cache reads the line, a dirty copy is written back. Returns true if there is a copy.
+    virtual bool SnoopRead(Word lineAddr) = 0;
+
+    // Another cache writes the line, the copy is written back if dirty and dropped
+    virtual bool SnoopInvalidate(Word lineAddr) = 0;
+};
+
+// Snooping bus between private data caches. Transactions are atomic: every other
+// cache has reacted by the time a call returns, so memory holds the latest data.
+class CoherenceBus
+{
+public:
+    explicit CoherenceBus(Protocol protocol = Protocol::Mesi)
+            : _protocol(protocol)
+    {
+
+    }
+
+    Protocol GetProtocol() const
+    {
+        return _protocol;
+    }
+
+    void Attach(ISnooper* cache)
+    {
+        _caches.push_back(cache);
+    }
+
+    // Returns true if another cache keeps a copy
+    bool Read(const ISnooper* from, Word lineAddr)
+    {
+        bool shared = false;
+        for (ISnooper* cache : _caches)
+        {
+            if (cache != from)
+                shared |= cache->SnoopRead(lineAddr);
+        }
+        return shared;
+    }
+
+    // A write miss or a write to a shared line
+    void Invalidate(const ISnooper* from, Word lineAddr)
+    {
+        for (ISnooper* cache : _caches)
+        {
+            if (cache != from)
+                cache->SnoopInvalidate(lineAddr);
+        }
+    }
+
+private:
+    Protocol _protocol;
+    std::vector<ISnooper*> _caches;
+};
+
+#endif //RISCV_SIM_COHERENCE_H
@@ -0,0 +1,224 @@
+#ifndef RISCV_SIM_COMPRESSED_H
+#define RISCV_SIM_COMPRESSED_H
+
+#include "Instruction.h"
+
+// The C extension for RV32 with F: every 16-bit instruction is expanded into the
+// 32-bit one it stands for, which the decoder then decodes as usual. C.FLD, C.FSD
+// and their SP forms need D and are illegal, as are the reserved encodings.
+class Compressed
+{
+public:
+    // Returns the 32-bit encoding, 0 if the parcel is not a legal instruction
+    static Word Expand(Word parcel)
+    {
+        Word funct3 = bits(parcel, 15, 13);
+        switch (parcel & 3u)
+        {
+            case 0b00: return quadrant0(parcel, funct3);
+            case 0b01: return quadrant1(parcel, funct3);
+            case 0b10: return quadrant2(parcel, funct3);
+            default:   return 0;
+        }
+    }
+
+private:
+    static constexpr Word opLoad    = Word(Opcode::Load);
+    static constexpr Word opLoadFp  = Word(Opcode::LoadFp);
+    static constexpr Word opStore   = Word(Opcode::Store);
+    static constexpr Word opStoreFp = Word(Opcode::StoreFp);
+    static constexpr Word opOpImm   = Word(Opcode::OpImm);
+    static constexpr Word opOp      = Word(Opcode::Op);
+    static constexpr Word opLui     = Word(Opcode::Lui);
+    static constexpr Word opBranch  = Word(Opcode::Branch);
+    static constexpr Word opJal     = Word(Opcode::Jal);
+    static constexpr Word opJalr    = Word(Opcode::Jalr);
+    static constexpr Word sp = 2;
+    static constexpr Word ra = 1;
+
+    static Word bits(Word value, unsigned hi, unsigned lo)
+    {
+        return (value >> lo) & ((Word(1) << (hi - lo + 1)) - 1);
+    }
+
+    static Word bit(Word value, unsigned pos)
+    {
+        return (value >> pos) & 1u;
+    }
+
+    static Word signExtend(Word value, unsigned width)
+    {
+        Word sign = Word(1) << (width - 1);
+        return (value ^ sign) - sign;
+    }
+
+    // rd', rs1' and rs2' are x8-x15
+    static Word reg3(Word value, unsigned lo)
+    {
+        return 8 + bits(value, lo + 2, lo);
+    }
+
+    static Word rType(Word opcode, Word rd, Word funct3, Word rs1, Word rs2, Word funct7)
+    {
+        return funct7 << 25u | rs2 << 20u | rs1 << 15u | funct3 << 12u | rd << 7u | opcode;
+    }
+
+    static Word iType(Word opcode, Word rd, Word funct3, Word rs1, Word imm)
+    {
+        return (imm & 0xfffu) << 20u | rs1 << 15u | funct3 << 12u | rd << 7u | opcode;
+    }
+
+    static Word sType(Word opcode, Word funct3, Word rs1, Word rs2, Word imm)
+    {
+        return bits(imm, 11, 5) << 25u | rs2 << 20u | rs1 << 15u | funct3 << 12u | bits(imm, 4, 0) << 7u | opcode;
+    }
+
+    static Word bType(Word funct3, Word rs1, Word rs2, Word imm)
+    {
+        return bit(imm, 12) << 31u | bits(imm, 10, 5) << 25u | rs2 << 20u | rs1 << 15u | funct3 << 12u |
+               bits(imm, 4, 1) << 8u | bit(imm, 11) << 7u | opBranch;
+    }
+
+    static Word jType(Word rd, Word imm)
+    {
+        return bit(imm, 20) << 31u | bits(imm, 10, 1) << 21u | bit(imm, 11) << 20u | bits(imm, 19, 12) << 12u |
+               rd << 7u | opJal;
+    }
+
+    // CJ format offset of C.J and C.JAL
+    static Word jumpOffset(Word c)
+    {
+        Word imm = bit(c, 12) << 11u | bit(c, 11) << 4u | bits(c, 10, 9) << 8u | bit(c, 8) << 10u |
+                   bit(c, 7) << 6u | bit(c, 6) << 7u | bits(c, 5, 3) << 1u | bit(c, 2) << 5u;
+        return signExtend(imm, 12);
+    }
+
+    // CI format immediate
+    static Word immediate6(Word c)
+    {
+        return signExtend(bit(c, 12) << 5u | bits(c, 6, 2), 6);
+    }
+
+    static Word quadrant0(Word c, Word funct3)
+    {
+        Word rd = reg3(c, 2);
+        Word rs1 = reg3(c, 7);
+        Word offset = bits(c, 12, 10) << 3u | bit(c, 6) << 2u | bit(c, 5) << 6u;    // C.LW, C.SW, C.FLW, C.FSW
+        switch (funct3)
+        {
+            case 0b000:
+            {
+                // C.ADDI4SPN
+                Word imm = bits(c, 12, 11) << 4u | bits(c, 10, 7) << 6u | bit(c, 6) << 2u | bit(c, 5) << 3u;
+                return imm == 0 ? 0 : iType(opOpImm, rd, 0b000, sp, imm);
+            }
+            case 0b010: return iType(opLoad, rd, fnLW, rs1, offset);
+            case 0b011: return iType(opLoadFp, rd, fnFLW, rs1, offset);
+            case 0b110: return sType(opStore, fnSW, rs1, rd, offset);
+            case 0b111: return sType(opStoreFp, fnFLW, rs1, rd, offset);
+            default:    return 0;
+        }
+    }
+
+    static Word quadrant1(Word c, Word funct3)
+    {
+        Word rd = bits(c, 11, 7);
+        switch (funct3)
+        {
+            case 0b000: return iType(opOpImm, rd, 0b000, rd, immediate6(c));                // C.ADDI, C.NOP
+            case 0b001: return jType(ra, jumpOffset(c));                                    // C.JAL
+            case 0b010: return iType(opOpImm, rd, 0b000, 0, immediate6(c));                 // C.LI
+            case 0b011:
+            {
+                if (rd == sp)
+                {
+                    // C.ADDI16SP
+                    Word imm = bit(c, 12) << 9u | bit(c, 6) << 4u | bit(c, 5) << 6u | bits(c, 4, 3) << 7u |
+                               bit(c, 2) << 5u;
+                    return imm == 0 ? 0 : iType(opOpImm, sp, 0b000, sp, signExtend(imm, 10));
+                }
+                // C.LUI
+                Word imm = immediate6(c);
+                return imm == 0 ? 0 : (imm & 0xfffffu) << 12u | rd << 7u | opLui;
+            }
+            case 0b100: return arithmetic(c);
+            case 0b101: return jType(0, jumpOffset(c));                                     // C.J
+            case 0b110:
+            case 0b111:
+            {
+                // C.BEQZ, C.BNEZ
+                Word imm = bit(c, 12) << 8u | bits(c, 11, 10) << 3u | bits(c, 6, 5) << 6u | bits(c, 4, 3) << 1u |
+                           bit(c, 2) << 5u;
+                return bType(funct3 == 0b110 ? Word(BrFunc::Eq) : Word(BrFunc::Neq), reg3(c, 7), 0,
+                             signExtend(imm, 9));
+            }
+            default:    return 0;
+        }
+    }
+
+    // C.SRLI, C.SRAI, C.ANDI, C.SUB, C.XOR, C.OR and C.AND on rd'
+    static Word arithmetic(Word c)
+    {
+        Word rd = reg3(c, 7);
+        Word rs2 = reg3(c, 2);
+        switch (bits(c, 11, 10))
+        {
+            case 0b00:
+            case 0b01:
+            {
+                // shamt[5] must be zero on RV32
+                if (bit(c, 12))
+                    return 0;
+                Word funct7 = bits(c, 11, 10) == 0b01 ? 0b0100000 : 0;
+                return rType(opOpImm, rd, Word(AluFunc::Sr), rd, bits(c, 6, 2), funct7);
+            }
+            case 0b10:
+                return iType(opOpImm, rd, Word(AluFunc::And), rd, immediate6(c));
+            default:
+            {
+                if (bit(c, 12))
+                    return 0;       // C.SUBW and C.ADDW are RV64 only
+                switch (bits(c, 6, 5))
+                {
+                    case 0b00: return rType(opOp, rd, Word(AluFunc::Add), rd, rs2, 0b0100000);
+                    case 0b01: return rType(opOp, rd, Word(AluFunc::Xor), rd, rs2, 0);
+                    case 0b10: return rType(opOp, rd, Word(AluFunc::Or), rd, rs2, 0);
+                    default:   return rType(opOp, rd, Word(AluFunc::And), rd, rs2, 0);
+                }
+            }
+        }
+    }
+
+    static Word quadrant2(Word c, Word funct3)
+    {
+        Word rd = bits(c, 11, 7);
+        Word rs2 = bits(c, 6, 2);
+        Word loadOffset = bit(c, 12) << 5u | bits(c, 6, 4) << 2u | bits(c, 3, 2) << 6u;    // C.LWSP, C.FLWSP
+        Word storeOffset = bits(c, 12, 9) << 2u | bits(c, 8, 7) << 6u;                      // C.SWSP, C.FSWSP
+        switch (funct3)
+        {
+            case 0b000:
+                // C.SLLI, shamt[5] must be zero on RV32
+                return bit(c, 12) ? 0 : rType(opOpImm, rd, Word(AluFunc::Sll), rd, rs2, 0);
+            case 0b010: return rd == 0 ? 0 : iType(opLoad, rd, fnLW, sp, loadOffset);
+            case 0b011: return iType(opLoadFp, rd, fnFLW, sp, loadOffset);
+            case 0b100:
+            {
+                if (!bit(c, 12))
+                {
+                    if (rs2 != 0)
+                        return rType(opOp, rd, Word(AluFunc::Add), 0, rs2, 0);         // C.MV
+                    return rd == 0 ? 0 : iType(opJalr, 0, 0b000, rd, 0);               // C.JR
+                }
+                if (rs2 != 0)
+                    return rType(opOp, rd, Word(AluFunc::Add), rd, rs2, 0);            // C.ADD
+                return rd == 0 ? instrEBREAK : iType(opJalr, ra, 0b000, rd, 0);        // C.EBREAK, C.JALR
+            }
+            case 0b110: return sType(opStore, fnSW, sp, rs2, storeOffset);
+            case 0b111: return sType(opStoreFp, fnFLW, sp, rs2, storeOffset);
+            default:    return 0;
+        }
+    }
+};
+
+#endif //RISCV_SIM_COMPRESSED_H
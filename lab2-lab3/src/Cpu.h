@@ -2,18 +2,25 @@
 #define RISCV_SIM_CPU_H
 
 #include "Memory.h"
-#include "Decoder.h"
+#include "DecodeCache.h"
 #include "RegisterFile.h"
 #include "CsrFile.h"
 #include "Executor.h"
+#include "MulDivUnit.h"
+#include "FpUnit.h"
+#include "VectorUnit.h"
+
+#include <limits>
 
 class Cpu
 {
 public:
 
-    Cpu(IMem& mem)
-            : _mem(mem)
+    Cpu(IMem& mem, const MulDivConfig& mulDiv = MulDivConfig(), const VectorConfig& vector = VectorConfig(),
+        const FpuConfig& fpu = FpuConfig())
+            : _mem(mem), _mulDiv(mulDiv), _fpu(fpu), _vector(vector)
     {
+        _mem.SetCounters(&_csrf.Counters());
 
     }
 
@@ -29,6 +36,22 @@ public:
             continueFromWritingBackRequest();
             return;
         }
+        if(continueExecute){
+            continueFromExecute();
+            return;
+        }
+        if(continueWaiting){
+            continueFromWaiting();
+            return;
+        }
+        if(continueVector){
+            continueFromVector();
+            return;
+        }
+
+        // Interrupts are taken between instructions
+        if (auto cause = _csrf.PendingInterrupt())
+            _ip = _csrf.Trap(*cause, _ip);
 
         // Fetch
         _mem.Request(_ip);
@@ -43,29 +66,83 @@ public:
         processInstruction();
     }
 
-    void Reset(Word ip)
+    // While waiting for the memory, the multiplier, the FP unit or the vector unit the core does nothing but count cycles
+    size_t CyclesToNextEvent() const
+    {
+        if (continueRequestForRead || continueRequestForWriteBack)
+            return std::numeric_limits<size_t>::max();
+        if (continueExecute)
+            return _executeCycles - 1;
+        if (continueVector)
+            return _vector.CyclesToNextEvent();
+        if (continueWaiting && _csrf.WaitsForInterrupt())
+            return std::numeric_limits<size_t>::max();
+
+        return 0;
+    }
+
+    void SkipCycles(size_t cycles)
+    {
+        _csrf.Clock(cycles);
+        if (continueExecute)
+            _executeCycles -= cycles;
+        if (continueVector)
+            _vector.SkipCycles(cycles);
+    }
+
+    void Reset(Word ip, Word hartId = 0, Word harts = 1)
     {
-        _csrf.Reset();
+        _csrf.Reset(hartId, harts);
         _ip = ip;
     }
 
+    // Continues from the architectural state reached by another model,
+    // e.g. after fast-forwarding with FunctionalCpu
+    void Restore(Word ip, const RegisterFile& rf, const CsrFile& csrf, const VectorRegisterFile& vrf)
+    {
+        _ip = ip;
+        _rf = rf;
+        _csrf = csrf;
+        _vector.Restore(vrf);
+    }
+
     std::optional<CpuToHostData> GetMessage()
     {
         return _csrf.GetMessage();
     }
 
+    const VectorStats& GetVectorStats() const
+    {
+        return _vector.GetStats();
+    }
+
+    // Timer and software interrupts come from the CLINT
+    void SetClint(Clint* clint)
+    {
+        _csrf.SetClint(clint);
+        _mem.SetClint(clint);
+    }
+
 private:
     Reg32 _ip;              // the same as PC and IAR
     Word _word;
-    Decoder _decoder;
+    DecodeCache _decodeCache;
     RegisterFile _rf;
     CsrFile _csrf;          // used as storage devices for information about instructions received from machines
     IMem& _mem;
+    MulDivUnit _mulDiv;
+    FpUnit _fpu;
+    VectorUnit _vector;
     std::optional <Word> _requestedWord;
 
     bool continueRequestForRead = false;
     bool continueRequestForWriteBack = false;
-    InstructionPtr _instruction;
+    bool continueExecute = false;
+    bool continueWaiting = false;   // WFI until an interrupt is pending
+    bool continueVector = false;
+    size_t _executeCycles = 0;      // left until a multiply, divide or FP operation is done
+    Instruction _instruction;
+    Word _nextIp = 0;
 
     void continueFromInstructionRequest()
     {
@@ -91,7 +168,7 @@ private:
 
         // Advance PC
         _csrf.InstructionExecuted();
-        _ip = _instruction->_nextIp;
+        _ip = _nextIp;
     }
 
     void processInstruction()
@@ -100,16 +177,81 @@ private:
         _word = _requestedWord.value();
 
         // Decode
-        _instruction = _decoder.Decode(_word);
+        _instruction = _decodeCache.Decode(_ip, _word);
 
         // Read
         _csrf.Read(_instruction);
         _rf.Read(_instruction);
 
         // Execute
-        Executor::Execute(_instruction, _ip);
+        _nextIp = Executor::Execute(_instruction, _ip);
+
+        if (_instruction._type == IType::St || _instruction.IsAtomic())
+            _decodeCache.Invalidate(_instruction.Addr());
+
+        if (_instruction.IsMulDiv() || _instruction._type == IType::Fpu)
+        {
+            _executeCycles = (_instruction.IsMulDiv() ? _mulDiv.Latency(_instruction) : _fpu.Latency(_instruction)) - 1;
+            if (_executeCycles > 0)
+            {
+                continueExecute = true;
+                return;
+            }
+        }
 
-        // Write back
+        if (_instruction.IsVector())
+        {
+            _vector.Start(_instruction);
+            if (_instruction._type == IType::Vst)
+                _decodeCache.Invalidate(_instruction, _vector.Registers());
+            if (!_vector.Clock(_mem))
+            {
+                continueVector = true;
+                return;
+            }
+        }
+
+        if (_instruction._type == IType::Wfi && _csrf.WaitsForInterrupt())
+        {
+            continueWaiting = true;
+            return;
+        }
+
+        writeBack();
+    }
+
+    void continueFromWaiting()
+    {
+        if (_csrf.WaitsForInterrupt())
+            return;
+
+        continueWaiting = false;
+
+        writeBack();
+    }
+
+    void continueFromVector()
+    {
+        if (!_vector.Clock(_mem))
+            return;
+
+        continueVector = false;
+
+        writeBack();
+    }
+
+    void continueFromExecute()
+    {
+        if (--_executeCycles > 0)
+            return;
+
+        continueExecute = false;
+
+        writeBack();
+    }
+
+    void writeBack()
+    {
         _mem.Request(_instruction);
 
         if(!_mem.Response(_instruction))
@@ -123,7 +265,7 @@ private:
 
         // Advance PC
         _csrf.InstructionExecuted();
-        _ip = _instruction->_nextIp;
+        _ip = _nextIp;
     }
 
 };
@@ -1,50 +1,200 @@
-
 #ifndef RISCV_SIM_CSRFILE_H
 #define RISCV_SIM_CSRFILE_H
 
 #include <optional>
+#include <limits>
+#include "FloatingPoint.h"
 #include "Instruction.h"
+#include "PerfCounters.h"
+#include "Clint.h"
+
+static constexpr size_t hpmCounters = 29;       // mhpmcounter3..31
+
+// Machine mode only: mstatus keeps MIE and MPIE, MPP always reads as machine mode
+static constexpr Word mstatusMie = 1u << 3u;
+static constexpr Word mstatusMpie = 1u << 7u;
+static constexpr Word mstatusMpp = 3u << 11u;
+static constexpr Word mipMsip = 1u << 3u;
+static constexpr Word mipMtip = 1u << 7u;
+static constexpr Word misaValue = (1u << 30u) | (1u << ('I' - 'A')) | (1u << ('M' - 'A')) | (1u << ('A' - 'A')) |
+                                  (1u << ('F' - 'A')) | (1u << ('C' - 'A'));
+// The FP unit is always on: FS reads as Dirty and cannot be turned off
+static constexpr Word mstatusFs = 3u << 13u;
+static constexpr Word mstatusSd = 1u << 31u;
+static constexpr Word fflagsMask = 0b11111;
+static constexpr Word frmShift = 5;
+
+// The crt.S of the benchmarks has its machine trap entry where the older privileged spec put it
+static constexpr Word mtvecReset = 0x1c0;
 
 class CsrFile
 {
 public:
-    void Reset()
+    void Reset(Word hartId = 0, Word harts = 1)
     {
         numInstr = 0;
         numCycles = 0;
-        coreId = 0;
+        retireCycles = 0;
+        lastRetireCycle = std::numeric_limits<uint64_t>::max();
+        coreId = hartId;
+        numHarts = harts;
+        counters = PerfCounters();
+        hpm.fill(HpmCounter());
+        mstatus = 0;
+        mie = 0;
+        mtvec = mtvecReset;
+        mscratch = 0;
+        mepc = 0;
+        mcause = 0;
+        mtval = 0;
+        fflags = 0;
+        frm = 0;
         cpuToHostData.reset();
         startReg = true;
     }
-    void Read(InstructionPtr& instr)
+    void Read(Instruction& instr)
     {
-        if (!instr->_csr)
+        if (instr._type == IType::Trap)
+            instr._data = mtvec & ~Word(3);     // exceptions always go to the base
+        else if (instr._type == IType::Mret)
+            instr._data = mepc;
+        else if (instr._type == IType::Fpu && instr.Rm() == Word(RoundingMode::Dyn))
+            instr._imm = (instr._imm & ~fpRmMask) | dynamicRm();
+
+        if (instr._type != IType::Csrr && instr._type != IType::Csrrw)
             return;
 
-        switch (static_cast<CsrIdx>(instr->_csr.value()))
+        switch (instr.Csr())
         {
-            case CsrIdx::Instret: instr->_csrVal = numInstr; break;
-            case CsrIdx::Cycle  : instr->_csrVal = numCycles; break;
-            case CsrIdx::Mhartid: instr->_csrVal = coreId; break;
-            default: break;
+            case CsrIdx::Instret:
+            case CsrIdx::Minstret: instr._data = Word(numInstr); break;
+            case CsrIdx::Instreth:
+            case CsrIdx::Minstreth: instr._data = Word(numInstr >> 32u); break;
+            case CsrIdx::Cycle  :
+            case CsrIdx::Mcycle : instr._data = Word(numCycles); break;
+            case CsrIdx::Cycleh :
+            case CsrIdx::Mcycleh: instr._data = Word(numCycles >> 32u); break;
+            case CsrIdx::Time   : instr._data = Word(time()); break;
+            case CsrIdx::Timeh  : instr._data = Word(time() >> 32u); break;
+            case CsrIdx::Mhartid: instr._data = coreId; break;
+            case CsrIdx::Mnumharts: instr._data = numHarts; break;
+            case CsrIdx::Fflags : instr._data = fflags; break;
+            case CsrIdx::Frm    : instr._data = frm; break;
+            case CsrIdx::Fcsr   : instr._data = frm << frmShift | fflags; break;
+            case CsrIdx::Mstatus: instr._data = mstatus | mstatusMpp | mstatusFs | mstatusSd; break;
+            case CsrIdx::Misa   : instr._data = misaValue; break;
+            case CsrIdx::Mie    : instr._data = mie; break;
+            case CsrIdx::Mip    : instr._data = mip(); break;
+            case CsrIdx::Mtvec  : instr._data = mtvec; break;
+            case CsrIdx::Mscratch: instr._data = mscratch; break;
+            case CsrIdx::Mepc   : instr._data = mepc; break;
+            case CsrIdx::Mcause : instr._data = mcause; break;
+            case CsrIdx::Mtval  : instr._data = mtval; break;
+            default: readHpm(instr); break;
         }
     }
-    void Write(InstructionPtr& instr)
+    void Write(const Instruction& instr)
     {
-        if (instr->_type == IType::Csrw && instr->_csr.value_or(CsrIdx::None) == CsrIdx::Mtohost)
+        if (instr._type == IType::Trap)
         {
-            cpuToHostData = CpuToHostData{instr->_data};
+            enterTrap(instr._imm, instr._data);
+            return;
         }
+        if (instr._type == IType::Mret)
+        {
+            mstatus = (mstatus & mstatusMpie ? mstatus | mstatusMie : mstatus & ~mstatusMie) | mstatusMpie;
+            return;
+        }
+        if (instr._type == IType::Fpu)
+        {
+            fflags |= instr.FpFlags();
+            return;
+        }
+        if (instr._type != IType::Csrw && instr._type != IType::Csrrw)
+            return;
+
+        // A Csrrw has read the old value into _data
+        Word value = instr._type == IType::Csrw ? instr._data : CsrValue(instr._aluFunc, instr._data, instr.CsrOperand());
+        switch (instr.Csr())
+        {
+            case CsrIdx::Fflags : fflags = value & fflagsMask; break;
+            case CsrIdx::Frm    : frm = value & fpRmMask; break;
+            case CsrIdx::Fcsr   :
+                fflags = value & fflagsMask;
+                frm = (value >> frmShift) & fpRmMask;
+                break;
+            case CsrIdx::Mtohost: cpuToHostData = CpuToHostData{value}; break;
+            case CsrIdx::Mstatus: mstatus = value & (mstatusMie | mstatusMpie); break;
+            case CsrIdx::Mie    : mie = value & (mipMsip | mipMtip); break;
+            case CsrIdx::Mtvec  : mtvec = value & ~Word(2); break;   // direct or vectored
+            case CsrIdx::Mscratch: mscratch = value; break;
+            case CsrIdx::Mepc   : mepc = value & ~Word(1); break;     // IALIGN is 16 with C
+            case CsrIdx::Mcause : mcause = value; break;
+            case CsrIdx::Mtval  : mtval = value; break;
+            default: writeHpm(instr.Csr(), value); break;
+        }
+    }
+
+    // The interrupt to take before the next instruction, if there is one
+    std::optional<Word> PendingInterrupt() const
+    {
+        if (!(mstatus & mstatusMie))
+            return std::nullopt;
+
+        Word pending = mip() & mie;
+        if (pending & mipMsip)
+            return causeMachineSoftware;
+        if (pending & mipMtip)
+            return causeMachineTimer;
+        return std::nullopt;
+    }
+
+    // WFI waits for an enabled interrupt whether interrupts are on in mstatus or not.
+    // With none enabled nothing could wake it up, so it does not wait at all.
+    bool WaitsForInterrupt() const
+    {
+        return mie != 0 && (mip() & mie) == 0;
+    }
+
+    // Takes a trap before the instruction at epc, returns the address of the handler
+    Word Trap(Word cause, Word epc)
+    {
+        enterTrap(cause, epc);
+
+        Word base = mtvec & ~Word(3);
+        bool vectored = (mtvec & 1u) && (cause & causeInterrupt);
+        return vectored ? base + 4 * (cause & ~causeInterrupt) : base;
     }
 
-    void InstructionExecuted()
+    // Interrupt lines and mtime come from the CLINT, shared by all harts
+    void SetClint(const Clint* device)
     {
-        numInstr++;
+        clint = device;
     }
 
-    void Clock()
+    // Several instructions at once are only retired by the functional model, one per cycle
+    void InstructionExecuted(Word count = 1)
     {
-        numCycles++;
+        numInstr += count;
+        if (count > 1 || lastRetireCycle != numCycles)
+            retireCycles += count;
+        lastRetireCycle = numCycles + count - 1;
+    }
+
+    void Clock(uint64_t cycles = 1)
+    {
+        numCycles += cycles;
+    }
+
+    // Where the core and its caches count their events
+    PerfCounters& Counters()
+    {
+        return counters;
+    }
+
+    bool HasMessage() const
+    {
+        return cpuToHostData.has_value();
     }
 
     std::optional<CpuToHostData> GetMessage()
@@ -54,12 +204,119 @@ public:
         return ret;
     }
 private:
-    Word numInstr = 0;
-    Word numCycles = 0;
+    // Counts the mapped event from the value it had when the counter was last written
+    struct HpmCounter
+    {
+        PerfEvent event = PerfEvent::None;
+        uint64_t offset = 0;
+    };
+
+    uint64_t numInstr = 0;
+    uint64_t numCycles = 0;
+    uint64_t retireCycles = 0;          // cycles in which an instruction retired
+    uint64_t lastRetireCycle = std::numeric_limits<uint64_t>::max();
     Word coreId = 0;
+    Word numHarts = 1;
+    Word mstatus = 0;
+    Word mie = 0;
+    Word mtvec = mtvecReset;
+    Word mscratch = 0;
+    Word mepc = 0;
+    Word mcause = 0;
+    Word mtval = 0;
+    Word fflags = 0;
+    Word frm = 0;
+    const Clint* clint = nullptr;
+    PerfCounters counters;
+    std::array<HpmCounter, hpmCounters> hpm{};
     std::optional<CpuToHostData> cpuToHostData;
     bool startReg = false;
 
+    // frm holding a reserved mode would make the instruction illegal, it rounds to nearest even instead
+    Word dynamicRm() const
+    {
+        return FloatingPoint::IsValid(RoundingMode(frm)) ? frm : Word(RoundingMode::Rne);
+    }
+
+    uint64_t time() const
+    {
+        return clint ? clint->Time() : numCycles;
+    }
+
+    Word mip() const
+    {
+        if (!clint)
+            return 0;
+        return (clint->SoftwarePending(coreId) ? mipMsip : 0) | (clint->TimerPending(coreId) ? mipMtip : 0);
+    }
+
+    void enterTrap(Word cause, Word epc)
+    {
+        mepc = epc;
+        mcause = cause;
+        mtval = 0;
+        mstatus = (mstatus & mstatusMie ? mstatus | mstatusMpie : mstatus & ~mstatusMpie) & ~mstatusMie;
+    }
+
+    static std::optional<size_t> hpmIndex(CsrIdx csr, CsrIdx first)
+    {
+        Word offset = Word(csr) - Word(first);
+        return offset < hpmCounters ? std::optional<size_t>(offset) : std::nullopt;
+    }
+
+    uint64_t eventCount(PerfEvent event) const
+    {
+        switch (event)
+        {
+            case PerfEvent::None: return 0;
+            case PerfEvent::StallCycle: return numCycles - retireCycles;
+            default: return counters.Get(event);
+        }
+    }
+
+    uint64_t hpmValue(size_t idx) const
+    {
+        return eventCount(hpm[idx].event) + hpm[idx].offset;
+    }
+
+    void setHpmValue(size_t idx, uint64_t value)
+    {
+        hpm[idx].offset = value - eventCount(hpm[idx].event);
+    }
+
+    void readHpm(Instruction& instr) const
+    {
+        if (auto idx = hpmIndex(instr.Csr(), CsrIdx::Hpmcounter3))
+            instr._data = Word(hpmValue(*idx));
+        else if (auto idx = hpmIndex(instr.Csr(), CsrIdx::Mhpmcounter3))
+            instr._data = Word(hpmValue(*idx));
+        else if (auto idx = hpmIndex(instr.Csr(), CsrIdx::Hpmcounter3h))
+            instr._data = Word(hpmValue(*idx) >> 32u);
+        else if (auto idx = hpmIndex(instr.Csr(), CsrIdx::Mhpmcounter3h))
+            instr._data = Word(hpmValue(*idx) >> 32u);
+        else if (auto idx = hpmIndex(instr.Csr(), CsrIdx::Mhpmevent3))
+            instr._data = Word(hpm[*idx].event);
+    }
+
+    void writeHpm(CsrIdx csr, Word data)
+    {
+        if (auto idx = hpmIndex(csr, CsrIdx::Mhpmevent3))
+        {
+            // The counter keeps its value and goes on with the new event
+            uint64_t value = hpmValue(*idx);
+            hpm[*idx].event = data < Word(PerfEvent::Count) ? PerfEvent(data) : PerfEvent::None;
+            setHpmValue(*idx, value);
+        }
+        else if (auto idx = hpmIndex(csr, CsrIdx::Mhpmcounter3))
+        {
+            setHpmValue(*idx, (hpmValue(*idx) & ~uint64_t(0xffffffff)) | data);
+        }
+        else if (auto idx = hpmIndex(csr, CsrIdx::Mhpmcounter3h))
+        {
+            setHpmValue(*idx, (hpmValue(*idx) & 0xffffffff) | (uint64_t(data) << 32u));
+        }
+    }
+
 };
 
 #endif //RISCV_SIM_CSRFILE_H
@@ -0,0 +1,81 @@
+#ifndef RISCV_SIM_DECODECACHE_H
+#define RISCV_SIM_DECODECACHE_H
+
+#include "Decoder.h"
+#include "Memory.h"
+#include "VectorUnit.h"
+
+static constexpr size_t decodeCacheSize = 4096; // entries, must be a power of two
+
+// Direct-mapped cache of already decoded instructions indexed by PC.
+// An entry is used only if both its address and raw word match the fetched ones,
+// so a modified instruction is never executed from a stale record. Only the low
+// half of the word belongs to a 16-bit instruction.
+class DecodeCache
+{
+public:
+    const Instruction& Decode(Word ip, Word word)
+    {
+        Entry& entry = _entries[Index(ip)];
+        if (InstructionLength(word) == 2)
+            word &= 0xffffu;
+
+        if (!entry.valid || entry.ip != ip || entry.word != word)
+        {
+            entry.instr = _decoder.Decode(word);
+            entry.ip = ip;
+            entry.word = word;
+            entry.valid = true;
+            _decodes++;
+        }
+
+        return entry.instr;
+    }
+
+    // Words decoded so far, one for every Decode that missed
+    uint64_t Decodes() const
+    {
+        return _decodes;
+    }
+
+    // Drops all entries that belong to the line with the given address
+    void Invalidate(Word addr)
+    {
+        Word lineAddr = ToLineAddr(addr);
+
+        for (size_t i = 0; i < lineSizeBytes / 2; i++)
+        {
+            Word ip = lineAddr + (i << 1u);
+            Entry& entry = _entries[Index(ip)];
+            if (entry.ip == ip)
+                entry.valid = false;
+        }
+    }
+
+    // Drops the entries of every line a vector store writes
+    void Invalidate(const Instruction& store, const VectorRegisterFile& vrf)
+    {
+        for (Word i = 0; i < vrf.Vl(); i++)
+            Invalidate(vrf.ElementAddr(store, i));
+    }
+
+private:
+    struct Entry
+    {
+        Word ip = 0;
+        Word word = 0;
+        bool valid = false;
+        Instruction instr;
+    };
+
+    static size_t Index(Word ip)
+    {
+        return (ip >> 1u) & (decodeCacheSize - 1);
+    }
+
+    Decoder _decoder;
+    std::vector<Entry> _entries = std::vector<Entry>(decodeCacheSize);
+    uint64_t _decodes = 0;
+};
+
+#endif //RISCV_SIM_DECODECACHE_H
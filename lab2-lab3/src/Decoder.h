@@ -3,17 +3,30 @@
 #define RISCV_SIM_DECODER_H
 
 #include "Instruction.h"
+#include "Compressed.h"
+#include "Executor.h"
 
 // This decoder implementation is stateless, so it could be a function as well
 class Decoder
 {
 
 public:
-    InstructionPtr Decode(Word data)
+    // A 16-bit instruction is in the low half of data, the upper half is not looked at
+    Instruction Decode(Word data)
+    {
+        if (InstructionLength(data) == 4)
+            return decode(data);
+
+        Instruction instr = decode(Compressed::Expand(data & 0xffffu));
+        instr._flags |= flagCompressed;
+        return instr;
+    }
+
+    Instruction decode(Word data)
     {
         DecodedInstr decoded{data};
 
-        InstructionPtr instr = std::make_unique<Instruction>();
+        Instruction instr;
         Imm immI = SignExtend(decoded.i.imm11_0, 11);
         Imm immS = SignExtend(decoded.s.imm11_5 << 5u | decoded.s.imm4_0, 11);
         Word immU = decoded.u.imm31_12 << 12u;
@@ -28,127 +41,349 @@ public:
         {
             case Opcode::OpImm:
             {
-                instr->_imm = immI;
-                instr->_type = IType::Alu;
-                instr->_aluFunc = static_cast<AluFunc>(decoded.i.funct3);
-                if (instr->_aluFunc == AluFunc::Sr)
+                instr._imm = immI;
+                instr._flags = flagImm;
+                instr._type = IType::Alu;
+                instr._aluFunc = static_cast<AluFunc>(decoded.i.funct3);
+                if (instr._aluFunc == AluFunc::Sr)
                 {
-                    instr->_aluFunc = decoded.r.aluSel ? AluFunc::Sra : AluFunc::Srl;
-                    instr->_imm.value() &= 31u;
+                    instr._aluFunc = decoded.r.aluSel ? AluFunc::Sra : AluFunc::Srl;
+                    instr._imm &= 31u;
                 }
-                instr->_dst = RId(decoded.i.rd);
-                instr->_src1 = RId(decoded.i.rs1);
+                instr._dst = RId(decoded.i.rd);
+                instr._src1 = RId(decoded.i.rs1);
                 break;
             }
             case Opcode::Op:
             {
-                instr->_type = IType::Alu;
+                instr._type = IType::Alu;
                 auto funct3 = AluFunc(decoded.r.funct3);
-                if (funct3 == AluFunc::Add)
+                if (data >> 25u == fn7MULDIV)
                 {
-                    instr->_aluFunc = decoded.r.aluSel == 0 ? AluFunc::Add : AluFunc::Sub;
+                    instr._aluFunc = AluFunc(uint8_t(AluFunc::Mul) + decoded.r.funct3);
+                }
+                else if (funct3 == AluFunc::Add)
+                {
+                    instr._aluFunc = decoded.r.aluSel == 0 ? AluFunc::Add : AluFunc::Sub;
                 }
                 else if (funct3 == AluFunc::Sr)
                 {
-                    instr->_aluFunc = decoded.r.aluSel ? AluFunc::Sra : AluFunc::Srl;
+                    instr._aluFunc = decoded.r.aluSel ? AluFunc::Sra : AluFunc::Srl;
                 }
                 else
                 {
-                    instr->_aluFunc = funct3;
+                    instr._aluFunc = funct3;
                 }
-                instr->_dst = RId(decoded.r.rd);
-                instr->_src1 = RId(decoded.r.rs1);
-                instr->_src2 = RId(decoded.r.rs2);
+                instr._dst = RId(decoded.r.rd);
+                instr._src1 = RId(decoded.r.rs1);
+                instr._src2 = RId(decoded.r.rs2);
                 break;
             }
             case Opcode::Lui:
             {
-                instr->_type = IType::Alu;
-                instr->_aluFunc = AluFunc::Add;
-                instr->_dst = RId(decoded.u.rd);
-                instr->_src1 = 0;
-                instr->_imm = immU;
+                instr._type = IType::Alu;
+                instr._aluFunc = AluFunc::Add;
+                instr._dst = RId(decoded.u.rd);
+                instr._src1 = 0;
+                instr._imm = immU;
+                instr._flags = flagImm;
                 break;
             }
             case Opcode::Auipc:
             {
-                instr->_type = IType::Auipc;
-                instr->_dst = RId(decoded.u.rd);
-                instr->_imm = immU;
+                instr._type = IType::Auipc;
+                instr._dst = RId(decoded.u.rd);
+                instr._imm = immU;
                 break;
             }
             case Opcode::Jal:
             {
-                instr->_type = IType::J;
-                instr->_brFunc = BrFunc::AT;
-                instr->_dst = RId(decoded.j.rd);
-                instr->_imm = immJ;
+                instr._type = IType::J;
+                instr._brFunc = BrFunc::AT;
+                instr._dst = RId(decoded.j.rd);
+                instr._imm = immJ;
                 break;
             }
             case Opcode::Jalr:
             {
-                instr->_type = IType::Jr;
-                instr->_brFunc = BrFunc::AT;
-                instr->_dst = RId(decoded.i.rd);
-                instr->_src1 = RId(decoded.i.rs1);
-                instr->_imm = immI;
+                instr._type = IType::Jr;
+                instr._brFunc = BrFunc::AT;
+                instr._dst = RId(decoded.i.rd);
+                instr._src1 = RId(decoded.i.rs1);
+                instr._imm = immI;
                 break;
             }
             case Opcode::Branch:
             {
-                instr->_type = IType::Br;
-                instr->_brFunc = static_cast<BrFunc>(decoded.b.funct3);
-                instr->_src1 = RId(decoded.b.rs1);
-                instr->_src2 = RId(decoded.b.rs2);
-                instr->_imm = immB;
+                instr._type = IType::Br;
+                instr._brFunc = static_cast<BrFunc>(decoded.b.funct3);
+                instr._src1 = RId(decoded.b.rs1);
+                instr._src2 = RId(decoded.b.rs2);
+                instr._imm = immB;
                 break;
             }
             case Opcode::Load:
             {
-                instr->_type = decoded.i.funct3 == fnLW ? IType::Ld : IType::Unsupported;
-                instr->_aluFunc = AluFunc::Add;
-                instr->_dst = RId(decoded.i.rd);
-                instr->_src1 = RId(decoded.i.rs1);
-                instr->_imm = immI;
+                instr._type = IType::Ld;
+                switch (decoded.i.funct3)
+                {
+                    case fnLW:  break;
+                    case fnLB:  instr._flags = flagByte; break;
+                    case fnLH:  instr._flags = flagHalf; break;
+                    case fnLBU: instr._flags = flagByte | flagUnsigned; break;
+                    case fnLHU: instr._flags = flagHalf | flagUnsigned; break;
+                    default:    instr._type = IType::Unsupported; break;
+                }
+                instr._aluFunc = AluFunc::Add;
+                instr._dst = RId(decoded.i.rd);
+                instr._src1 = RId(decoded.i.rs1);
+                instr._imm = immI;
                 break;
             }
             case Opcode::Store:
             {
-                instr->_type = decoded.i.funct3 == fnSW ? IType::St : IType::Unsupported;
-                instr->_aluFunc = AluFunc::Add;
-                instr->_src1 = RId(decoded.s.rs1);
-                instr->_src2 = RId(decoded.s.rs2);
-                instr->_imm = immS;
+                instr._type = IType::St;
+                switch (decoded.s.funct3)
+                {
+                    case fnSW: break;
+                    case fnSB: instr._flags = flagByte; break;
+                    case fnSH: instr._flags = flagHalf; break;
+                    default:   instr._type = IType::Unsupported; break;
+                }
+                instr._aluFunc = AluFunc::Add;
+                instr._src1 = RId(decoded.s.rs1);
+                instr._src2 = RId(decoded.s.rs2);
+                instr._imm = immS;
                 break;
             }
             case Opcode::System:
             {
-                if (decoded.i.funct3 == fnCSRRW && decoded.i.rd == 0)
+                if (decoded.i.funct3 == fnPRIV)
                 {
-                    instr->_type = IType::Csrw;
+                    switch (data)
+                    {
+                        case instrECALL:
+                            instr._type = IType::Trap;
+                            instr._imm = causeMachineEcall;
+                            break;
+                        case instrEBREAK:
+                            instr._type = IType::Trap;
+                            instr._imm = causeBreakpoint;
+                            break;
+                        case instrMRET:
+                        case instrERET:
+                            instr._type = IType::Mret;
+                            break;
+                        case instrWFI:
+                            instr._type = IType::Wfi;
+                            break;
+                        default:
+                            break;
+                    }
+                    break;
                 }
-                else if (decoded.i.funct3 == fnCSRRS && decoded.i.rs1 == 0)
+
+                instr._type = IType::Csrrw;
+                switch (decoded.i.funct3)
                 {
-                    instr->_type = IType::Csrr;
+                    case fnCSRRW:
+                    case fnCSRRWI: instr._aluFunc = AluFunc::Swap; break;
+                    case fnCSRRS:
+                    case fnCSRRSI: instr._aluFunc = AluFunc::Or; break;
+                    case fnCSRRC:
+                    case fnCSRRCI: instr._aluFunc = AluFunc::And; break;
+                    default:       instr._type = IType::Unsupported; break;
                 }
-                instr->_dst = RId(decoded.i.rd);
-                instr->_src1 = RId(decoded.i.rs1);
-                instr->_csr = static_cast<CsrIdx>(immI & 0xfff);
+
+                // The immediate forms have uimm in the rs1 field
+                bool uimm = decoded.i.funct3 >= fnCSRRWI;
+                instr._dst = RId(decoded.i.rd);
+                instr._src1 = uimm ? 0 : RId(decoded.i.rs1);
+                instr._imm = (immI & csrIdxMask) | (uimm ? Word(decoded.i.rs1) << csrUimmShift : 0);
+                instr._flags = uimm ? flagImm : 0;
+
+                // Setting or clearing no bits doesn't write, swapping into x0 doesn't read
+                if (instr._type == IType::Csrrw && instr._aluFunc != AluFunc::Swap && decoded.i.rs1 == 0)
+                    instr._type = IType::Csrr;
+                else if (instr._type == IType::Csrrw && instr._aluFunc == AluFunc::Swap && decoded.i.rd == 0)
+                    instr._type = IType::Csrw;
                 break;
             }
-            // LR SC FENCE AMO not implemented
-            case Opcode::MiscMem:
             case Opcode::Amo:
+            {
+                if (decoded.r.funct3 != fnAMOW)
+                    break;
+
+                instr._type = IType::Amo;
+                switch (data >> 27u)
+                {
+                    case fnLR:      instr._type = IType::Lr; break;
+                    case fnSC:      instr._type = IType::Sc; break;
+                    case fnAMOSWAP: instr._aluFunc = AluFunc::Swap; break;
+                    case fnAMOADD:  instr._aluFunc = AluFunc::Add; break;
+                    case fnAMOXOR:  instr._aluFunc = AluFunc::Xor; break;
+                    case fnAMOAND:  instr._aluFunc = AluFunc::And; break;
+                    case fnAMOOR:   instr._aluFunc = AluFunc::Or; break;
+                    case fnAMOMIN:  instr._aluFunc = AluFunc::Min; break;
+                    case fnAMOMAX:  instr._aluFunc = AluFunc::Max; break;
+                    case fnAMOMINU: instr._aluFunc = AluFunc::Minu; break;
+                    case fnAMOMAXU: instr._aluFunc = AluFunc::Maxu; break;
+                    default:        instr._type = IType::Unsupported; break;
+                }
+                instr._dst = RId(decoded.r.rd);
+                instr._src1 = RId(decoded.r.rs1);
+                if (instr._type != IType::Lr)
+                    instr._src2 = RId(decoded.r.rs2);
+                break;
+            }
+            case Opcode::OpV:
+            {
+                if (decoded.r.funct3 == fnOPCFG)
+                {
+                    // vsetvli only
+                    if (data >> 31u == 0)
+                    {
+                        instr._type = IType::Vset;
+                        instr._dst = RId(decoded.i.rd);
+                        instr._src1 = RId(decoded.i.rs1);
+                        instr._imm = decoded.i.imm11_0 & 0x7ffu;
+                    }
+                    break;
+                }
+
+                Word funct6 = data >> 26u;
+                bool unmasked = (data >> 25u) & 1u;
+                instr._type = IType::Valu;
+                instr._aluFunc = AluFunc::Add;
+                instr._imm = decoded.r.rd | (decoded.r.rs2 << 10u);
+                switch (decoded.r.funct3)
+                {
+                    case fnOPIVV:
+                        instr._type = funct6 == fn6VADD ? IType::Valu : IType::Unsupported;
+                        instr._imm |= decoded.r.rs1 << 5u;
+                        break;
+                    case fnOPIVX:
+                        instr._type = funct6 == fn6VADD ? IType::Valu : IType::Unsupported;
+                        instr._flags = flagScalar;
+                        instr._src1 = RId(decoded.r.rs1);
+                        break;
+                    case fnOPIVI:
+                        instr._type = funct6 == fn6VADD ? IType::Valu : IType::Unsupported;
+                        instr._flags = flagImm;
+                        instr._imm |= Word(SignExtend(decoded.r.rs1, 4)) << 15u;
+                        break;
+                    case fnOPMVV:
+                        if (funct6 == fn6VMUL)
+                            instr._aluFunc = AluFunc::Mul;
+                        else if (funct6 == fn6VREDSUM)
+                            instr._flags = flagReduce;
+                        else
+                            instr._type = IType::Unsupported;
+                        instr._imm |= decoded.r.rs1 << 5u;
+                        break;
+                    case fnOPMVX:
+                        instr._type = funct6 == fn6VMUL ? IType::Valu : IType::Unsupported;
+                        instr._aluFunc = AluFunc::Mul;
+                        instr._flags = flagScalar;
+                        instr._src1 = RId(decoded.r.rs1);
+                        break;
+                    default:
+                        instr._type = IType::Unsupported;
+                        break;
+                }
+                if (!unmasked)
+                    instr._type = IType::Unsupported;
+                break;
+            }
+            case Opcode::LoadFp:
+            case Opcode::StoreFp:
+            {
+                if (decoded.r.funct3 == fnFLW)
+                {
+                    instr._src1 = RId(decoded.i.rs1);
+                    if (static_cast<Opcode>(decoded.i.opcode) == Opcode::LoadFp)
+                    {
+                        instr._type = IType::Ld;
+                        instr._dst = RId(fpRegBase + decoded.i.rd);
+                        instr._imm = immI;
+                    }
+                    else
+                    {
+                        instr._type = IType::St;
+                        instr._src2 = RId(fpRegBase + decoded.s.rs2);
+                        instr._imm = immS;
+                    }
+                    break;
+                }
+
+                // vle32 and vse32 with nf = 0 and mew = 0, unmasked
+                Word mop = (data >> 26u) & 3u;
+                bool unmasked = (data >> 25u) & 1u;
+                if (decoded.r.funct3 != fnVE32 || (data >> 28u) != 0 || !unmasked ||
+                    (mop == mopUNIT && decoded.r.rs2 != 0) || (mop != mopUNIT && mop != mopSTRIDED))
+                    break;
+
+                instr._type = static_cast<Opcode>(decoded.i.opcode) == Opcode::LoadFp ? IType::Vld : IType::Vst;
+                instr._src1 = RId(decoded.r.rs1);
+                if (mop == mopSTRIDED)
+                {
+                    instr._flags = flagStrided;
+                    instr._src2 = RId(decoded.r.rs2);
+                }
+                instr._imm = decoded.r.rd;
+                break;
+            }
+            case Opcode::OpFp:
+                decodeFp(data, instr);
+                break;
+            case Opcode::Madd:
+            case Opcode::Msub:
+            case Opcode::Nmsub:
+            case Opcode::Nmadd:
+            {
+                // fmt = S
+                if (((data >> 25u) & 3u) != 0)
+                    break;
+
+                instr._type = IType::Fpu;
+                instr._aluFunc = AluFunc(uint8_t(AluFunc::FMadd) + ((decoded.i.opcode >> 2u) & 3u));
+                instr._dst = RId(fpRegBase + decoded.r.rd);
+                instr._src1 = RId(fpRegBase + decoded.r.rs1);
+                instr._src2 = RId(fpRegBase + decoded.r.rs2);
+                instr._imm = decoded.r.funct3 | Word(fpRegBase + (data >> 27u)) << fpSrc3Shift;
+                break;
+            }
+            case Opcode::MiscMem:
+            {
+                // FENCE and FENCE.I: addi x0, x0, 0
+                if (decoded.i.funct3 == fnFENCE || decoded.i.funct3 == fnFENCEI)
+                {
+                    instr._type = IType::Alu;
+                    instr._aluFunc = AluFunc::Add;
+                    instr._flags = flagImm;
+                }
+                break;
+            }
             default:
             {
-                instr->_type = IType::Unsupported;
-                instr->_aluFunc = AluFunc::None;
-                instr->_brFunc = BrFunc::NT;
+                instr._type = IType::Unsupported;
+                instr._aluFunc = AluFunc::None;
+                instr._brFunc = BrFunc::NT;
             }
         }
 
-        if (instr->_dst.value_or(0) == 0)
-            instr->_dst.reset();
+        // rm = 101 and 110 are reserved
+        if (instr._type == IType::Fpu && (instr.Rm() == 0b101 || instr.Rm() == 0b110))
+            instr._type = IType::Unsupported;
+
+        if (instr._type == IType::Unsupported)
+        {
+            instr = Instruction();
+            instr._type = IType::Trap;
+            instr._imm = causeIllegalInstruction;
+        }
+
+        instr._op = Executor::HandlerIndex(instr);
 
         return instr;
     }
@@ -156,6 +391,77 @@ public:
 private:
     using Imm = int32_t;
 
+    // OpFp with fmt = S. Operations without a rounding mode keep funct3 in _imm, which is never dynamic.
+    static void decodeFp(Word data, Instruction& instr)
+    {
+        Word funct7 = data >> 25u;
+        Word funct3 = (data >> 12u) & 7u;
+        Word rs2 = (data >> 20u) & 31u;
+        RId rd = RId((data >> 7u) & 31u);
+        RId rs1 = RId((data >> 15u) & 31u);
+
+        // Which of the registers are x registers
+        bool intDst = false;
+        bool intSrc = false;
+        bool unary = false;
+        AluFunc func = AluFunc::None;
+        switch (funct7)
+        {
+            case fn7FADD: func = AluFunc::FAdd; break;
+            case fn7FSUB: func = AluFunc::FSub; break;
+            case fn7FMUL: func = AluFunc::FMul; break;
+            case fn7FDIV: func = AluFunc::FDiv; break;
+            case fn7FSQRT:
+                func = rs2 == 0 ? AluFunc::FSqrt : AluFunc::None;
+                unary = true;
+                break;
+            case fn7FSGNJ:
+                func = funct3 <= 0b010 ? AluFunc(uint8_t(AluFunc::FSgnj) + funct3) : AluFunc::None;
+                break;
+            case fn7FMINMAX:
+                func = funct3 <= 0b001 ? AluFunc(uint8_t(AluFunc::FMin) + funct3) : AluFunc::None;
+                break;
+            case fn7FCMP:
+                func = funct3 == 0b010 ? AluFunc::FEq : funct3 == 0b001 ? AluFunc::FLt :
+                       funct3 == 0b000 ? AluFunc::FLe : AluFunc::None;
+                intDst = true;
+                break;
+            case fn7FCVTWS:
+                func = rs2 <= 1 ? AluFunc(uint8_t(AluFunc::FCvtWS) + rs2) : AluFunc::None;
+                intDst = true;
+                unary = true;
+                break;
+            case fn7FCVTSW:
+                func = rs2 <= 1 ? AluFunc(uint8_t(AluFunc::FCvtSW) + rs2) : AluFunc::None;
+                intSrc = true;
+                unary = true;
+                break;
+            case fn7FMVXW:
+                func = rs2 != 0 ? AluFunc::None : funct3 == 0b000 ? AluFunc::FMvXW :
+                       funct3 == 0b001 ? AluFunc::FClass : AluFunc::None;
+                intDst = true;
+                unary = true;
+                break;
+            case fn7FMVWX:
+                func = rs2 == 0 && funct3 == 0b000 ? AluFunc::FMvWX : AluFunc::None;
+                intSrc = true;
+                unary = true;
+                break;
+            default:
+                break;
+        }
+        if (func == AluFunc::None)
+            return;
+
+        instr._type = IType::Fpu;
+        instr._aluFunc = func;
+        instr._dst = intDst ? rd : RId(fpRegBase + rd);
+        instr._src1 = intSrc ? rs1 : RId(fpRegBase + rs1);
+        if (!unary)
+            instr._src2 = RId(fpRegBase + rs2);
+        instr._imm = funct3;
+    }
+
     Imm SignExtend(Imm i, unsigned sbit)
     {
         return i + ((0xffffffff << (sbit + 1)) * ((i & (1u << sbit)) >> sbit));
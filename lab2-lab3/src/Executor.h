@@ -1,163 +1,221 @@
 #ifndef RISCV_SIM_EXECUTOR_H
 #define RISCV_SIM_EXECUTOR_H
 
+#include <utility>
+
+#include "FloatingPoint.h"
 #include "Instruction.h"
 
+// Every operation has its own handler generated from the templates below.
+// The decoder picks the handler index once, so executing an instruction is
+// a single indirect call.
 class Executor
 {
 public:
-    static void Execute(InstructionPtr& instr, Word ip)
+    using Handler = Word (*)(Instruction& instr, Word ip);
+
+    // Returns the address of the next instruction
+    static Word Execute(Instruction& instr, Word ip)
     {
-        instr->_nextIp = ip + 4;    // by default
+        return handlers[instr._op](instr, ip);
+    }
 
-        switch (instr->_type) {
+    // The handlers of the other types come first, so index 0 is the one of an
+    // Unsupported instruction and an instruction that hasn't been decoded does nothing
+    static uint8_t HandlerIndex(const Instruction& instr)
+    {
+        switch (instr._type)
+        {
             case IType::Alu:
-            {
+                return otherHandlers + static_cast<uint8_t>(instr._aluFunc) * 2 + ((instr._flags & flagImm) ? 1 : 0);
+            case IType::Br:
+                return otherHandlers + aluHandlers + static_cast<uint8_t>(instr._brFunc);
+            case IType::Fpu:
+                return otherHandlers + aluHandlers + brHandlers +
+                       static_cast<uint8_t>(instr._aluFunc) - static_cast<uint8_t>(AluFunc::FAdd);
+            default:
+                return static_cast<uint8_t>(instr._type);
+        }
+    }
+
+private:
+    static constexpr size_t aluHandlers = (static_cast<size_t>(AluFunc::None) + 1) * 2;
+    static constexpr size_t brHandlers = static_cast<size_t>(BrFunc::NT) + 1;
+    static constexpr size_t otherHandlers = static_cast<size_t>(IType::Fpu) + 1;
+    static constexpr size_t fpuHandlers = static_cast<size_t>(AluFunc::FNmadd) - static_cast<size_t>(AluFunc::FAdd) + 1;
+    static constexpr size_t handlerCount = aluHandlers + brHandlers + otherHandlers + fpuHandlers;
+    static_assert(handlerCount <= 256, "A handler index has to fit in Instruction::_op");
 
-                if (instr->_src1.has_value() && instr->_imm.has_value())
-                    aluFunc(instr, instr->_imm.value());
-                else if (instr->_src1.has_value() && instr->_src2.has_value())
-                    aluFunc(instr, instr->_src2Val);
+    static const std::array<Handler, handlerCount> handlers;
 
-                return;
-            }
+    static constexpr Word signMin = Word(1) << 31u;
 
-            case IType::Br:
-                if (!instr->_src1.has_value() || !instr->_src2.has_value())
-                    return;
-
-                switch (instr->_brFunc) {
-                    case BrFunc::Eq:
-                        if (instr->_src1Val == instr->_src2Val)
-                            instr->_nextIp = ip + instr->_imm.value();
-                        return;
-                    case BrFunc::Neq:
-                        if (instr->_src1Val != instr->_src2Val)
-                            instr->_nextIp = ip + instr->_imm.value();
-                        return;
-                    case BrFunc::Lt:
-                        if (signedLessThan(instr->_src1Val, instr->_src2Val))
-                            instr->_nextIp = ip + instr->_imm.value();
-                        return;
-                    case BrFunc::Ltu:
-                        if (instr->_src1Val < instr->_src2Val)
-                            instr->_nextIp = ip + instr->_imm.value();
-                        return;
-                    case BrFunc::Ge:
-                        if (!signedLessThan(instr->_src1Val, instr->_src2Val))
-                            instr->_nextIp = ip + instr->_imm.value();
-                        return;
-                    case BrFunc::Geu:
-                        if (instr->_src1Val >= instr->_src2Val)
-                            instr->_nextIp = ip + instr->_imm.value();
-                        return;
-                    case BrFunc::AT:
-                        instr->_nextIp = ip + instr->_imm.value();
-                        return;
-                    case BrFunc::NT:
-                        return;
-                }
-            case IType::Ld:
-                instr->_addr = instr->_src1Val + instr->_imm.value();
-                return;
+    template <AluFunc func, bool imm>
+    static Word alu(Instruction& instr, Word ip)
+    {
+        instr._data = aluOp<func>(instr._src1Val, imm ? instr._imm : instr._src2Val);
+        return ip + instr.Length();
+    }
+
+    template <BrFunc func>
+    static Word branch(Instruction& instr, Word ip)
+    {
+        return taken<func>(instr._src1Val, instr._src2Val) ? ip + instr._imm : ip + instr.Length();
+    }
+
+    template <IType type>
+    static Word other(Instruction& instr, Word ip)
+    {
+        switch (type)
+        {
             case IType::St:
-                instr->_addr = instr->_src1Val + instr->_imm.value();
-                instr->_data = instr->_src2Val;
-                return;
-            case IType::Csrr:
-                instr->_data = instr->_csrVal;
-                return;
+            case IType::Sc:
+            case IType::Amo:            // the memory combines it with the loaded value
+                instr._data = instr._src2Val;
+                return ip + instr.Length();
             case IType::Csrw:
-                instr->_data = instr->_src1Val;
-                return;
+                instr._data = instr.CsrOperand();
+                return ip + instr.Length();
             case IType::J:
-                instr->_data = ip + 4;
-                instr->_nextIp = ip + instr->_imm.value();
-                return;
+                instr._data = ip + instr.Length();
+                return ip + instr._imm;
             case IType::Jr:
-                instr->_data = ip + 4;
-                instr->_nextIp = instr->_src1Val + instr->_imm.value();
-                return;
+                instr._data = ip + instr.Length();
+                return instr._src1Val + instr._imm;
             case IType::Auipc:
-                instr->_data = ip + instr->_imm.value();
-                return;
-            case IType::Unsupported:
-                return;
+                instr._data = ip + instr._imm;
+                return ip + instr.Length();
+            case IType::Trap:
+            {
+                // CsrFile has read the handler address, the trap is taken when the instruction writes back
+                Word handler = instr._data;
+                instr._data = ip;
+                return handler;
+            }
+            case IType::Mret:           // CsrFile has read mepc
+                return instr._data;
+            default:                    // Csrr, Csrrw: CsrFile has already read the value into _data, Lr: the memory loads it,
+                return ip + instr.Length();     // vector instructions: the vector unit does all of the work
         }
     }
 
-private:
-
-    static bool checkIsNegative(Word w){
-        return (w & (1u << 31u)) != 0;
+    // CsrFile has replaced a dynamic rounding mode, rs3 of a fused multiply-add is in _data
+    template <AluFunc func>
+    static Word fpu(Instruction& instr, Word ip)
+    {
+        uint8_t flags = 0;
+        instr._data = fpuOp<func>(instr._src1Val, instr._src2Val, instr._data, RoundingMode(instr.Rm()), flags);
+        instr._imm = (instr._imm & ~fpFlagsMask) | Word(flags) << fpFlagsShift;
+        return ip + instr.Length();
     }
 
-    static Word twosComplementAbs(Word w){
-        if(checkIsNegative(w)){
-            return ~w + 1;
+    template <AluFunc func>
+    static Word fpuOp(Word a, Word b, Word c, RoundingMode rm, uint8_t& flags)
+    {
+        switch (func)
+        {
+            case AluFunc::FAdd:    return FloatingPoint::Add(a, b, rm, flags);
+            case AluFunc::FSub:    return FloatingPoint::Sub(a, b, rm, flags);
+            case AluFunc::FMul:    return FloatingPoint::Mul(a, b, rm, flags);
+            case AluFunc::FDiv:    return FloatingPoint::Div(a, b, rm, flags);
+            case AluFunc::FSqrt:   return FloatingPoint::Sqrt(a, rm, flags);
+            case AluFunc::FSgnj:   return (a & ~fpSign) | (b & fpSign);
+            case AluFunc::FSgnjn:  return (a & ~fpSign) | (~b & fpSign);
+            case AluFunc::FSgnjx:  return a ^ (b & fpSign);
+            case AluFunc::FMin:    return FloatingPoint::Min(a, b, flags);
+            case AluFunc::FMax:    return FloatingPoint::Max(a, b, flags);
+            case AluFunc::FEq:     return FloatingPoint::Eq(a, b, flags);
+            case AluFunc::FLt:     return FloatingPoint::Lt(a, b, flags);
+            case AluFunc::FLe:     return FloatingPoint::Le(a, b, flags);
+            case AluFunc::FClass:  return FloatingPoint::Class(a);
+            case AluFunc::FCvtWS:  return FloatingPoint::ToInt(a, false, rm, flags);
+            case AluFunc::FCvtWuS: return FloatingPoint::ToInt(a, true, rm, flags);
+            case AluFunc::FCvtSW:  return FloatingPoint::FromInt(a, false, rm, flags);
+            case AluFunc::FCvtSWu: return FloatingPoint::FromInt(a, true, rm, flags);
+            case AluFunc::FMadd:   return FloatingPoint::Fma(a, b, c, rm, flags);
+            case AluFunc::FMsub:   return FloatingPoint::Fma(a, b, c ^ fpSign, rm, flags);
+            case AluFunc::FNmsub:  return FloatingPoint::Fma(a ^ fpSign, b, c, rm, flags);
+            case AluFunc::FNmadd:  return FloatingPoint::Fma(a ^ fpSign, b, c ^ fpSign, rm, flags);
+            default:               return a;    // FMvXW, FMvWX
         }
-        return w;
     }
 
-    static void aluFunc(InstructionPtr& instr, Word secondOperand) {
-        switch (instr->_aluFunc) {
-            case AluFunc::Add:
-                instr->_data = instr->_src1Val + secondOperand;
-                break;
-            case AluFunc::Sub:
-                instr->_data = instr->_src1Val + (~secondOperand + 1);
-                break;
-            case AluFunc::And:
-                instr->_data = instr->_src1Val & secondOperand;
-                break;
-            case AluFunc::Or:
-                instr->_data = instr->_src1Val | secondOperand;
-                break;
-            case AluFunc::Xor:
-                instr->_data = instr->_src1Val ^ secondOperand;
-                break;
-            case AluFunc::Slt:
-                instr->_data = signedLessThan(instr->_src1Val, secondOperand);
-                break;
-            case AluFunc::Sltu:
-                instr->_data = instr->_src1Val < secondOperand;
-                break;
-            case AluFunc::Sll:
-                instr->_data = instr->_src1Val << (secondOperand % 32);
-                break;
-            case AluFunc::Srl:
-                instr->_data = instr->_src1Val >> (secondOperand % 32);
-                break;
-            case AluFunc::Sra:
-                if (checkIsNegative(instr->_src1Val)) {
-                    Word unsignedShift = instr->_src1Val >> (secondOperand % 32);
-                    Word addedBits = (1u << 31u) - (1u << (31 - secondOperand % 32));
-                    instr->_data = unsignedShift | addedBits | (1u << 31u);
-                } else
-                    instr->_data = instr->_src1Val >> (secondOperand % 32);
-                break;
+    template <AluFunc func>
+    static constexpr Word aluOp(Word a, Word b)
+    {
+        switch (func)
+        {
+            case AluFunc::Add:  return a + b;
+            case AluFunc::Sub:  return a - b;
+            case AluFunc::And:  return a & b;
+            case AluFunc::Or:   return a | b;
+            case AluFunc::Xor:  return a ^ b;
+            case AluFunc::Slt:  return SignedWord(a) < SignedWord(b);
+            case AluFunc::Sltu: return a < b;
+            case AluFunc::Sll:  return a << (b % 32);
+            case AluFunc::Srl:  return a >> (b % 32);
+            case AluFunc::Sra:  return Word(SignedWord(a) >> (b % 32));
+            case AluFunc::Mul:    return a * b;
+            case AluFunc::Mulh:   return Word(uint64_t(int64_t(SignedWord(a)) * int64_t(SignedWord(b))) >> 32u);
+            case AluFunc::Mulhsu: return Word(uint64_t(int64_t(SignedWord(a)) * int64_t(b)) >> 32u);
+            case AluFunc::Mulhu:  return Word((uint64_t(a) * uint64_t(b)) >> 32u);
+            // Division by zero and overflow give the results defined by the spec, no trap
+            case AluFunc::Div:
+                if (b == 0)
+                    return ~Word(0);
+                if (a == signMin && SignedWord(b) == -1)
+                    return a;
+                return Word(SignedWord(a) / SignedWord(b));
+            case AluFunc::Divu: return b == 0 ? ~Word(0) : a / b;
+            case AluFunc::Rem:
+                if (b == 0)
+                    return a;
+                if (a == signMin && SignedWord(b) == -1)
+                    return 0;
+                return Word(SignedWord(a) % SignedWord(b));
+            case AluFunc::Remu: return b == 0 ? a : a % b;
+            default:            return 0;
         }
     }
 
-    static bool signedLessThan(Word fi, Word sec){
-
-        if(checkIsNegative(fi) && !checkIsNegative(sec)){
-            return true;
-        }
-        if(!checkIsNegative(fi) && checkIsNegative(sec)){
-            return false;
-        }
-        if(!checkIsNegative(fi) && !checkIsNegative(sec)){
-            return fi < sec;
+    template <BrFunc func>
+    static constexpr bool taken(Word a, Word b)
+    {
+        switch (func)
+        {
+            case BrFunc::Eq:  return a == b;
+            case BrFunc::Neq: return a != b;
+            case BrFunc::Lt:  return SignedWord(a) < SignedWord(b);
+            case BrFunc::Ltu: return a < b;
+            case BrFunc::Ge:  return SignedWord(a) >= SignedWord(b);
+            case BrFunc::Geu: return a >= b;
+            case BrFunc::AT:  return true;
+            default:          return false;
         }
-        if(checkIsNegative(fi) && checkIsNegative(sec)){
-            Word absFi = twosComplementAbs(fi);
-            Word absSec = twosComplementAbs(sec);
+    }
 
-            return absFi > absSec;
-        }
+    template <size_t idx>
+    static constexpr Handler handler()
+    {
+        if constexpr (idx < otherHandlers)
+            return &other<static_cast<IType>(idx)>;
+        else if constexpr (idx < otherHandlers + aluHandlers)
+            return &alu<static_cast<AluFunc>((idx - otherHandlers) / 2), (idx - otherHandlers) % 2 == 1>;
+        else if constexpr (idx < otherHandlers + aluHandlers + brHandlers)
+            return &branch<static_cast<BrFunc>(idx - otherHandlers - aluHandlers)>;
+        else
+            return &fpu<static_cast<AluFunc>(idx - otherHandlers - aluHandlers - brHandlers +
+                                             static_cast<size_t>(AluFunc::FAdd))>;
+    }
 
+    template <size_t... idx>
+    static constexpr std::array<Handler, handlerCount> makeHandlers(std::index_sequence<idx...>)
+    {
+        return {handler<idx>()...};
     }
 };
 
-#endif // RISCV_SIM_EXECUTOR_H
\ No newline at end of file
+inline const std::array<Executor::Handler, Executor::handlerCount> Executor::handlers =
+        Executor::makeHandlers(std::make_index_sequence<Executor::handlerCount>());
+
+#endif // RISCV_SIM_EXECUTOR_H
@@ -0,0 +1,568 @@
+#ifndef RISCV_SIM_FLOATINGPOINT_H
+#define RISCV_SIM_FLOATINGPOINT_H
+
+#include <algorithm>
+#include <cfenv>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include "BaseTypes.h"
+
+// fflags
+constexpr uint8_t fpInexact    = 0b1;       // NX
+constexpr uint8_t fpUnderflow  = 0b10;      // UF
+constexpr uint8_t fpOverflow   = 0b100;     // OF
+constexpr uint8_t fpDivByZero  = 0b1000;    // DZ
+constexpr uint8_t fpInvalid    = 0b10000;   // NV
+
+enum class RoundingMode : uint8_t
+{
+    Rne = 0b000,
+    Rtz = 0b001,
+    Rdn = 0b010,
+    Rup = 0b011,
+    Rmm = 0b100,
+    Dyn = 0b111,    // frm, only in an instruction
+};
+
+constexpr Word fpCanonicalNan = 0x7fc00000;
+constexpr Word fpSign = Word(1) << 31u;
+
+// Single-precision arithmetic on the bits of the registers. Round to nearest even,
+// the default, uses the host FPU and takes the flags from the host. The other
+// rounding modes go through exact integer arithmetic below, as does everything
+// the host does differently: NaN results are always the canonical NaN, and
+// conversions to integers saturate as the spec says.
+// The host detects tininess after rounding like RISC-V, so the flags agree.
+class FloatingPoint
+{
+public:
+    static Word Add(Word a, Word b, RoundingMode rm, uint8_t& flags)
+    {
+        if (rm == RoundingMode::Rne)
+            return host([](float x, float y) { return x + y; }, a, b, flags);
+        return addSoft(a, b, rm, flags);
+    }
+
+    static Word Sub(Word a, Word b, RoundingMode rm, uint8_t& flags)
+    {
+        return Add(a, b ^ fpSign, rm, flags);
+    }
+
+    static Word Mul(Word a, Word b, RoundingMode rm, uint8_t& flags)
+    {
+        if (rm == RoundingMode::Rne)
+            return host([](float x, float y) { return x * y; }, a, b, flags);
+        return mulSoft(a, b, rm, flags);
+    }
+
+    static Word Div(Word a, Word b, RoundingMode rm, uint8_t& flags)
+    {
+        if (rm == RoundingMode::Rne)
+            return host([](float x, float y) { return x / y; }, a, b, flags);
+        return divSoft(a, b, rm, flags);
+    }
+
+    static Word Sqrt(Word a, RoundingMode rm, uint8_t& flags)
+    {
+        if (rm == RoundingMode::Rne)
+            return host([](float x, float) { return std::sqrt(x); }, a, 0, flags);
+        return sqrtSoft(a, rm, flags);
+    }
+
+    // a * b + c with a single rounding
+    static Word Fma(Word a, Word b, Word c, RoundingMode rm, uint8_t& flags)
+    {
+        // The host does not raise invalid for inf * 0 + qNaN
+        if (rm == RoundingMode::Rne && !isNan(c))
+        {
+            volatile float x = toFloat(a), y = toFloat(b), z = toFloat(c);
+            std::feclearexcept(FE_ALL_EXCEPT);
+            volatile float r = std::fma(float(x), float(y), float(z));
+            return fromHost(r, flags);
+        }
+        return fmaSoft(a, b, c, rm, flags);
+    }
+
+    // IEEE 754-2019 minimumNumber and maximumNumber: a NaN is only returned if both are
+    static Word Min(Word a, Word b, uint8_t& flags)
+    {
+        return minMax(a, b, true, flags);
+    }
+
+    static Word Max(Word a, Word b, uint8_t& flags)
+    {
+        return minMax(a, b, false, flags);
+    }
+
+    // FEQ is a quiet comparison, FLT and FLE are signaling ones
+    static Word Eq(Word a, Word b, uint8_t& flags)
+    {
+        if (isSignalingNan(a) || isSignalingNan(b))
+            flags |= fpInvalid;
+        return !isNan(a) && !isNan(b) && toFloat(a) == toFloat(b);
+    }
+
+    static Word Lt(Word a, Word b, uint8_t& flags)
+    {
+        if (isNan(a) || isNan(b))
+        {
+            flags |= fpInvalid;
+            return 0;
+        }
+        return toFloat(a) < toFloat(b);
+    }
+
+    static Word Le(Word a, Word b, uint8_t& flags)
+    {
+        if (isNan(a) || isNan(b))
+        {
+            flags |= fpInvalid;
+            return 0;
+        }
+        return toFloat(a) <= toFloat(b);
+    }
+
+    // One bit set: -inf, -normal, -subnormal, -0, +0, +subnormal, +normal, +inf, sNaN, qNaN
+    static Word Class(Word a)
+    {
+        bool sign = a >> 31u;
+        Word exp = (a >> 23u) & 0xffu;
+        if (isSignalingNan(a))
+            return 1u << 8u;
+        if (isNan(a))
+            return 1u << 9u;
+        if (isInf(a))
+            return sign ? 1u << 0u : 1u << 7u;
+        if (isZero(a))
+            return sign ? 1u << 3u : 1u << 4u;
+        if (exp == 0)
+            return sign ? 1u << 2u : 1u << 5u;
+        return sign ? 1u << 1u : 1u << 6u;
+    }
+
+    // FCVT.W.S and FCVT.WU.S: out of range values and NaNs saturate and raise invalid
+    static Word ToInt(Word a, bool isUnsigned, RoundingMode rm, uint8_t& flags)
+    {
+        Word maxPositive = isUnsigned ? ~Word(0) : 0x7fffffffu;
+        if (isNan(a))
+        {
+            flags |= fpInvalid;
+            return maxPositive;
+        }
+
+        bool sign = a >> 31u;
+        Word minNegative = isUnsigned ? 0 : 0x80000000u;
+        if (isInf(a))
+        {
+            flags |= fpInvalid;
+            return sign ? minNegative : maxPositive;
+        }
+        if (isZero(a))
+            return 0;
+
+        Unpacked x = unpack(a);
+        uint64_t magnitude;
+        bool inexact = false;
+        if (x.exp >= 0)
+            magnitude = x.exp < 40 ? x.sig << x.exp : ~uint64_t(0);
+        else
+            magnitude = roundBits(sign, x.sig, false, -x.exp, rm, inexact);
+
+        uint64_t limit = sign ? (isUnsigned ? 0 : uint64_t(1) << 31u) : maxPositive;
+        if (magnitude > limit)
+        {
+            flags |= fpInvalid;
+            return sign ? minNegative : maxPositive;
+        }
+
+        if (inexact)
+            flags |= fpInexact;
+        return sign ? Word(-SignedWord(magnitude)) : Word(magnitude);
+    }
+
+    // FCVT.S.W and FCVT.S.WU
+    static Word FromInt(Word a, bool isUnsigned, RoundingMode rm, uint8_t& flags)
+    {
+        if (rm == RoundingMode::Rne)
+        {
+            volatile double exact = isUnsigned ? double(a) : double(SignedWord(a));
+            float r = float(exact);
+            if (double(r) != exact)
+                flags |= fpInexact;
+            return fromFloat(r);
+        }
+
+        bool sign = !isUnsigned && SignedWord(a) < 0;
+        uint64_t magnitude = sign ? uint64_t(-int64_t(SignedWord(a))) : uint64_t(a);
+        if (magnitude == 0)
+            return 0;
+        return roundPack(sign, 0, magnitude, false, rm, flags);
+    }
+
+    static bool IsValid(RoundingMode rm)
+    {
+        return rm <= RoundingMode::Rmm;
+    }
+
+private:
+    // A finite nonzero value is sig * 2^exp
+    struct Unpacked
+    {
+        bool sign;
+        int exp;
+        uint64_t sig;
+    };
+
+    static float toFloat(Word a)
+    {
+        float f;
+        std::memcpy(&f, &a, sizeof(f));
+        return f;
+    }
+
+    static Word fromFloat(float f)
+    {
+        Word a;
+        std::memcpy(&a, &f, sizeof(a));
+        return a;
+    }
+
+    static bool isNan(Word a)
+    {
+        return (a & ~fpSign) > 0x7f800000u;
+    }
+
+    static bool isSignalingNan(Word a)
+    {
+        return isNan(a) && !(a & 0x00400000u);
+    }
+
+    static bool isInf(Word a)
+    {
+        return (a & ~fpSign) == 0x7f800000u;
+    }
+
+    static bool isZero(Word a)
+    {
+        return (a & ~fpSign) == 0;
+    }
+
+    static Unpacked unpack(Word a)
+    {
+        bool sign = a >> 31u;
+        Word exp = (a >> 23u) & 0xffu;
+        Word mantissa = a & 0x7fffffu;
+        if (exp == 0)
+            return Unpacked{sign, -149, mantissa};
+        return Unpacked{sign, int(exp) - 150, mantissa | 0x800000u};
+    }
+
+    // The operands go through volatile variables, so nothing is folded or moved past the flags
+    template <typename Op>
+    static Word host(Op op, Word a, Word b, uint8_t& flags)
+    {
+        volatile float x = toFloat(a), y = toFloat(b);
+        std::feclearexcept(FE_ALL_EXCEPT);
+        volatile float r = op(float(x), float(y));
+        return fromHost(r, flags);
+    }
+
+    static Word fromHost(float r, uint8_t& flags)
+    {
+        int raised = std::fetestexcept(FE_ALL_EXCEPT);
+        flags |= ((raised & FE_INEXACT) ? fpInexact : 0) | ((raised & FE_UNDERFLOW) ? fpUnderflow : 0) |
+                 ((raised & FE_OVERFLOW) ? fpOverflow : 0) | ((raised & FE_DIVBYZERO) ? fpDivByZero : 0) |
+                 ((raised & FE_INVALID) ? fpInvalid : 0);
+        return std::isnan(r) ? fpCanonicalNan : fromFloat(r);
+    }
+
+    static Word nanResult(Word a, Word b, uint8_t& flags)
+    {
+        if (isSignalingNan(a) || isSignalingNan(b))
+            flags |= fpInvalid;
+        return fpCanonicalNan;
+    }
+
+    static Word invalid(uint8_t& flags)
+    {
+        flags |= fpInvalid;
+        return fpCanonicalNan;
+    }
+
+    // sig >> shift rounded to an integer, the bits shifted out and sticky are the fraction
+    static uint64_t roundBits(bool sign, uint64_t sig, bool sticky, int shift, RoundingMode rm, bool& inexact)
+    {
+        if (shift > 64)
+        {
+            sticky = sticky || sig != 0;
+            sig = 0;
+            shift = 64;
+        }
+
+        uint64_t kept = shift == 64 ? 0 : sig >> shift;
+        uint64_t rem = shift == 64 ? sig : sig & ((uint64_t(1) << shift) - 1);
+        uint64_t half = uint64_t(1) << (shift - 1);
+        inexact = rem != 0 || sticky;
+
+        bool up = false;
+        switch (rm)
+        {
+            case RoundingMode::Rne: up = rem > half || (rem == half && (sticky || (kept & 1u))); break;
+            case RoundingMode::Rmm: up = rem >= half; break;
+            case RoundingMode::Rdn: up = inexact && sign; break;
+            case RoundingMode::Rup: up = inexact && !sign; break;
+            default:                break;      // Rtz
+        }
+        return kept + (up ? 1 : 0);
+    }
+
+    static Word overflow(bool sign, RoundingMode rm)
+    {
+        bool toInf = rm == RoundingMode::Rne || rm == RoundingMode::Rmm ||
+                     (rm == RoundingMode::Rup && !sign) || (rm == RoundingMode::Rdn && sign);
+        return (sign ? fpSign : 0) | (toInf ? 0x7f800000u : 0x7f7fffffu);
+    }
+
+    // Rounds sig * 2^exp, sticky means there is more below the last bit of sig
+    static Word roundPack(bool sign, int exp, uint64_t sig, bool sticky, RoundingMode rm, uint8_t& flags)
+    {
+        int zeros = __builtin_clzll(sig);
+        sig <<= zeros;
+        exp -= zeros;
+
+        // Exponent of the leading bit, 24 bits are kept of a normal result
+        int e = exp + 63;
+        Word signBit = sign ? fpSign : 0;
+        bool inexact = false;
+        if (e < -126)
+        {
+            // Tiny if it stays below the smallest normal number once rounded to 24 bits
+            bool tiny = e < -127 || (roundBits(sign, sig, sticky, 40, rm, inexact) >> 24u) == 0;
+            uint64_t m = roundBits(sign, sig, sticky, 40 - 126 - e, rm, inexact);
+            if (inexact)
+                flags |= fpInexact | (tiny ? fpUnderflow : 0);
+            return signBit | Word(m);   // rounded up to 2^23 it becomes the smallest normal number
+        }
+
+        uint64_t m = roundBits(sign, sig, sticky, 40, rm, inexact);
+        if (m >> 24u)
+        {
+            m >>= 1u;
+            e++;
+        }
+        if (inexact)
+            flags |= fpInexact;
+        if (e > 127)
+        {
+            flags |= fpOverflow | fpInexact;
+            return overflow(sign, rm);
+        }
+        return signBit | (Word(e + 127) << 23u) | (Word(m) & 0x7fffffu);
+    }
+
+    // 128-bit version, shifted into 64 bits with the rest as sticky
+    static Word roundPack128(bool sign, int exp, unsigned __int128 sig, bool sticky, RoundingMode rm, uint8_t& flags)
+    {
+        uint64_t high = uint64_t(sig >> 64u);
+        if (high != 0)
+        {
+            int shift = 64 - __builtin_clzll(high);
+            sticky = sticky || (sig & ((((unsigned __int128)1) << shift) - 1)) != 0;
+            sig >>= shift;
+            exp += shift;
+        }
+        return roundPack(sign, exp, uint64_t(sig), sticky, rm, flags);
+    }
+
+    // An exact zero is positive, except when rounding down
+    static Word exactZero(RoundingMode rm)
+    {
+        return rm == RoundingMode::Rdn ? fpSign : 0;
+    }
+
+    static Word addSoft(Word a, Word b, RoundingMode rm, uint8_t& flags)
+    {
+        if (isNan(a) || isNan(b))
+            return nanResult(a, b, flags);
+        if (isInf(a) || isInf(b))
+        {
+            if (isInf(a) && isInf(b) && ((a ^ b) & fpSign))
+                return invalid(flags);
+            return isInf(a) ? a : b;
+        }
+        if (isZero(a) && isZero(b))
+            return ((a ^ b) & fpSign) ? exactZero(rm) : a;
+        if (isZero(a))
+            return b;
+        if (isZero(b))
+            return a;
+
+        Unpacked x = unpack(a), y = unpack(b);
+        if (x.exp < y.exp)
+            std::swap(x, y);
+
+        // x is shifted up as far as it stays exact, what y has below that is only sticky
+        int d = x.exp - y.exp;
+        int shiftX = std::min(d, 39);
+        int dropY = d - shiftX;
+        uint64_t big = x.sig << shiftX;
+        uint64_t small = dropY >= 64 ? 0 : y.sig >> dropY;
+        bool sticky = dropY >= 64 ? y.sig != 0 : (y.sig & ((uint64_t(1) << dropY) - 1)) != 0;
+        int exp = x.exp - shiftX;
+
+        if (x.sign == y.sign)
+            return roundPack(x.sign, exp, big + small, sticky, rm, flags);
+        if (big > small)
+            return roundPack(x.sign, exp, big - small - (sticky ? 1 : 0), sticky, rm, flags);
+        if (big < small)
+            return roundPack(y.sign, exp, small - big, false, rm, flags);
+        return exactZero(rm);
+    }
+
+    static Word mulSoft(Word a, Word b, RoundingMode rm, uint8_t& flags)
+    {
+        if (isNan(a) || isNan(b))
+            return nanResult(a, b, flags);
+
+        Word sign = (a ^ b) & fpSign;
+        if (isInf(a) || isInf(b))
+            return isZero(a) || isZero(b) ? invalid(flags) : sign | 0x7f800000u;
+        if (isZero(a) || isZero(b))
+            return sign;
+
+        Unpacked x = unpack(a), y = unpack(b);
+        return roundPack(sign != 0, x.exp + y.exp, x.sig * y.sig, false, rm, flags);
+    }
+
+    static Word divSoft(Word a, Word b, RoundingMode rm, uint8_t& flags)
+    {
+        if (isNan(a) || isNan(b))
+            return nanResult(a, b, flags);
+
+        Word sign = (a ^ b) & fpSign;
+        if (isInf(a))
+            return isInf(b) ? invalid(flags) : sign | 0x7f800000u;
+        if (isInf(b))
+            return sign;
+        if (isZero(b))
+        {
+            if (isZero(a))
+                return invalid(flags);
+            flags |= fpDivByZero;
+            return sign | 0x7f800000u;
+        }
+        if (isZero(a))
+            return sign;
+
+        // The dividend goes up to bit 62, so the quotient has at least 39 bits
+        Unpacked x = unpack(a), y = unpack(b);
+        int shift = __builtin_clzll(x.sig) - 1;
+        uint64_t dividend = x.sig << shift;
+        return roundPack(sign != 0, x.exp - shift - y.exp, dividend / y.sig, dividend % y.sig != 0, rm, flags);
+    }
+
+    static Word sqrtSoft(Word a, RoundingMode rm, uint8_t& flags)
+    {
+        if (isNan(a))
+            return nanResult(a, a, flags);
+        if (isZero(a))
+            return a;
+        if (a & fpSign)
+            return invalid(flags);
+        if (isInf(a))
+            return a;
+
+        // An even exponent and at least 62 bits, the root has at least 31
+        Unpacked x = unpack(a);
+        int shift = __builtin_clzll(x.sig) - 1;
+        if ((x.exp - shift) % 2 != 0)
+            shift++;
+        uint64_t n = x.sig << shift;
+
+        auto root = uint64_t(std::sqrt(static_cast<long double>(n)));
+        while ((unsigned __int128)(root) * root > n)
+            root--;
+        while ((unsigned __int128)(root + 1) * (root + 1) <= n)
+            root++;
+
+        return roundPack(false, (x.exp - shift) / 2, root, root * root != n, rm, flags);
+    }
+
+    static Word fmaSoft(Word a, Word b, Word c, RoundingMode rm, uint8_t& flags)
+    {
+        bool infTimesZero = (isInf(a) && isZero(b)) || (isZero(a) && isInf(b));
+        if (isNan(a) || isNan(b) || isNan(c))
+        {
+            if (infTimesZero)
+                flags |= fpInvalid;
+            return nanResult(nanResult(a, b, flags), c, flags);
+        }
+        if (infTimesZero)
+            return invalid(flags);
+
+        Word productSign = (a ^ b) & fpSign;
+        if (isInf(a) || isInf(b))
+        {
+            if (isInf(c) && (c & fpSign) != productSign)
+                return invalid(flags);
+            return productSign | 0x7f800000u;
+        }
+        if (isInf(c))
+            return c;
+        if (isZero(a) || isZero(b))
+        {
+            if (!isZero(c))
+                return c;
+            return (c & fpSign) == productSign ? c : exactZero(rm);
+        }
+
+        Unpacked x = unpack(a), y = unpack(b);
+        Unpacked p{productSign != 0, x.exp + y.exp, x.sig * y.sig};
+        if (isZero(c))
+            return roundPack(p.sign, p.exp, p.sig, false, rm, flags);
+
+        // As in addSoft, with the 48 bits of the product there is room for a shift of 78
+        Unpacked z = unpack(c);
+        Unpacked hi = p, lo = z;
+        if (hi.exp < lo.exp)
+            std::swap(hi, lo);
+        int d = hi.exp - lo.exp;
+        int shiftHi = std::min(d, 78);
+        int dropLo = d - shiftHi;
+        unsigned __int128 big = (unsigned __int128)(hi.sig) << shiftHi;
+        unsigned __int128 small = dropLo >= 64 ? 0 : lo.sig >> dropLo;
+        bool sticky = dropLo >= 64 ? lo.sig != 0 : (lo.sig & ((uint64_t(1) << dropLo) - 1)) != 0;
+        int exp = hi.exp - shiftHi;
+
+        if (hi.sign == lo.sign)
+            return roundPack128(hi.sign, exp, big + small, sticky, rm, flags);
+        if (big > small)
+            return roundPack128(hi.sign, exp, big - small - (sticky ? 1 : 0), sticky, rm, flags);
+        if (big < small)
+            return roundPack128(lo.sign, exp, small - big, false, rm, flags);
+        return exactZero(rm);
+    }
+
+    static Word minMax(Word a, Word b, bool min, uint8_t& flags)
+    {
+        if (isSignalingNan(a) || isSignalingNan(b))
+            flags |= fpInvalid;
+        if (isNan(a) && isNan(b))
+            return fpCanonicalNan;
+        if (isNan(a))
+            return b;
+        if (isNan(b))
+            return a;
+
+        // -0 is less than +0 here
+        if (isZero(a) && isZero(b))
+            return min ? a | b : a & b;
+
+        bool less = toFloat(a) < toFloat(b);
+        return less == min ? a : b;
+    }
+};
+
+#endif //RISCV_SIM_FLOATINGPOINT_H
@@ -0,0 +1,88 @@
+#ifndef RISCV_SIM_FPUNIT_H
+#define RISCV_SIM_FPUNIT_H
+
+#include "Instruction.h"
+
+#include <algorithm>
+
+struct FpuConfig
+{
+    size_t addLatency = 3;      // add, subtract, min/max, compare and conversions
+    size_t mulLatency = 4;      // multiply and fused multiply-add
+    size_t divLatency = 16;     // divide and square root
+};
+
+// FP unit of the F extension shared by all operations of a core. The adder and
+// the multiplier are pipelined, divide and square root are iterative and take
+// one operation at a time. Sign injection, moves and FCLASS take a cycle like
+// an ALU operation.
+class FpUnit
+{
+public:
+    explicit FpUnit(const FpuConfig& config = FpuConfig())
+            : _config(config)
+    {
+
+    }
+
+    size_t Latency(const Instruction& instr) const
+    {
+        switch (instr._aluFunc)
+        {
+            case AluFunc::FSgnj:
+            case AluFunc::FSgnjn:
+            case AluFunc::FSgnjx:
+            case AluFunc::FMvXW:
+            case AluFunc::FMvWX:
+            case AluFunc::FClass:
+                return 1;
+            case AluFunc::FMul:
+            case AluFunc::FMadd:
+            case AluFunc::FMsub:
+            case AluFunc::FNmsub:
+            case AluFunc::FNmadd:
+                return std::max<size_t>(1, _config.mulLatency);
+            case AluFunc::FDiv:
+            case AluFunc::FSqrt:
+                return std::max<size_t>(1, _config.divLatency);
+            default:
+                return std::max<size_t>(1, _config.addLatency);
+        }
+    }
+
+    bool CanStart(const Instruction& instr) const
+    {
+        return !instr.IsFpDivSqrt() || _busyCycles == 0;
+    }
+
+    // Returns the number of cycles until the result is ready
+    size_t Start(const Instruction& instr)
+    {
+        size_t latency = Latency(instr);
+        if (instr.IsFpDivSqrt())
+            _busyCycles = latency;
+        return latency;
+    }
+
+    void Clock()
+    {
+        if (_busyCycles > 0)
+            _busyCycles--;
+    }
+
+    void SkipCycles(size_t cycles)
+    {
+        _busyCycles -= std::min(cycles, _busyCycles);
+    }
+
+    void Reset()
+    {
+        _busyCycles = 0;
+    }
+
+private:
+    FpuConfig _config;
+    size_t _busyCycles = 0;     // left of the divide or square root
+};
+
+#endif //RISCV_SIM_FPUNIT_H
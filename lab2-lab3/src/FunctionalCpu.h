@@ -0,0 +1,354 @@
+#ifndef RISCV_SIM_FUNCTIONALCPU_H
+#define RISCV_SIM_FUNCTIONALCPU_H
+
+#include "Memory.h"
+#include "BlockCache.h"
+#include "Jit.h"
+#include "RegisterFile.h"
+#include "CsrFile.h"
+#include "Executor.h"
+#include "VectorUnit.h"
+
+struct FunctionalStats
+{
+    uint64_t dispatches = 0;                // blocks and superblocks entered
+    uint64_t superblocks = 0;               // formed
+    uint64_t droppedSuperblocks = 0;        // left early too often
+    uint64_t superblockInstructions = 0;
+    uint64_t sideExits = 0;
+};
+
+// Functional model: executes whole basic blocks against the memory storage
+// directly, without any timing. Every instruction takes one cycle.
+// With the JIT enabled hot blocks are translated to native code. With
+// superblocks enabled hot blocks are stitched together first.
+// Interrupts are taken between blocks, a WFI waits by moving the timer on.
+// Vector instructions are interpreted, a block with any is never translated.
+class FunctionalCpu
+{
+public:
+
+    explicit FunctionalCpu(MemoryStorage& mem, bool useJit = false, bool useSuperblocks = false,
+                           const VectorConfig& vector = VectorConfig())
+            : _mem(mem), _blocks(mem), _useJit(useJit), _useSuperblocks(useSuperblocks), _vrf(vector.vlen)
+    {
+        _jitContext.mem = &_mem;
+        _jitContext.blocks = &_blocks;
+    }
+
+    // Executes up to maxInstructions, stops earlier if there is a message for the host
+    size_t Run(size_t maxInstructions)
+    {
+        size_t executed = 0;
+
+        while (executed < maxInstructions && !_csrf.HasMessage())
+        {
+            if (auto cause = _csrf.PendingInterrupt())
+            {
+                _ip = _csrf.Trap(*cause, _ip);
+                _block = nullptr;
+            }
+
+            _block = _block == nullptr ? _blocks.Lookup(_ip) : _blocks.Next(_block, _ip);
+            if (_useSuperblocks)
+                _block = enter(_block);
+
+            _stats.dispatches++;
+            if (++_block->execCount == jitThreshold && _useJit && _block->native == nullptr)
+                _block->native = _jit.Compile(*_block);
+
+            if (_block->native != nullptr && _block->ops.size() <= maxInstructions - executed)
+            {
+                executed += RunNative();
+                continue;
+            }
+
+            const std::vector<Instruction>& ops = _block->ops;
+            size_t blockStart = executed;
+            bool superblock = _block->superblock;
+            for (size_t i = 0; i < ops.size(); i++)
+            {
+                _instruction = ops[i];
+                _rf.Read(_instruction);
+
+                bool usesCsrs = _instruction.UsesCsrs();
+                if (usesCsrs)
+                {
+                    retire();
+                    _csrf.Read(_instruction);
+                }
+
+                Word nextIp = Executor::Execute(_instruction, _ip);
+
+                bool codeModified = false;
+                switch (_instruction._type)
+                {
+                    case IType::Ld:
+                    case IType::St:
+                    case IType::Lr:
+                    case IType::Sc:
+                    case IType::Amo:
+                        codeModified = access();
+                        break;
+                    case IType::Vset:
+                    case IType::Valu:
+                    case IType::Vld:
+                    case IType::Vst:
+                        codeModified = executeVector();
+                        break;
+                    default:
+                        break;
+                }
+
+                _rf.Write(_instruction);
+                if (usesCsrs)
+                    _csrf.Write(_instruction);
+
+                _ip = nextIp;
+                executed++;
+                _unretired++;
+
+                if (_instruction._type == IType::Wfi)
+                {
+                    retire();
+                    waitForInterrupt();
+                }
+
+                if (codeModified)
+                {
+                    _block = nullptr;
+                    break;
+                }
+
+                // A guard of a superblock, the block chain goes on from where it has been left
+                bool last = i + 1 == ops.size();
+                if (!last && nextIp != _block->ips[i + 1])
+                {
+                    _block->sideExits++;
+                    _stats.sideExits++;
+                    break;
+                }
+
+                // The rest of the block is not needed now
+                if (executed == maxInstructions && !last)
+                {
+                    _block = nullptr;
+                    break;
+                }
+            }
+            retire();
+
+            if (superblock)
+                _stats.superblockInstructions += executed - blockStart;
+        }
+
+        return executed;
+    }
+
+    void Reset(Word ip)
+    {
+        _csrf.Reset();
+        _ip = ip;
+        _block = nullptr;
+    }
+
+    std::optional<CpuToHostData> GetMessage()
+    {
+        return _csrf.GetMessage();
+    }
+
+    Word GetIp() const
+    {
+        return _ip;
+    }
+
+    const RegisterFile& GetRegisters() const
+    {
+        return _rf;
+    }
+
+    const CsrFile& GetCsrs() const
+    {
+        return _csrf;
+    }
+
+    const VectorRegisterFile& GetVectorRegisters() const
+    {
+        return _vrf;
+    }
+
+    const FunctionalStats& GetStats() const
+    {
+        return _stats;
+    }
+
+    // The timer counts instructions, as the cycles do
+    void SetClint(Clint* clint)
+    {
+        _clint = clint;
+        _csrf.SetClint(clint);
+        _jitContext.clint = clint;
+    }
+
+private:
+    Reg32 _ip;
+    MemoryStorage& _mem;
+    BlockCache _blocks;
+    BasicBlock* _block = nullptr;   // the last executed block
+    bool _useJit;
+    bool _useSuperblocks;
+    Jit _jit;
+    JitContext _jitContext{};
+    RegisterFile _rf;
+    CsrFile _csrf;
+    VectorRegisterFile _vrf;
+    Instruction _instruction;
+    FunctionalStats _stats;
+    Clint* _clint = nullptr;
+    std::optional<Word> _reservation;       // of the last LR
+    size_t _unretired = 0;                  // instructions interpreted since the last retire
+
+    void clock(size_t cycles)
+    {
+        _csrf.Clock(cycles);
+        if (_clint != nullptr)
+            _clint->Clock(cycles);
+    }
+
+    // The counters and the timer go on for the interpreted instructions at once,
+    // before anything can see them: a CSR, the CLINT, a WFI or the end of a block
+    void retire()
+    {
+        if (_unretired == 0)
+            return;
+        _csrf.InstructionExecuted(_unretired);
+        clock(_unretired);
+        _unretired = 0;
+    }
+
+    // Returns true if a store has modified code
+    bool access()
+    {
+        Word addr = _instruction.Addr();
+        if (_clint != nullptr && Clint::Contains(addr))
+        {
+            retire();
+            _clint->Access(_instruction);
+            return false;
+        }
+
+        bool codeModified = false;
+        switch (_instruction._type)
+        {
+            case IType::Ld:
+                _instruction._data = LoadLane(addr, _instruction._flags, _mem.Read(addr));
+                return false;
+            case IType::St:
+                _mem.Write(addr, StoreLane(addr, _instruction._flags, _instruction._data),
+                           AccessMask(addr, _instruction._flags));
+                codeModified = _blocks.Invalidate(addr);
+                break;
+            default:
+                _instruction._data = _mem.Atomic(_instruction, _reservation);
+                codeModified = _instruction._type != IType::Lr && _blocks.Invalidate(addr);
+                break;
+        }
+
+        if (codeModified)
+            _jit.Reset();
+        return codeModified;
+    }
+
+    // Returns true if a vector store has modified code
+    bool executeVector()
+    {
+        switch (_instruction._type)
+        {
+            case IType::Vset:
+                _vrf.SetVl(_instruction);
+                return false;
+            case IType::Valu:
+                _vrf.Execute(_instruction);
+                return false;
+            default:
+                break;
+        }
+
+        _vrf.Access(_instruction, _mem);
+        if (_instruction._type != IType::Vst)
+            return false;
+
+        bool codeModified = false;
+        for (Word i = 0; i < _vrf.Vl(); i++)
+            codeModified |= _blocks.Invalidate(_vrf.ElementAddr(_instruction, i));
+        if (codeModified)
+            _jit.Reset();
+        return codeModified;
+    }
+
+    // Nothing but the timer can end the wait here. Without a timer set
+    // the WFI is a nop, which the specification allows.
+    void waitForInterrupt()
+    {
+        if (_clint == nullptr || !_csrf.WaitsForInterrupt())
+            return;
+
+        size_t cycles = _clint->CyclesToTimer();
+        if (cycles != std::numeric_limits<size_t>::max())
+            clock(cycles);
+    }
+
+    // Returns the superblock starting with the block if there is a good one
+    BasicBlock* enter(BasicBlock* block)
+    {
+        if (block->trace != nullptr)
+        {
+            BasicBlock* trace = block->trace.get();
+            if (trace->execCount < superblockThreshold || trace->sideExits * 2 < trace->execCount)
+                return trace;
+
+            // Left early more often than not, the profile it was formed from was misleading
+            block->trace.reset();
+            _stats.droppedSuperblocks++;
+            return block;
+        }
+
+        if (block->traced || block->execCount < superblockThreshold)
+            return block;
+
+        BasicBlock* trace = _blocks.FormSuperblock(block);
+        if (trace == nullptr)
+            return block;
+
+        _stats.superblocks++;
+        return trace;
+    }
+
+    size_t RunNative()
+    {
+        _jitContext.codeModified = false;
+        _ip = _block->native(_rf.Data(), &_jitContext);
+
+        _csrf.InstructionExecuted(_jitContext.executed);
+        clock(_jitContext.executed);
+
+        if (_jitContext.codeModified)
+        {
+            _block = nullptr;
+            _jit.Reset();
+        }
+        else if (_block->superblock)
+        {
+            _stats.superblockInstructions += _jitContext.executed;
+            if (_jitContext.executed < _block->ops.size())
+            {
+                _block->sideExits++;
+                _stats.sideExits++;
+            }
+        }
+
+        return _jitContext.executed;
+    }
+};
+
+#endif //RISCV_SIM_FUNCTIONALCPU_H
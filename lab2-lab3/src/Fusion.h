@@ -0,0 +1,43 @@
+#ifndef RISCV_SIM_FUSION_H
+#define RISCV_SIM_FUSION_H
+
+#include "Instruction.h"
+
+// Pairs of adjacent instructions executed as one operation. The first one writes
+// a register that the second one reads and overwrites, so the intermediate value
+// is never seen by anything else. The pair reads at most two other registers.
+enum class FusionKind : uint8_t
+{
+    None,
+    LuiAddi,        // 32-bit constant
+    AuipcJalr,      // far call
+    AuipcLoad,      // pc-relative load
+    SlliAdd,        // indexed address
+    Count,
+};
+
+static FusionKind FusionOf(const Instruction& first, const Instruction& second)
+{
+    RId dst = first._dst;
+    if (dst == 0 || second._dst != dst)
+        return FusionKind::None;
+
+    bool firstIsLui = first._type == IType::Alu && first._aluFunc == AluFunc::Add &&
+                      (first._flags & flagImm) && first._src1 == 0;
+    bool firstIsSlli = first._type == IType::Alu && first._aluFunc == AluFunc::Sll && (first._flags & flagImm);
+
+    if (firstIsLui && second._type == IType::Alu && second._aluFunc == AluFunc::Add &&
+        (second._flags & flagImm) && second._src1 == dst)
+        return FusionKind::LuiAddi;
+    if (first._type == IType::Auipc && second._type == IType::Jr && second._src1 == dst)
+        return FusionKind::AuipcJalr;
+    if (first._type == IType::Auipc && second._type == IType::Ld && second._src1 == dst)
+        return FusionKind::AuipcLoad;
+    if (firstIsSlli && second._type == IType::Alu && second._aluFunc == AluFunc::Add &&
+        !(second._flags & flagImm) && (second._src1 == dst || second._src2 == dst))
+        return FusionKind::SlliAdd;
+
+    return FusionKind::None;
+}
+
+#endif //RISCV_SIM_FUSION_H
@@ -2,48 +2,108 @@
 #ifndef RISCV_SIM_INSTRUCTION_H
 #define RISCV_SIM_INSTRUCTION_H
 
+#include <array>
+#include <cstdint>
 #include <optional>
 #include <memory>
+#include <type_traits>
 
 #include "BaseTypes.h"
-#include "PoolAllocator.h"
 
 
 enum class Opcode : uint8_t
 {
     Load    = 0b0000011,
+    LoadFp  = 0b0000111,    // FLW and vector loads
     MiscMem = 0b0001111,
     OpImm   = 0b0010011,
     Auipc   = 0b0010111,
     Store   = 0b0100011,
+    StoreFp = 0b0100111,    // FSW and vector stores
     Amo     = 0b0101111,
     Op      = 0b0110011,
     Lui     = 0b0110111,
+    Madd    = 0b1000011,
+    Msub    = 0b1000111,
+    Nmsub   = 0b1001011,
+    Nmadd   = 0b1001111,
+    OpFp    = 0b1010011,
+    OpV     = 0b1010111,
     Branch  = 0b1100011,
     Jalr    = 0b1100111,
     Jal     = 0b1101111,
     System  = 0b1110011,
 };
 
-enum class CsrIdx : RId
+enum class CsrIdx : uint16_t
 {
+    Fflags  = 0x001,
+    Frm     = 0x002,
+    Fcsr    = 0x003,
     Instret = 0xc02,
     Cycle   = 0xc00,
+    Instreth = 0xc82,
+    Cycleh  = 0xc80,
+    Hpmcounter3  = 0xc03,   // up to hpmcounter31
+    Hpmcounter3h = 0xc83,
+    Minstret = 0xb02,
+    Mcycle  = 0xb00,
+    Minstreth = 0xb82,
+    Mcycleh = 0xb80,
+    Mhpmcounter3  = 0xb03,  // up to mhpmcounter31
+    Mhpmcounter3h = 0xb83,
+    Mhpmevent3 = 0x323,     // up to mhpmevent31
+    Time    = 0xc01,
+    Timeh   = 0xc81,
+    Mstatus = 0x300,
+    Misa    = 0x301,
+    Mie     = 0x304,
+    Mtvec   = 0x305,
+    Mscratch = 0x340,
+    Mepc    = 0x341,
+    Mcause  = 0x342,
+    Mtval   = 0x343,
+    Mip     = 0x344,
     Mhartid = 0xf10,
+    Mnumharts = 0xfc0,  // non-standard: number of harts in the system
     Mtohost = 0x780,
     None    = 0xfff,
 };
 
-// LR, SC, FENCE not implemented
-// LB(U), LH(U), SB, SH not implemented
+// FENCE and FENCE.I are nops: every core performs its accesses in order with
+// the others and checks the raw word of every decoded instruction.
 
-// For CSR, only following two are implemented
-// CSRR rd csr (i.e. CSRRS rd csr x0)
-// CSRW csr rs1 (i.e. CSRRW x0 csr rs1)
+// CSR instructions are Csrr if they only read (CSRRS and CSRRC without bits to
+// set or clear), Csrw if they only write (CSRRW and CSRRWI into x0) and Csrrw
+// otherwise. CsrFile reads the old value into _data for rd, and a Csrrw writes
+// back CsrValue of it with _aluFunc: Swap, Or to set bits or And to clear them.
+// The operand is rs1, or uimm above the CSR index in _imm with flagImm, see CsrOperand().
 
-// SCALL, SBREAK not implemented
+// An instruction that is not supported decodes as a Trap with the illegal
+// instruction cause.
 
-enum class IType
+// ECALL and EBREAK are Trap, the cause is in _imm. MRET also decodes from the
+// ERET encoding of the older privileged spec the benchmarks are built with.
+
+// LR.W, SC.W and AMO*.W access a whole word, the address is in rs1 only.
+// For an AMO _aluFunc combines the loaded value with rs2. The aq and rl bits
+// are ignored: every core performs atomics in order with all other accesses.
+
+// The F extension: f0-f31 are registers 32-63 after x0-x31, see fpRegBase,
+// so every core tracks them like the integer registers. FLW and FSW are Ld
+// and St. Any other F instruction is Fpu with its operation in _aluFunc and
+// _imm holding the rounding mode, rs3 of a fused multiply-add and, once
+// executed, the exception flags raised, see Rm(), Src3() and FpFlags().
+// A dynamic rounding mode is replaced by frm when CsrFile reads the instruction,
+// the flags are accrued into fflags when it writes back.
+
+// The V extension subset: vsetvli, unmasked vle32/vse32 (unit-stride and strided),
+// vadd.vv/vx/vi, vmul.vv/vx and vredsum.vs. Only SEW = 32 and LMUL = 1 are supported.
+// The vector registers are packed into _imm, see Vd(), Vs1(), Vs2() and VImm().
+// For vsetvli _imm is vtypei. A load or store has the base address in rs1 and
+// the stride in rs2, vd is the register stored.
+
+enum class IType : uint8_t
 {
     Unsupported,
     Alu,
@@ -54,7 +114,19 @@ enum class IType
     Br,
     Csrr,
     Csrw,
-    Auipc
+    Csrrw,
+    Auipc,
+    Trap,
+    Mret,
+    Wfi,
+    Lr,
+    Sc,
+    Amo,
+    Vset,
+    Valu,
+    Vld,
+    Vst,
+    Fpu,
 };
 
 enum class BrFunc : uint8_t
@@ -69,7 +141,7 @@ enum class BrFunc : uint8_t
     NT,
 };
 
-enum class AluFunc
+enum class AluFunc : uint8_t
 {
     Add  = 0b000,
     Sll  = 0b001,
@@ -82,55 +154,349 @@ enum class AluFunc
     Sub  = 0b1000,
     Sra,
     Srl,
+    // M extension, in the order of funct3
+    Mul,
+    Mulh,
+    Mulhsu,
+    Mulhu,
+    Div,
+    Divu,
+    Rem,
+    Remu,
+    // A extension, only for AMOs
+    Swap,
+    Min,
+    Max,
+    Minu,
+    Maxu,
     None,
+    // F extension, only for Fpu
+    FAdd,
+    FSub,
+    FMul,
+    FDiv,
+    FSqrt,
+    FSgnj,
+    FSgnjn,
+    FSgnjx,
+    FMin,
+    FMax,
+    FEq,
+    FLt,
+    FLe,
+    FClass,
+    FCvtWS,
+    FCvtWuS,
+    FCvtSW,
+    FCvtSWu,
+    FMvXW,
+    FMvWX,
+    FMadd,
+    FMsub,
+    FNmsub,
+    FNmadd,
 };
 
-struct Instruction : public PoolAllocated<Instruction>
+// Instruction flags
+constexpr uint8_t flagImm = 0b1;    // the second ALU operand is _imm rather than _src2
+// Size of a load or store, a whole word if neither is set
+constexpr uint8_t flagByte = 0b10;
+constexpr uint8_t flagHalf = 0b100;
+constexpr uint8_t flagUnsigned = 0b1000;    // LBU, LHU: zero extended
+// Vector instructions
+constexpr uint8_t flagStrided = 0b10000;    // the stride is in rs2, unit-stride otherwise
+constexpr uint8_t flagScalar = 0b100000;    // .vx: the second operand is rs1 for every element
+constexpr uint8_t flagReduce = 0b1000000;   // vredsum: vd[0] = vs1[0] + sum of vs2
+constexpr uint8_t flagCompressed = 0b10000000;  // expanded from a 16-bit instruction of the C extension
+
+constexpr RId fpRegBase = 32;    // f0
+constexpr RId archRegs = 64;     // x0-x31 and f0-f31
+
+// CSR _imm fields
+constexpr Word csrIdxMask = 0xfff;
+constexpr unsigned csrUimmShift = 12;
+
+// Fpu _imm fields
+constexpr Word fpRmMask = 0b111;
+constexpr unsigned fpSrc3Shift = 8;
+constexpr unsigned fpFlagsShift = 16;
+constexpr Word fpFlagsMask = Word(0b11111) << fpFlagsShift;
+
+// Register index 0 means "no register": x0 always reads as zero and writes to it are dropped
+struct Instruction
 {
     IType _type = IType::Unsupported;
+    uint8_t _op = 0;        // index of the handler in Executor chosen by the decoder, 0 for Unsupported
+    AluFunc _aluFunc = AluFunc::None;
     BrFunc _brFunc = BrFunc::NT;
-    AluFunc _aluFunc;
-    std::optional<RId> _dst;
-    std::optional<RId> _src1;
-    std::optional<RId> _src2;
-    std::optional<CsrIdx> _csr;
-    std::optional<Word> _imm;
-
-    Word _src1Val;
-    Word _src2Val;
-    Word _csrVal;
-    Word _data = 0xdeadbeaf;
-    Word _addr = 0xdeadbeaf;
-    Word _nextIp = 0xdeadbeaf;
+    uint8_t _flags = 0;
+    RId _dst = 0;
+    RId _src1 = 0;
+    RId _src2 = 0;
+
+    Word _imm = 0;          // CSR index for CSR instructions
+    Word _src1Val = 0;
+    Word _src2Val = 0;
+    Word _data = 0;         // result, loaded or stored data
+
+    CsrIdx Csr() const
+    {
+        return static_cast<CsrIdx>(_imm & csrIdxMask);
+    }
+
+    Word CsrOperand() const
+    {
+        return (_flags & flagImm) ? _imm >> csrUimmShift : _src1Val;
+    }
+
+    Word Addr() const
+    {
+        return _src1Val + _imm;
+    }
+
+    bool IsMulDiv() const
+    {
+        return _type == IType::Alu && _aluFunc >= AluFunc::Mul && _aluFunc <= AluFunc::Remu;
+    }
+
+    bool IsDiv() const
+    {
+        return _type == IType::Alu && _aluFunc >= AluFunc::Div && _aluFunc <= AluFunc::Remu;
+    }
+
+    bool IsAtomic() const
+    {
+        return _type == IType::Lr || _type == IType::Sc || _type == IType::Amo;
+    }
+
+    // CsrFile reads or writes the state of the instruction
+    bool UsesCsrs() const
+    {
+        return _type == IType::Csrr || _type == IType::Csrw || _type == IType::Csrrw || _type == IType::Fpu ||
+               _type == IType::Trap || _type == IType::Mret;
+    }
+
+    bool IsMemAccess() const
+    {
+        return _type == IType::Ld || _type == IType::St || IsAtomic();
+    }
+
+    bool IsVector() const
+    {
+        return _type >= IType::Vset && _type <= IType::Vst;
+    }
+
+    bool IsVectorMem() const
+    {
+        return _type == IType::Vld || _type == IType::Vst;
+    }
+
+    bool IsFma() const
+    {
+        return _type == IType::Fpu && _aluFunc >= AluFunc::FMadd;
+    }
+
+    bool IsFpDivSqrt() const
+    {
+        return _type == IType::Fpu && (_aluFunc == AluFunc::FDiv || _aluFunc == AluFunc::FSqrt);
+    }
+
+    uint8_t Rm() const
+    {
+        return uint8_t(_imm & fpRmMask);
+    }
+
+    // Register index of rs3, 0 if there is none
+    RId Src3() const
+    {
+        return IsFma() ? RId(_imm >> fpSrc3Shift) : 0;
+    }
+
+    uint8_t FpFlags() const
+    {
+        return uint8_t((_imm & fpFlagsMask) >> fpFlagsShift);
+    }
+
+    RId Vd() const
+    {
+        return RId(_imm & 31u);
+    }
+
+    RId Vs1() const
+    {
+        return RId((_imm >> 5u) & 31u);
+    }
+
+    RId Vs2() const
+    {
+        return RId((_imm >> 10u) & 31u);
+    }
+
+    Word VImm() const
+    {
+        return Word(SignedWord(_imm) >> 15);
+    }
+
+    // Bytes from the instruction to the next one
+    Word Length() const
+    {
+        return (_flags & flagCompressed) ? 2 : 4;
+    }
 };
 
-using InstructionPtr = std::unique_ptr<Instruction>;
+// The length of an instruction from its first halfword: the two low bits are 11 for 32 bits
+inline Word InstructionLength(Word bits)
+{
+    return (bits & 3u) == 3u ? 4 : 2;
+}
+
+static_assert(sizeof(Instruction) == 24, "Instruction is expected to be 24 bytes");
+static_assert(std::is_trivially_copyable<Instruction>::value, "Instruction must be trivially copyable");
+
+// Memory is accessed by words. A byte or halfword access is aligned down to its
+// size and uses some of the bytes of one word, the others are left untouched.
+inline Word AccessSize(uint8_t flags)
+{
+    return (flags & flagByte) ? 1 : (flags & flagHalf) ? 2 : 4;
+}
+
+inline Word LaneShift(Word addr, uint8_t flags)
+{
+    return 8 * (addr & 3u & ~(AccessSize(flags) - 1));
+}
 
+// The bytes of the word an access writes
+inline Word AccessMask(Word addr, uint8_t flags)
+{
+    Word size = AccessSize(flags);
+    Word mask = size == 4 ? ~Word(0) : (Word(1) << (8 * size)) - 1;
+    return mask << LaneShift(addr, flags);
+}
+
+// Stored data moved to its bytes of the word
+inline Word StoreLane(Word addr, uint8_t flags, Word data)
+{
+    return data << LaneShift(addr, flags);
+}
+
+// The loaded value taken from the word, sign or zero extended
+inline Word LoadLane(Word addr, uint8_t flags, Word word)
+{
+    Word bits = 8 * AccessSize(flags);
+    if (bits == 32)
+        return word;
+
+    Word value = (word >> LaneShift(addr, flags)) & ((Word(1) << bits) - 1);
+    if (!(flags & flagUnsigned) && (value >> (bits - 1)) != 0)
+        value |= ~Word(0) << bits;
+    return value;
+}
+
+// The value an AMO stores, the loaded one is its result
+inline Word AmoValue(AluFunc func, Word loaded, Word src)
+{
+    switch (func)
+    {
+        case AluFunc::Add:  return loaded + src;
+        case AluFunc::Xor:  return loaded ^ src;
+        case AluFunc::And:  return loaded & src;
+        case AluFunc::Or:   return loaded | src;
+        case AluFunc::Min:  return SignedWord(loaded) < SignedWord(src) ? loaded : src;
+        case AluFunc::Max:  return SignedWord(loaded) > SignedWord(src) ? loaded : src;
+        case AluFunc::Minu: return loaded < src ? loaded : src;
+        case AluFunc::Maxu: return loaded > src ? loaded : src;
+        default:            return src;     // Swap
+    }
+}
+
+// The value a Csrrw writes to the CSR, the old one is its result
+inline Word CsrValue(AluFunc func, Word old, Word operand)
+{
+    switch (func)
+    {
+        case AluFunc::Or:   return old | operand;
+        case AluFunc::And:  return old & ~operand;
+        default:            return operand;     // Swap
+    }
+}
+
+// Op
+constexpr uint8_t fn7MULDIV = 0b0000001;
 // Load
 constexpr uint8_t fnLW    = 0b010;
-//constexpr uint8_t fnLB    = 0b000;
-//constexpr uint8_t fnLH    = 0b001;
-//constexpr uint8_t fnLBU   = 0b100;
-//constexpr uint8_t fnLHU   = 0b101;
+constexpr uint8_t fnLB    = 0b000;
+constexpr uint8_t fnLH    = 0b001;
+constexpr uint8_t fnLBU   = 0b100;
+constexpr uint8_t fnLHU   = 0b101;
 // Store
 constexpr uint8_t fnSW    = 0b010;
-//constexpr uint8_t fnSB    = 0b000;
-//constexpr uint8_t fnSH    = 0b001;
-// Amo
+constexpr uint8_t fnSB    = 0b000;
+constexpr uint8_t fnSH    = 0b001;
+// Amo, funct5
 constexpr uint8_t fnLR    = 0b00010;
 constexpr uint8_t fnSC    = 0b00011;
+constexpr uint8_t fnAMOSWAP = 0b00001;
+constexpr uint8_t fnAMOADD  = 0b00000;
+constexpr uint8_t fnAMOXOR  = 0b00100;
+constexpr uint8_t fnAMOAND  = 0b01100;
+constexpr uint8_t fnAMOOR   = 0b01000;
+constexpr uint8_t fnAMOMIN  = 0b10000;
+constexpr uint8_t fnAMOMAX  = 0b10100;
+constexpr uint8_t fnAMOMINU = 0b11000;
+constexpr uint8_t fnAMOMAXU = 0b11100;
+constexpr uint8_t fnAMOW    = 0b010;    // funct3
 //MiscMem
 constexpr uint8_t fnFENCE  = 0b000;
-//constexpr uint8_t fnFENCEI = 0b001;
+constexpr uint8_t fnFENCEI = 0b001;
+// OpV, funct3 and funct6
+constexpr uint8_t fnOPIVV  = 0b000;
+constexpr uint8_t fnOPMVV  = 0b010;
+constexpr uint8_t fnOPIVI  = 0b011;
+constexpr uint8_t fnOPIVX  = 0b100;
+constexpr uint8_t fnOPMVX  = 0b110;
+constexpr uint8_t fnOPCFG  = 0b111;
+constexpr uint8_t fn6VADD  = 0b000000;
+constexpr uint8_t fn6VREDSUM = 0b000000;
+constexpr uint8_t fn6VMUL  = 0b100101;
+// LoadFp and StoreFp, width and mop
+constexpr uint8_t fnFLW    = 0b010;
+constexpr uint8_t fnVE32   = 0b110;
+constexpr uint8_t mopUNIT  = 0b00;
+constexpr uint8_t mopSTRIDED = 0b10;
+// OpFp, funct7 with fmt = S
+constexpr uint8_t fn7FADD  = 0b0000000;
+constexpr uint8_t fn7FSUB  = 0b0000100;
+constexpr uint8_t fn7FMUL  = 0b0001000;
+constexpr uint8_t fn7FDIV  = 0b0001100;
+constexpr uint8_t fn7FSQRT = 0b0101100;
+constexpr uint8_t fn7FSGNJ = 0b0010000;
+constexpr uint8_t fn7FMINMAX = 0b0010100;
+constexpr uint8_t fn7FCVTWS = 0b1100000;
+constexpr uint8_t fn7FCVTSW = 0b1101000;
+constexpr uint8_t fn7FCMP  = 0b1010000;
+constexpr uint8_t fn7FMVXW = 0b1110000;    // and FCLASS
+constexpr uint8_t fn7FMVWX = 0b1111000;
 // System
 constexpr uint8_t fnCSRRW  = 0b001;
 constexpr uint8_t fnCSRRS  = 0b010;
-//constexpr uint8_t fnCSRRC  = 0b011;
-//constexpr uint8_t fnCSRRWI = 0b101;
-//constexpr uint8_t fnCSRRSI = 0b110;
-//constexpr uint8_t fnCSRRCI = 0b111;
+constexpr uint8_t fnCSRRC  = 0b011;
+constexpr uint8_t fnCSRRWI = 0b101;
+constexpr uint8_t fnCSRRSI = 0b110;
+constexpr uint8_t fnCSRRCI = 0b111;
 constexpr uint8_t fnPRIV   = 0b000;
-constexpr uint8_t privSCALL    = 0b000;
+constexpr Word instrECALL  = 0x00000073;
+constexpr Word instrEBREAK = 0x00100073;
+constexpr Word instrMRET   = 0x30200073;
+constexpr Word instrERET   = 0x10000073;
+constexpr Word instrWFI    = 0x10500073;
+
+// mcause, interrupts have the top bit set
+constexpr Word causeInterrupt = Word(1) << 31u;
+constexpr Word causeIllegalInstruction = 2;
+constexpr Word causeBreakpoint = 3;
+constexpr Word causeMachineEcall = 11;
+constexpr Word causeMachineSoftware = causeInterrupt | 3;
+constexpr Word causeMachineTimer = causeInterrupt | 7;
 
 
 #endif //RISCV_SIM_INSTRUCTION_H
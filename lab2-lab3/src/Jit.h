@@ -0,0 +1,432 @@
+#ifndef RISCV_SIM_JIT_H
+#define RISCV_SIM_JIT_H
+
+#include <sys/mman.h>
+#include <cstddef>
+#include <optional>
+
+#include "BlockCache.h"
+
+static constexpr size_t jitThreshold = 64;              // executions before a block is translated
+static constexpr size_t jitCodeSizeBytes = 16 * 1024 * 1024;
+
+struct JitContext
+{
+    MemoryStorage* mem;
+    BlockCache* blocks;
+    Clint* clint;
+    Word executed;          // instructions retired by the last call
+    bool codeModified;      // the last call stored into translated code
+};
+
+// Translates RV32I basic blocks and superblocks to x86-64 code. Blocks which contain
+// anything but ALU, memory and control transfer instructions, or which
+// multiply or divide, are left to the interpreter.
+class Jit
+{
+public:
+    Jit()
+    {
+#if defined(__x86_64__)
+        void* code = mmap(nullptr, jitCodeSizeBytes, PROT_READ | PROT_WRITE | PROT_EXEC,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (code != MAP_FAILED)
+            _code = static_cast<uint8_t*>(code);
+#endif
+    }
+
+    ~Jit()
+    {
+        if (_code != nullptr)
+            munmap(_code, jitCodeSizeBytes);
+    }
+
+    Jit(const Jit&) = delete;
+    Jit& operator=(const Jit&) = delete;
+
+    // Returns nullptr if the block can't be translated
+    JitFunc Compile(const BasicBlock& block)
+    {
+        if (_code == nullptr || !IsSupported(block))
+            return nullptr;
+
+        // The largest instruction needs less than 64 bytes
+        if (jitCodeSizeBytes - _size < block.ops.size() * 64 + 64)
+            return nullptr;
+
+        size_t start = _size;
+        EmitPrologue();
+
+        for (size_t i = 0; i < block.ops.size(); i++)
+        {
+            if (i + 1 < block.ops.size())
+                EmitInstruction(block.ops[i], block.ips[i], i + 1, block.ips[i + 1]);
+            else
+                EmitInstruction(block.ops[i], block.ips[i], i + 1);
+        }
+
+        const Instruction& last = block.ops.back();
+        if (last._type != IType::Br && last._type != IType::J && last._type != IType::Jr)
+            EmitExit(block.ips.back() + last.Length(), block.ops.size());
+
+        return reinterpret_cast<JitFunc>(_code + start);
+    }
+
+    // Drops all translations, the memory is reused by the next Compile
+    void Reset()
+    {
+        _size = 0;
+    }
+
+private:
+    enum Reg : uint8_t
+    {
+        eax = 0,
+        ecx = 1,
+        edx = 2,
+        esi = 6,
+    };
+
+    static bool IsSupported(const BasicBlock& block)
+    {
+        for (const Instruction& op : block.ops)
+        {
+            switch (op._type)
+            {
+                case IType::Alu:
+                    if (op._aluFunc == AluFunc::None || op.IsMulDiv())
+                        return false;
+                    break;
+                case IType::Br:
+                    if (op._brFunc != BrFunc::Eq && op._brFunc != BrFunc::Neq &&
+                        op._brFunc != BrFunc::Lt && op._brFunc != BrFunc::Ltu &&
+                        op._brFunc != BrFunc::Ge && op._brFunc != BrFunc::Geu)
+                        return false;
+                    break;
+                case IType::Ld:
+                case IType::St:
+                case IType::J:
+                case IType::Jr:
+                case IType::Auipc:
+                    break;
+                default:
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    template <uint8_t flags>
+    static Word Load(JitContext* ctx, Word addr)
+    {
+        if (ctx->clint != nullptr && Clint::Contains(addr))
+            return LoadLane(addr, flags, ctx->clint->Read(addr));
+        return LoadLane(addr, flags, ctx->mem->Read(addr));
+    }
+
+    template <uint8_t flags>
+    static bool Store(JitContext* ctx, Word addr, Word data)
+    {
+        if (ctx->clint != nullptr && Clint::Contains(addr))
+        {
+            ctx->clint->Write(addr, StoreLane(addr, flags, data), AccessMask(addr, flags));
+            return false;
+        }
+        ctx->mem->Write(addr, StoreLane(addr, flags, data), AccessMask(addr, flags));
+        ctx->codeModified = ctx->blocks->Invalidate(addr);
+        return ctx->codeModified;
+    }
+
+    // Only the size flags choose the function, a compressed load or store takes the same one
+    static void* LoadFunc(uint8_t flags)
+    {
+        switch (flags & (flagByte | flagHalf | flagUnsigned))
+        {
+            case flagByte:                  return reinterpret_cast<void*>(&Jit::Load<flagByte>);
+            case flagHalf:                  return reinterpret_cast<void*>(&Jit::Load<flagHalf>);
+            case flagByte | flagUnsigned:   return reinterpret_cast<void*>(&Jit::Load<flagByte | flagUnsigned>);
+            case flagHalf | flagUnsigned:   return reinterpret_cast<void*>(&Jit::Load<flagHalf | flagUnsigned>);
+            default:                        return reinterpret_cast<void*>(&Jit::Load<0>);
+        }
+    }
+
+    static void* StoreFunc(uint8_t flags)
+    {
+        switch (flags & (flagByte | flagHalf))
+        {
+            case flagByte:  return reinterpret_cast<void*>(&Jit::Store<flagByte>);
+            case flagHalf:  return reinterpret_cast<void*>(&Jit::Store<flagHalf>);
+            default:        return reinterpret_cast<void*>(&Jit::Store<0>);
+        }
+    }
+
+    // Inside a superblock the op is followed by the one at `traceIp`, a control
+    // transfer going anywhere else leaves the superblock
+    void EmitInstruction(const Instruction& op, Word ip, size_t executed, std::optional<Word> traceIp = std::nullopt)
+    {
+        RId dst = op._dst;
+        RId src1 = op._src1;
+        RId src2 = op._src2;
+        Word imm = op._imm;
+
+        switch (op._type)
+        {
+            case IType::Alu:
+                if (dst != 0)
+                {
+                    if (op._flags & flagImm)
+                        EmitAluImm(op._aluFunc, src1, imm);
+                    else
+                        EmitAluReg(op._aluFunc, src1, src2);
+                    EmitStoreReg(eax, dst);
+                }
+                return;
+            case IType::Auipc:
+                if (dst != 0)
+                    EmitStoreImm(dst, ip + imm);
+                return;
+            case IType::Ld:
+                EmitLoadReg(esi, src1);
+                EmitAddImm(esi, imm);
+                EmitCall(LoadFunc(op._flags));
+                if (dst != 0)
+                    EmitStoreReg(eax, dst);
+                return;
+            case IType::St:
+            {
+                EmitLoadReg(esi, src1);
+                EmitAddImm(esi, imm);
+                EmitLoadReg(edx, src2);
+                EmitCall(StoreFunc(op._flags));
+                Emit({0x84, 0xc0});                         // test al, al
+                size_t skip = EmitJcc(0x4);                 // jz
+                EmitExit(ip + op.Length(), executed);
+                Patch(skip);
+                return;
+            }
+            case IType::Br:
+            {
+                EmitLoadReg(eax, src1);
+                EmitMem(0x3b, eax, src2);                   // cmp eax, [rbx + src2]
+                if (!traceIp)
+                {
+                    size_t taken = EmitJcc(Condition(op._brFunc));
+                    EmitExit(ip + op.Length(), executed);
+                    Patch(taken);
+                    EmitExit(ip + imm, executed);
+                }
+                else if (imm != op.Length())
+                {
+                    // The inverted condition stays on the trace if it falls through
+                    bool fallsThrough = *traceIp == ip + op.Length();
+                    size_t stay = EmitJcc(uint8_t(Condition(op._brFunc) ^ (fallsThrough ? 1u : 0u)));
+                    EmitExit(fallsThrough ? ip + imm : ip + op.Length(), executed);
+                    Patch(stay);
+                }
+                return;
+            }
+            case IType::J:
+                if (dst != 0)
+                    EmitStoreImm(dst, ip + op.Length());
+                if (!traceIp)
+                    EmitExit(ip + imm, executed);
+                return;
+            case IType::Jr:
+            {
+                EmitLoadReg(eax, src1);
+                EmitAddImm(eax, imm);
+                if (dst != 0)
+                    EmitStoreImm(dst, ip + op.Length());
+                if (!traceIp)
+                {
+                    EmitReturn(executed);
+                    return;
+                }
+                Emit(0x3d);                                 // cmp eax, traceIp
+                Emit32(*traceIp);
+                size_t stay = EmitJcc(0x4);                 // je
+                EmitReturn(executed);
+                Patch(stay);
+                return;
+            }
+            default:
+                return;
+        }
+    }
+
+    // eax = src1 op [rbx + src2]
+    void EmitAluReg(AluFunc func, RId src1, RId src2)
+    {
+        EmitLoadReg(eax, src1);
+        switch (func)
+        {
+            case AluFunc::Add: EmitMem(0x03, eax, src2); return;
+            case AluFunc::Sub: EmitMem(0x2b, eax, src2); return;
+            case AluFunc::And: EmitMem(0x23, eax, src2); return;
+            case AluFunc::Or:  EmitMem(0x0b, eax, src2); return;
+            case AluFunc::Xor: EmitMem(0x33, eax, src2); return;
+            case AluFunc::Slt:
+                EmitMem(0x3b, eax, src2);
+                EmitSetcc(0xc);
+                return;
+            case AluFunc::Sltu:
+                EmitMem(0x3b, eax, src2);
+                EmitSetcc(0x2);
+                return;
+            case AluFunc::Sll: EmitLoadReg(ecx, src2); Emit({0xd3, 0xe0}); return;
+            case AluFunc::Srl: EmitLoadReg(ecx, src2); Emit({0xd3, 0xe8}); return;
+            case AluFunc::Sra: EmitLoadReg(ecx, src2); Emit({0xd3, 0xf8}); return;
+            default: return;
+        }
+    }
+
+    // eax = src1 op imm
+    void EmitAluImm(AluFunc func, RId src1, Word imm)
+    {
+        EmitLoadReg(eax, src1);
+        switch (func)
+        {
+            case AluFunc::Add: Emit(0x05); Emit32(imm); return;
+            case AluFunc::And: Emit(0x25); Emit32(imm); return;
+            case AluFunc::Or:  Emit(0x0d); Emit32(imm); return;
+            case AluFunc::Xor: Emit(0x35); Emit32(imm); return;
+            case AluFunc::Slt:
+                Emit(0x3d); Emit32(imm);
+                EmitSetcc(0xc);
+                return;
+            case AluFunc::Sltu:
+                Emit(0x3d); Emit32(imm);
+                EmitSetcc(0x2);
+                return;
+            case AluFunc::Sll: Emit({0xc1, 0xe0, uint8_t(imm & 31u)}); return;
+            case AluFunc::Srl: Emit({0xc1, 0xe8, uint8_t(imm & 31u)}); return;
+            case AluFunc::Sra: Emit({0xc1, 0xf8, uint8_t(imm & 31u)}); return;
+            default: return;
+        }
+    }
+
+    static uint8_t Condition(BrFunc func)
+    {
+        switch (func)
+        {
+            case BrFunc::Eq:  return 0x4;
+            case BrFunc::Neq: return 0x5;
+            case BrFunc::Lt:  return 0xc;
+            case BrFunc::Ge:  return 0xd;
+            case BrFunc::Ltu: return 0x2;
+            case BrFunc::Geu: return 0x3;
+            default: return 0x5;
+        }
+    }
+
+    // push rbx; push r12; sub rsp, 8; mov rbx, rdi; mov r12, rsi
+    void EmitPrologue()
+    {
+        Emit({0x53, 0x41, 0x54, 0x48, 0x83, 0xec, 0x08, 0x48, 0x89, 0xfb, 0x49, 0x89, 0xf4});
+    }
+
+    void EmitExit(Word nextIp, size_t executed)
+    {
+        Emit(0xb8);                                 // mov eax, nextIp
+        Emit32(nextIp);
+        EmitReturn(executed);
+    }
+
+    // ctx->executed = executed; add rsp, 8; pop r12; pop rbx; ret
+    void EmitReturn(size_t executed)
+    {
+        Emit({0x41, 0xc7, 0x44, 0x24, uint8_t(offsetof(JitContext, executed))});
+        Emit32(Word(executed));
+        Emit({0x48, 0x83, 0xc4, 0x08, 0x41, 0x5c, 0x5b, 0xc3});
+    }
+
+    // mov rdi, r12; mov rax, func; call rax
+    void EmitCall(void* func)
+    {
+        Emit({0x4c, 0x89, 0xe7, 0x48, 0xb8});
+        auto target = reinterpret_cast<uint64_t>(func);
+        Emit32(Word(target));
+        Emit32(Word(target >> 32u));
+        Emit({0xff, 0xd0});
+    }
+
+    // setcc al; movzx eax, al
+    void EmitSetcc(uint8_t cc)
+    {
+        Emit({0x0f, uint8_t(0x90 | cc), 0xc0, 0x0f, 0xb6, 0xc0});
+    }
+
+    void EmitLoadReg(Reg reg, RId src)
+    {
+        EmitMem(0x8b, reg, src);
+    }
+
+    void EmitStoreReg(Reg reg, RId dst)
+    {
+        EmitMem(0x89, reg, dst);
+    }
+
+    void EmitStoreImm(RId dst, Word imm)
+    {
+        EmitMem(0xc7, eax, dst);
+        Emit32(imm);
+    }
+
+    void EmitAddImm(Reg reg, Word imm)
+    {
+        Emit({0x81, uint8_t(0xc0 | reg)});
+        Emit32(imm);
+    }
+
+    // jcc rel32, returns the position of the offset to patch
+    size_t EmitJcc(uint8_t cc)
+    {
+        Emit({0x0f, uint8_t(0x80 | cc)});
+        size_t pos = _size;
+        Emit32(0);
+        return pos;
+    }
+
+    // Points the jump at `pos` to the current position
+    void Patch(size_t pos)
+    {
+        Word rel = Word(_size - (pos + 4));
+        std::memcpy(_code + pos, &rel, sizeof(rel));
+    }
+
+    // opcode reg, [rbx + 4 * rid], the register file is in rbx
+    // [rbx + disp8] for the x registers, [rbx + disp32] for the f registers above the signed disp8 range
+    void EmitMem(uint8_t opcode, Reg reg, RId rid)
+    {
+        Word disp = rid * sizeof(Word);
+        if (disp < 0x80)
+        {
+            Emit({opcode, uint8_t(0x43 | (reg << 3u)), uint8_t(disp)});
+            return;
+        }
+        Emit({opcode, uint8_t(0x83 | (reg << 3u))});
+        Emit32(disp);
+    }
+
+    void Emit(std::initializer_list<uint8_t> bytes)
+    {
+        for (uint8_t byte : bytes)
+            Emit(byte);
+    }
+
+    void Emit(uint8_t byte)
+    {
+        _code[_size++] = byte;
+    }
+
+    void Emit32(Word value)
+    {
+        std::memcpy(_code + _size, &value, sizeof(value));
+        _size += sizeof(value);
+    }
+
+    uint8_t* _code = nullptr;
+    size_t _size = 0;
+};
+
+#endif //RISCV_SIM_JIT_H
@@ -3,6 +3,11 @@
 #define RISCV_SIM_DATAMEMORY_H
 
 #include "Instruction.h"
+#include "Cache.h"
+#include "MemoryLevel.h"
+#include "Coherence.h"
+#include "PerfCounters.h"
+#include "Clint.h"
 #include <iostream>
 #include <fstream>
 #include <elf.h>
@@ -10,8 +15,8 @@
 #include <vector>
 #include <cassert>
 #include <map>
-#include <queue>
 #include <algorithm>
+#include <limits>
 
 
 //static constexpr size_t memSize = 4*1024*1024; // memory size in 4-byte words
@@ -29,11 +34,26 @@ static constexpr size_t codeCacheSizeLines = codeCacheSizeBytes / lineSizeBytes;
 static constexpr size_t dataCacheSizeBytes = 1024;
 static constexpr size_t dataCacheSizeLines = dataCacheSizeBytes / lineSizeBytes;
 
+// The default caches are fully associative
+static const CacheConfig codeCacheConfig{codeCacheSizeBytes, 0, lineSizeBytes, cacheMemoryLatency};
+static const CacheConfig dataCacheConfig{dataCacheSizeBytes, 0, lineSizeBytes, cacheMemoryLatency};
+
 using Line = std::array<Word, lineSizeWords>;
 
 static Word ToWordAddr(Word addr) { return addr >> 2u; }
-static Word ToLineAddr(Word addr) { return addr & ~(lineSizeBytes - 1); }
-static Word ToLineOffset(Word addr) { return ToWordAddr(addr) & (lineSizeWords - 1); }
+inline Word ToLineAddr(Word addr) { return addr & ~(lineSizeBytes - 1); }
+
+// Access to the words of one line at once, as the vector unit makes them.
+// Only the words in mask are read or written.
+struct LineAccess
+{
+    Word lineAddr = 0;
+    uint32_t mask = 0;
+    bool write = false;
+    Line words{};
+};
+
+static_assert(lineSizeWords <= 32, "A line access mask is expected to cover the whole line");
 
 
 class MemoryStorage {
@@ -99,9 +119,49 @@ public:
         return _mem[ToWordAddr(ip)];
     }
 
-    void Write(Word ip, Word data)
+    // The instruction at a halfword address, the upper half of a 32-bit one may be in the next word
+    Word Fetch(Word ip)
+    {
+        Word parcel = Read(ip) >> (8 * (ip & 2u));
+        if ((ip & 2u) && InstructionLength(parcel) == 4)
+            parcel |= Read(ip + 2) << 16u;
+        return parcel;
+    }
+
+    // Only the bytes in mask are written
+    void Write(Word ip, Word data, Word mask = ~Word(0))
     {
-        _mem[ToWordAddr(ip)] = data;
+        Word& word = _mem[ToWordAddr(ip)];
+        word = (word & ~mask) | (data & mask);
+    }
+
+    // Performs LR, SC or an AMO at once and returns the value for rd. LR reserves
+    // its word for the hart, SC stores only if the reservation is still there.
+    Word Atomic(const Instruction& instr, std::optional<Word>& reservation)
+    {
+        Word addr = ToWordAddr(instr.Addr());
+        Word& word = _mem[addr];
+        switch (instr._type)
+        {
+            case IType::Lr:
+                reservation = addr;
+                return word;
+            case IType::Sc:
+            {
+                bool reserved = reservation == addr;
+                reservation.reset();
+                if (!reserved)
+                    return 1;
+                word = instr._data;
+                return 0;
+            }
+            default:
+            {
+                Word loaded = word;
+                word = AmoValue(instr._aluFunc, loaded, instr._data);
+                return loaded;
+            }
+        }
     }
 
 private:
@@ -158,186 +218,417 @@ public:
     IMem& operator=(const IMem&) = delete;
     IMem& operator=(IMem&&) = delete;
 
+    // Instructions are fetched from halfword addresses. A 16-bit one is in the
+    // low half of the response, the upper half is whatever follows it.
     virtual void Request(Word ip) = 0;
     virtual std::optional<Word> Response() = 0;
-    virtual void Request(const InstructionPtr &instr) = 0;
-    virtual bool Response(const InstructionPtr &instr) = 0;
+
+    // Like Response(), but also returns the following instructions that are wholly
+    // in the same line, up to maxWords in total. Returns 0 until the fetch is done.
+    virtual size_t ResponseBlock(Word* words, size_t maxWords)
+    {
+        std::optional<Word> word = Response();
+        if (!word || maxWords == 0)
+            return 0;
+
+        words[0] = word.value();
+        return 1;
+    }
+
+    // Every data port has at most one outstanding access
+    virtual size_t DataPorts() const
+    {
+        return 1;
+    }
+
+    virtual void Request(const Instruction &instr, size_t port = 0) = 0;
+    virtual bool Response(Instruction &instr, size_t port = 0) = 0;
+
+    // A line access takes a data port like a single load or store.
+    // The CLINT is not accessed by lines: its words read as zero and writes are dropped.
+    virtual void Request(const LineAccess &line, size_t port = 0) = 0;
+    virtual bool Response(LineAccess &line, size_t port = 0) = 0;
+
     virtual void Clock() = 0;
-};
 
+    // Number of cycles before the memory can respond to any outstanding request,
+    // nothing else happens in between
+    virtual size_t CyclesToNextEvent() const = 0;
+    virtual void SkipCycles(size_t cycles) = 0;
 
-class CashMemoryStorage
-{
-public:
-    explicit CashMemoryStorage(MemoryStorage& amem) : _mem(amem) {
+    // Cache events are counted for the hart that owns the memory
+    virtual void SetCounters(PerfCounters* counters)
+    {
+        _counters = counters;
+    }
 
+    // Loads and stores to the CLINT go straight to it, they are never cached
+    void SetClint(Clint* clint)
+    {
+        _clint = clint;
     }
 
-    struct CashUnit{
-        CashUnit(){
-            tag = (~((1u) << (31u))) | (1u << 31u) ;
-        }
+    bool IsMmio(Word addr) const
+    {
+        return _clint && Clint::Contains(addr);
+    }
 
-        CashUnit(Word t, Line l):
-                tag(t), line(l){
+protected:
+    PerfCounters* _counters = nullptr;
+    Clint* _clint = nullptr;
 
-        }
+    void count(PerfEvent event)
+    {
+        if (_counters)
+            _counters->Count(event);
+    }
+};
 
-        Word tag{};
-        Line line{};
-        bool vb = true;
 
-        bool operator == (Word addressTag){
-            return tag == addressTag;
-        }
-        bool operator != (Word addressTag){
-            return tag != addressTag;
-        }
-    };
+// The bottom of the cache hierarchy, it has every line
+class MainMemory : public IMemoryLevel
+{
+public:
+    explicit MainMemory(MemoryStorage& storage, size_t latency = memoryLatency)
+            : _storage(storage), _latency(latency)
+    {
 
+    }
 
-    std::pair <Word, bool> ReadInstruction(Word ip)
+    size_t ReadLine(Word lineAddr, Word* words, size_t count) override
     {
-        Word cacheAddress = ToLineAddr(ip);
-        Word offset = ToLineOffset(ip);
+        for (size_t i = 0; i < count; i++)
+            words[i] = _storage.Read(lineAddr + i * sizeof(Word));
+        return _latency;
+    }
 
-        auto findUnit = std::find(cacheCode.begin(), cacheCode.end(), cacheAddress);
+    void EvictLine(Word lineAddr, const Word* words, size_t count, bool dirty) override
+    {
+        if (dirty)
+            WriteLine(lineAddr, words, count);
+    }
 
-        if(findUnit != cacheCode.end())
-            return std::make_pair(findUnit->line[offset], false);
-        else
-        {
-            Line readLine = ReadLineFromMemory(cacheAddress);
-            CashUnit newUnit = CashUnit(cacheAddress, readLine);
+    void WriteLine(Word lineAddr, const Word* words, size_t count) override
+    {
+        for (size_t i = 0; i < count; i++)
+            _storage.Write(lineAddr + i * sizeof(Word), words[i]);
+    }
 
-            size_t newIndex;
+private:
+    MemoryStorage& _storage;
+    size_t _latency;
+};
 
-            if (codeTimeQueue.size() == codeCacheSizeLines){
-                size_t deletedIndex = codeTimeQueue.front();
-                codeTimeQueue.pop();
-                CashUnit deletedUnit = cacheCode[deletedIndex];
 
-                if (!deletedUnit.vb)
-                    WriteLineInMemory(deletedUnit.tag, deletedUnit.line);
+// Data lines follow MSI or MESI when the cache is attached to a coherence bus.
+// Without one there are no other copies: a clean line is Exclusive, a dirty one Modified.
+// The reservation of LR is a whole line. It is lost when another cache invalidates
+// the line or the line is evicted, so without a bus atomics only work within one hart.
+// Lines come from the next level of the hierarchy, the memory itself if there is none.
+class CashMemoryStorage : public ISnooper, public IUpperLevel
+{
+public:
+    explicit CashMemoryStorage(MemoryStorage& amem, CoherenceBus* bus = nullptr,
+                               const CacheConfig& code = codeCacheConfig, const CacheConfig& data = dataCacheConfig,
+                               IMemoryLevel* next = nullptr)
+            : cacheCode(code), cacheData(data), _memory(amem), _next(next ? *next : _memory), _bus(bus) {
+        if (_bus)
+            _bus->Attach(this);
+        _next.Attach(this);
+    }
 
-                newIndex = deletedIndex;
-            }
-            else
-                newIndex = codeTimeQueue.size();
+    ~CashMemoryStorage() override = default;
+    CashMemoryStorage(const CashMemoryStorage&) = delete;
+    CashMemoryStorage& operator=(const CashMemoryStorage&) = delete;
 
-            cacheCode[newIndex] = newUnit;
-            codeTimeQueue.push(newIndex);
+    // Returns the word and the cycles it takes, 0 on a hit
+    std::pair <Word, size_t> ReadInstruction(Word ip)
+    {
+        if (Cache::Way* way = cacheCode.Find(ip))
+        {
+            cacheCode.Touch(*way);
+            return std::make_pair(cacheCode.WordAt(*way, ip), 0);
+        }
 
-            return std::make_pair(readLine[offset], true);
+        // Code lines are never dirty
+        Cache::Way& victim = cacheCode.Victim(ip);
+        if (victim.state != LineState::Invalid)
+        {
+            victim.state = LineState::Invalid;
+            _next.EvictLine(cacheCode.LineAddr(victim), victim.words, cacheCode.LineWords(), false);
         }
+        size_t latency = _next.ReadLine(cacheCode.LineAddr(ip), victim.words, cacheCode.LineWords());
+        victim.tag = cacheCode.Tag(ip);
+        victim.state = LineState::Exclusive;
+
+        return std::make_pair(cacheCode.WordAt(victim, ip), latency);
     }
 
-    std::pair <Word, bool> LoadInstruction(Word ip)
+    // Returns the word and the cycles it takes, 0 on a hit
+    std::pair <Word, size_t> LoadInstruction(Word ip)
     {
-        Word cacheAddress = ToLineAddr(ip);
-        Word offset = ToLineOffset(ip);
-        auto findUnit = std::find(cacheData.begin(), cacheData.end(), cacheAddress);
-
-        if (findUnit != cacheData.end())
-            return std::make_pair(findUnit->line[offset], false);
-        else
+        if (Cache::Way* way = cacheData.Find(ip))
         {
-            Line readLine = ReadLineFromMemory(cacheAddress);
-            CashUnit newUnit = CashUnit(cacheAddress, readLine);
+            cacheData.Touch(*way);
+            return std::make_pair(cacheData.WordAt(*way, ip), 0);
+        }
 
-            size_t newIndex;
+        LineState state = LineState::Exclusive;
+        if (_bus)
+        {
+            countCoherenceMiss(ip);
+            _stats.busReads++;
+            bool shared = _bus->Read(this, cacheData.LineAddr(ip));
+            state = shared || _bus->GetProtocol() == Protocol::Msi ? LineState::Shared : LineState::Exclusive;
+        }
 
-            if (dataTimeQueue.size() == dataCacheSizeLines){
-                size_t deletedIndex = dataTimeQueue.front();
-                dataTimeQueue.pop();
-                CashUnit deletedUnit = cacheData[deletedIndex];
+        size_t latency = 0;
+        Cache::Way& way = installData(ip, state, latency);
 
-                if (!deletedUnit.vb)
-                    WriteLineInMemory(deletedUnit.tag, deletedUnit.line);
+        return std::make_pair(cacheData.WordAt(way, ip), latency);
+    }
 
-                newIndex = deletedIndex;
+    // Writes the bytes of data in mask. Returns the cycles the store takes, 0 on a hit.
+    size_t StoreInstruction(Word ip, Word data, Word mask = ~Word(0))
+    {
+        if (Cache::Way* way = cacheData.Find(ip))
+        {
+            cacheData.Touch(*way);
+            size_t latency = 0;
+            if (way->state == LineState::Shared)
+            {
+                _stats.busUpgrades++;
+                _bus->Invalidate(this, cacheData.LineAddr(ip));
+                latency = upgradeLatency;
             }
-            else
-                newIndex = dataTimeQueue.size();
 
-            cacheData[newIndex] = newUnit;
-            dataTimeQueue.push(newIndex);
+            Word& word = cacheData.WordAt(*way, ip);
+            word = (word & ~mask) | (data & mask);
+            setState(*way, LineState::Modified);
+            return latency;
+        }
 
-            return std::make_pair(readLine[offset], true);
+        if (_bus)
+        {
+            countCoherenceMiss(ip);
+            _stats.busReadsExclusive++;
+            _bus->Invalidate(this, cacheData.LineAddr(ip));
         }
+
+        size_t latency = 0;
+        Cache::Way& way = installData(ip, LineState::Modified, latency);
+        Word& word = cacheData.WordAt(way, ip);
+        word = (word & ~mask) | (data & mask);
+
+        return latency;
     }
 
-    bool StoreInstruction(Word ip, Word data)
+    // Performs LR, SC or an AMO at once. Returns the value for rd and the cycles it
+    // takes, 0 on a hit. SC and AMOs need the line in the Modified state.
+    std::pair <Word, size_t> AtomicInstruction(const Instruction& instr)
     {
-        Word cacheAddress = ToLineAddr(ip);
-        Word offset = ToLineOffset(ip);
-        auto findUnit = std::find(cacheData.begin(), cacheData.end(), cacheAddress);
-
-        if(findUnit != cacheData.end())
+        Word ip = instr.Addr();
+        Word cacheAddress = cacheData.LineAddr(ip);
+        switch (instr._type)
         {
-            findUnit->line[offset] = data;
-            findUnit->vb = false;
-            return false;
+            case IType::Lr:
+            {
+                auto loadResult = LoadInstruction(ip);
+                _reservation = cacheAddress;
+                return loadResult;
+            }
+            case IType::Sc:
+            {
+                bool reserved = _reservation == cacheAddress;
+                _reservation.reset();
+                if (!reserved)
+                    return std::make_pair(Word(1), size_t(0));
+                return std::make_pair(Word(0), StoreInstruction(ip, instr._data));
+            }
+            default:
+            {
+                // Nothing is written, the line is just taken for writing
+                size_t latency = StoreInstruction(ip, 0, 0);
+                Word& word = cacheData.WordAt(*cacheData.Find(ip), ip);
+                Word loaded = word;
+                word = AmoValue(instr._aluFunc, loaded, instr._data);
+                return std::make_pair(loaded, latency);
+            }
         }
-        else
+    }
+
+    bool SnoopRead(Word lineAddr) override
+    {
+        Cache::Way* way = cacheData.Find(lineAddr);
+        if (way == nullptr)
+            return false;
+
+        if (way->state == LineState::Modified)
         {
-            Line readLine = ReadLineFromMemory(cacheAddress);
-            readLine[offset] = data;
-            CashUnit newUnit = CashUnit(cacheAddress, readLine);
-            newUnit.vb = false;
+            _stats.snoopFlushes++;
+            writeBack(*way);
+        }
+        setState(*way, LineState::Shared);
+        return true;
+    }
 
-            size_t newIndex;
+    bool SnoopInvalidate(Word lineAddr) override
+    {
+        Cache::Way* way = cacheData.Find(lineAddr);
+        if (way == nullptr)
+            return false;
 
-            if (dataTimeQueue.size() == dataCacheSizeLines)
+        if (way->state == LineState::Modified)
+        {
+            _stats.snoopFlushes++;
+            writeBack(*way);
+        }
+        _stats.snoopInvalidations++;
+        setState(*way, LineState::Invalid);
+        cacheData.Invalidated(*way);
+        if (_reservation == lineAddr)
+            _reservation.reset();
+        return true;
+    }
+
+    // The tags are dropped too, so the next misses on the line don't count as coherence misses
+    bool BackInvalidate(Word lineAddr, Word* words, bool& dirty) override
+    {
+        bool copy = false;
+        if (Cache::Way* way = cacheCode.Find(lineAddr))
+        {
+            way->state = LineState::Invalid;
+            way->tag = ~Word(0);
+            cacheCode.Invalidated(*way);
+            copy = true;
+        }
+        if (Cache::Way* way = cacheData.Find(lineAddr))
+        {
+            if (way->state == LineState::Modified)
             {
-                size_t deletedIndex = dataTimeQueue.front();
-                dataTimeQueue.pop();
-                CashUnit deletedUnit = cacheData[deletedIndex];
+                std::copy_n(way->words, cacheData.LineWords(), words);
+                dirty = true;
+            }
+            setState(*way, LineState::Invalid);
+            way->tag = ~Word(0);
+            cacheData.Invalidated(*way);
+            if (_reservation == lineAddr)
+                _reservation.reset();
+            copy = true;
+        }
+        return copy;
+    }
 
-                if (!deletedUnit.vb)
-                    WriteLineInMemory(deletedUnit.tag, deletedUnit.line);
+    const CoherenceStats& GetCoherenceStats() const
+    {
+        return _stats;
+    }
 
-                newIndex = deletedIndex;
-            }
-            else
-                newIndex = dataTimeQueue.size();
+    void SetCounters(PerfCounters* counters)
+    {
+        _counters = counters;
+    }
 
-            cacheData[newIndex] = newUnit;
-            dataTimeQueue.push(newIndex);
+    const Cache& CodeCache() const
+    {
+        return cacheCode;
+    }
 
-            return true;
-        }
+    const Cache& DataCache() const
+    {
+        return cacheData;
     }
 
 private:
-    std::array <CashUnit, codeCacheSizeLines> cacheCode = std::array <CashUnit, codeCacheSizeLines>();
-    std::array <CashUnit, dataCacheSizeLines> cacheData = std::array <CashUnit, dataCacheSizeLines>();
+    Cache cacheCode;
+    Cache cacheData;
 
-    std::queue <size_t> dataTimeQueue = std::queue <size_t>();
-    std::queue <size_t> codeTimeQueue = std::queue <size_t>();
+    MainMemory _memory;
+    IMemoryLevel& _next;
+    CoherenceBus* _bus;
+    CoherenceStats _stats;
+    PerfCounters* _counters = nullptr;
+    std::optional<Word> _reservation;
 
-    MemoryStorage& _mem;
+    void setState(Cache::Way& way, LineState state)
+    {
+        if (way.state == state)
+            return;
+        _stats.transitions[size_t(way.state)][size_t(state)]++;
+        way.state = state;
+    }
 
-    Line ReadLineFromMemory(Word address)
+    // The tag of an invalidated line stays until the way is reused
+    void countCoherenceMiss(Word addr)
     {
-        Line line;
+        if (cacheData.IsInvalidated(addr))
+            _stats.coherenceMisses++;
+    }
 
-        for (size_t i = 0; i < lineSizeWords; i++)
+    // A snoop flush, the line stays
+    void writeBack(Cache::Way& way)
+    {
+        if (_counters)
+            _counters->Count(PerfEvent::Writeback);
+        _next.WriteLine(cacheData.LineAddr(way), way.words, cacheData.LineWords());
+    }
+
+    // Replaces a line with the one of addr. The old line leaves before the new one
+    // is read, since reading can take lines away from this cache.
+    Cache::Way& installData(Word addr, LineState state, size_t& latency)
+    {
+        Cache::Way& way = cacheData.Victim(addr);
+
+        if (way.state != LineState::Invalid)
         {
-            line[i] = _mem.Read(address);
-            address += 1u << 2u;
+            bool dirty = way.state == LineState::Modified;
+            if (dirty && _counters)
+                _counters->Count(PerfEvent::Writeback);
+            setState(way, LineState::Invalid);
+            _next.EvictLine(cacheData.LineAddr(way), way.words, cacheData.LineWords(), dirty);
         }
+        if (_reservation == cacheData.LineAddr(way))
+            _reservation.reset();
+
+        latency = _next.ReadLine(cacheData.LineAddr(addr), way.words, cacheData.LineWords());
+        way.tag = cacheData.Tag(addr);
+        setState(way, state);
+        return way;
+    }
+};
+
+
+// One outstanding request. Instruction fetches and data accesses have separate
+// ports, so a pipelined core may have one of each in flight.
+struct MemPort
+{
+    Word requestedIp = 0;
+    size_t waitCycles = 0;
+    Word data = 0;
+    bool isMiss = false;
+    bool pending = false;       // requested and not responded yet
 
-        return line;
+    void Start(Word ip, size_t latency)
+    {
+        requestedIp = ip;
+        waitCycles = latency;
+        pending = true;
     }
 
-    void WriteLineInMemory(Word address, Line line)
+    void Clock()
     {
-        for (size_t i = 0; i < lineSizeWords; i++)
-        {
-            _mem.Write(address, line[i]);
-            address += 1u << 2u;
-        }
+        if (waitCycles > 0)
+            waitCycles--;
+    }
+
+    void SkipCycles(size_t cycles)
+    {
+        waitCycles -= std::min(cycles, waitCycles);
+    }
+
+    size_t CyclesToResponse() const
+    {
+        return pending ? waitCycles : std::numeric_limits<size_t>::max();
     }
 };
 
@@ -345,92 +636,267 @@ private:
 class CachedMem: public IMem
 {
 public:
-    explicit CachedMem(MemoryStorage& amem):
-            _mem(amem){
+    explicit CachedMem(MemoryStorage& amem, size_t dataPorts = 1, CoherenceBus* bus = nullptr,
+                       const CacheConfig& code = codeCacheConfig, const CacheConfig& data = dataCacheConfig,
+                       IMemoryLevel* next = nullptr):
+            _access(dataPorts), _mem(amem, bus, code, data, next){
 
     }
 
     void Request(Word ip) override
     {
-        _requestedIp = ip;
-        _waitCycles = cacheMemoryLatency;
+        _fetch.Start(ip, _mem.CodeCache().Config().hitLatency);
+        _fetchUpper = false;
     }
 
+    // A 32-bit instruction at ip + 2 is read in two parts, the second one from the
+    // next word. That word may be on the next line, which can miss in turn.
     std::optional<Word> Response() override
     {
-        if (_waitCycles != 0)
+        if (_fetch.waitCycles != 0)
             return std::optional<Word>();
 
-        if (!_isMiss)
+        if (!_fetch.isMiss)
         {
-            auto loadResult = _mem.ReadInstruction(_requestedIp);
-            _data = loadResult.first;
-            _isMiss = loadResult.second;
-            _waitCycles = _isMiss ? memoryLatency : 0;
+            Word ip = _fetch.requestedIp;
+            auto loadResult = _mem.ReadInstruction(_fetchUpper ? ip + 2 : ip);
+            if (_fetchUpper)
+                _fetch.data |= loadResult.first << 16u;
+            else
+                _fetch.data = loadResult.first >> (8 * (ip & 2u));
+            _fetch.waitCycles = loadResult.second;
+            _fetch.isMiss = _fetch.waitCycles != 0;
+            if (_fetch.isMiss)
+                count(PerfEvent::ICacheMiss);
         }
 
-        if (_waitCycles == 0)
+        if (_fetch.waitCycles != 0)
+            return std::optional<Word>();
+
+        _fetch.isMiss = false;
+        if (!_fetchUpper && (_fetch.requestedIp & 2u) && InstructionLength(_fetch.data) == 4)
         {
-            _isMiss = false;
-            return _data;
+            _fetchUpper = true;
+            return Response();
         }
-        else
-            return std::optional<Word>();
+
+        _fetchUpper = false;
+        _fetch.pending = false;
+        return _fetch.data;
     }
 
-    void Request(const InstructionPtr &instr) override
+    // The rest of the line is in the cache once the first instruction has arrived
+    size_t ResponseBlock(Word* words, size_t maxWords) override
     {
-        if (instr->_type != IType::Ld && instr->_type != IType::St)
+        size_t count = IMem::ResponseBlock(words, maxWords);
+        if (count == 0)
+            return 0;
+
+        const Cache& cache = _mem.CodeCache();
+        Word lineAddr = cache.LineAddr(_fetch.requestedIp);
+        Word ip = _fetch.requestedIp + InstructionLength(words[0]);
+        while (count < maxWords && cache.LineAddr(ip) == lineAddr)
+        {
+            Word bits = _mem.ReadInstruction(ip).first >> (8 * (ip & 2u));
+            Word length = InstructionLength(bits);
+            if (cache.LineAddr(ip + length - 1) != lineAddr)
+                break;
+            if (length == 4 && (ip & 2u))
+                bits |= _mem.ReadInstruction(ip + 2).first << 16u;
+            words[count++] = bits;
+            ip += length;
+        }
+
+        return count;
+    }
+
+    size_t DataPorts() const override
+    {
+        return _access.size();
+    }
+
+    void Request(const Instruction &instr, size_t port = 0) override
+    {
+        if (!instr.IsMemAccess())
             return;
 
-        Request(instr->_addr);
+        _access[port].Start(instr.Addr(), IsMmio(instr.Addr()) ? clintLatency : _mem.DataCache().Config().hitLatency);
     }
 
-    bool Response(const InstructionPtr &instr) override
+    bool Response(Instruction &instr, size_t port = 0) override
     {
-        if (instr->_type != IType::Ld && instr->_type != IType::St)
+        if (!instr.IsMemAccess())
             return true;
 
-        if (_waitCycles != 0)
+        MemPort& access = _access[port];
+        if (access.waitCycles != 0)
             return false;
 
-        if (instr->_type == IType::Ld && !_isMiss)
+        if (IsMmio(access.requestedIp))
         {
-            auto loadResult = _mem.LoadInstruction(_requestedIp);
-            _data = loadResult.first;
-            _isMiss = loadResult.second;
-            _waitCycles = _isMiss ? memoryLatency : 0;
+            _clint->Access(instr);
+            access.pending = false;
+            return true;
+        }
+
+        if (instr._type == IType::Ld && !access.isMiss)
+        {
+            auto loadResult = _mem.LoadInstruction(access.requestedIp);
+            access.data = loadResult.first;
+            access.waitCycles = loadResult.second;
+            access.isMiss = access.waitCycles != 0;
+            if (access.isMiss)
+                count(PerfEvent::DCacheMiss);
+        }
+        else if (instr._type == IType::St && !access.isMiss)
+        {
+            access.waitCycles = _mem.StoreInstruction(access.requestedIp,
+                                                      StoreLane(access.requestedIp, instr._flags, instr._data),
+                                                      AccessMask(access.requestedIp, instr._flags));
+            access.isMiss = access.waitCycles != 0;
+            if (access.isMiss)
+                count(PerfEvent::DCacheMiss);
+        }
+        else if (instr.IsAtomic() && !access.isMiss)
+        {
+            auto atomicResult = _mem.AtomicInstruction(instr);
+            access.data = atomicResult.first;
+            access.waitCycles = atomicResult.second;
+            access.isMiss = access.waitCycles != 0;
+            if (access.isMiss)
+                count(PerfEvent::DCacheMiss);
+        }
+
+        // A hit on a line that another port is still filling waits for the fill
+        if (!access.isMiss)
+        {
+            access.waitCycles = fillCycles(access.requestedIp);
+            access.isMiss = access.waitCycles != 0;
+        }
+
+        if (access.waitCycles == 0)
+        {
+            if (instr._type == IType :: Ld)
+                instr._data = LoadLane(access.requestedIp, instr._flags, access.data);
+            else if (instr.IsAtomic())
+                instr._data = access.data;
+
+            access.isMiss = false;
+            access.pending = false;
         }
-        else if (instr->_type == IType::St && !_isMiss)
+
+        return access.waitCycles == 0;
+    }
+
+    void Request(const LineAccess &line, size_t port = 0) override
+    {
+        _access[port].Start(line.lineAddr, IsMmio(line.lineAddr) ? clintLatency : _mem.DataCache().Config().hitLatency);
+    }
+
+    // Takes as long as the slowest word. With lines as long as the access only the first word may miss.
+    bool Response(LineAccess &line, size_t port = 0) override
+    {
+        MemPort& access = _access[port];
+        if (access.waitCycles != 0)
+            return false;
+
+        if (IsMmio(line.lineAddr))
         {
-            _isMiss = _mem.StoreInstruction(_requestedIp, instr->_data);
-            _waitCycles = _isMiss ? memoryLatency : 0;
+            if (!line.write)
+                line.words.fill(0);
+            access.pending = false;
+            return true;
         }
 
-        if (_waitCycles == 0)
+        if (!access.isMiss)
         {
-            if (instr->_type == IType :: Ld)
-                instr->_data = _data;
+            for (Word i = 0; i < lineSizeWords; i++)
+            {
+                if (!((line.mask >> i) & 1u))
+                    continue;
+
+                Word addr = line.lineAddr + i * sizeof(Word);
+                if (line.write)
+                {
+                    access.waitCycles = std::max(access.waitCycles, _mem.StoreInstruction(addr, line.words[i]));
+                }
+                else
+                {
+                    auto loadResult = _mem.LoadInstruction(addr);
+                    line.words[i] = loadResult.first;
+                    access.waitCycles = std::max(access.waitCycles, loadResult.second);
+                }
+            }
+            access.isMiss = access.waitCycles != 0;
+            if (access.isMiss)
+                count(PerfEvent::DCacheMiss);
+            else
+            {
+                access.waitCycles = fillCycles(line.lineAddr);
+                access.isMiss = access.waitCycles != 0;
+            }
+        }
 
-            _isMiss = false;
+        if (access.waitCycles == 0)
+        {
+            access.isMiss = false;
+            access.pending = false;
         }
 
-        return _waitCycles == 0;
+        return access.waitCycles == 0;
+    }
+
+    const CoherenceStats& GetCoherenceStats() const
+    {
+        return _mem.GetCoherenceStats();
+    }
+
+    void SetCounters(PerfCounters* counters) override
+    {
+        IMem::SetCounters(counters);
+        _mem.SetCounters(counters);
     }
 
     void Clock() override
     {
-        if (_waitCycles > 0)
-            _waitCycles--;
+        _fetch.Clock();
+        for (MemPort& access : _access)
+            access.Clock();
+    }
+
+    size_t CyclesToNextEvent() const override
+    {
+        size_t cycles = _fetch.CyclesToResponse();
+        for (const MemPort& access : _access)
+            cycles = std::min(cycles, access.CyclesToResponse());
+        return cycles;
+    }
+
+    void SkipCycles(size_t cycles) override
+    {
+        _fetch.SkipCycles(cycles);
+        for (MemPort& access : _access)
+            access.SkipCycles(cycles);
     }
 
 private:
-    Word _requestedIp = 0;
-    size_t _waitCycles = 0;
-    Word _data;
-    bool _isMiss = false;
+    MemPort _fetch;
+    bool _fetchUpper = false;       // reading the second part of the fetched instruction
+    std::vector<MemPort> _access;
 
     CashMemoryStorage _mem;
+
+    size_t fillCycles(Word addr) const
+    {
+        const Cache& cache = _mem.DataCache();
+        size_t cycles = 0;
+        for (const MemPort& access : _access)
+        {
+            if (access.isMiss && cache.LineAddr(access.requestedIp) == cache.LineAddr(addr))
+                cycles = std::max(cycles, access.waitCycles);
+        }
+        return cycles;
+    }
 };
 
 
@@ -445,53 +911,99 @@ public:
 
     void Request(Word ip) override
     {
-        _requestedIp = ip;
-        _waitCycles = latency;
+        _fetch.Start(ip, latency);
     }
 
     std::optional<Word> Response() override
     {
-        if (_waitCycles > 0)
+        if (_fetch.waitCycles > 0)
             return std::optional<Word>();
 
-        return _mem.Read(_requestedIp);
+        _fetch.pending = false;
+        return _mem.Fetch(_fetch.requestedIp);
     }
 
-    void Request(const InstructionPtr &instr) override
+    void Request(const Instruction &instr, size_t = 0) override
     {
-        if (instr->_type != IType::Ld && instr->_type != IType::St)
+        if (!instr.IsMemAccess())
             return;
 
-        Request(instr->_addr);
+        _access.Start(instr.Addr(), IsMmio(instr.Addr()) ? clintLatency : latency);
     }
 
-    bool Response(const InstructionPtr &instr) override
+    bool Response(Instruction &instr, size_t = 0) override
     {
-        if (instr->_type != IType::Ld && instr->_type != IType::St)
+        if (!instr.IsMemAccess())
             return true;
 
-        if (_waitCycles != 0)
+        if (_access.waitCycles != 0)
             return false;
 
-        if (instr->_type == IType::Ld)
-            instr->_data = _mem.Read(instr->_addr);
-        else if (instr->_type == IType::St)
-            _mem.Write(instr->_addr, instr->_data);
+        Word addr = instr.Addr();
+        if (IsMmio(addr))
+            _clint->Access(instr);
+        else if (instr._type == IType::Ld)
+            instr._data = LoadLane(addr, instr._flags, _mem.Read(addr));
+        else if (instr._type == IType::St)
+            _mem.Write(addr, StoreLane(addr, instr._flags, instr._data), AccessMask(addr, instr._flags));
+        else
+            instr._data = _mem.Atomic(instr, _reservation);
 
+        _access.pending = false;
         return true;
     }
 
-    void Clock()
+    void Request(const LineAccess &line, size_t = 0) override
+    {
+        _access.Start(line.lineAddr, IsMmio(line.lineAddr) ? clintLatency : latency);
+    }
+
+    bool Response(LineAccess &line, size_t = 0) override
+    {
+        if (_access.waitCycles != 0)
+            return false;
+
+        for (Word i = 0; i < lineSizeWords; i++)
+        {
+            Word addr = line.lineAddr + i * sizeof(Word);
+            if (!((line.mask >> i) & 1u))
+                continue;
+
+            if (IsMmio(addr))
+                line.words[i] = line.write ? line.words[i] : 0;
+            else if (line.write)
+                _mem.Write(addr, line.words[i]);
+            else
+                line.words[i] = _mem.Read(addr);
+        }
+
+        _access.pending = false;
+        return true;
+    }
+
+    void Clock() override
+    {
+        _fetch.Clock();
+        _access.Clock();
+    }
+
+    size_t CyclesToNextEvent() const override
+    {
+        return std::min(_fetch.CyclesToResponse(), _access.CyclesToResponse());
+    }
+
+    void SkipCycles(size_t cycles) override
     {
-        if (_waitCycles > 0)
-            _waitCycles--;
+        _fetch.SkipCycles(cycles);
+        _access.SkipCycles(cycles);
     }
 
 private:
     static constexpr size_t latency = 120;
-    Word _requestedIp = 0;
-    size_t _waitCycles = 0;
+    MemPort _fetch;
+    MemPort _access;
     MemoryStorage& _mem;
+    std::optional<Word> _reservation;
 };
 
 #endif //RISCV_SIM_DATAMEMORY_H
@@ -0,0 +1,220 @@
+#ifndef RISCV_SIM_MEMORYLEVEL_H
+#define RISCV_SIM_MEMORYLEVEL_H
+
+#include "BaseTypes.h"
+#include "Cache.h"
+
+#include <algorithm>
+#include <vector>
+
+// How a cache level keeps the lines of the caches above it
+enum class Inclusion : uint8_t
+{
+    Nine,           // non-inclusive non-exclusive: lines are filled on the way up, replacing them affects nobody
+    Inclusive,      // every line above is here too, replacing one invalidates the copies above
+    Exclusive,      // a line is either here or above: a hit moves it up, the lines replaced above come here
+};
+
+struct LevelStats
+{
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t writebacks = 0;            // dirty lines written to the level below
+    uint64_t backInvalidations = 0;     // replaced lines that still had copies above
+};
+
+// A cache above a level. The level may take a line away from it.
+class IUpperLevel
+{
+public:
+    virtual ~IUpperLevel() = default;
+
+    // Drops the copies of the line. The data of a dirty copy is written to words and
+    // dirty is set. Returns true if there was a copy.
+    virtual bool BackInvalidate(Word lineAddr, Word* words, bool& dirty) = 0;
+};
+
+// A level below the first-level caches, down to the memory. Lines move between
+// levels whole, so all cache levels have the line size of the first-level caches.
+class IMemoryLevel
+{
+public:
+    IMemoryLevel() = default;
+    virtual ~IMemoryLevel() = default;
+    IMemoryLevel(const IMemoryLevel &) = delete;
+    IMemoryLevel(IMemoryLevel &&) = delete;
+
+    IMemoryLevel& operator=(const IMemoryLevel&) = delete;
+    IMemoryLevel& operator=(IMemoryLevel&&) = delete;
+
+    // Reads the line and returns the cycles it takes
+    virtual size_t ReadLine(Word lineAddr, Word* words, size_t count) = 0;
+
+    // A line replaced above. A clean one may be dropped.
+    virtual void EvictLine(Word lineAddr, const Word* words, size_t count, bool dirty) = 0;
+
+    // The data of a dirty line flushed for a snoop, the cache above may keep a clean copy
+    virtual void WriteLine(Word lineAddr, const Word* words, size_t count) = 0;
+
+    // A cache above registers itself, the memory never takes lines away
+    virtual void Attach(IUpperLevel*)
+    {
+
+    }
+};
+
+// A cache below the first-level caches, shared by all of them. Lines are written
+// back when they leave the level; there are no other copies at the same level,
+// so a clean line is Exclusive and a dirty one Modified. Writebacks take no time,
+// only reads add the latency of the levels they go through.
+class CacheLevel : public IMemoryLevel, public IUpperLevel
+{
+public:
+    CacheLevel(const CacheConfig& config, Inclusion inclusion, IMemoryLevel& next)
+            : _cache(config), _inclusion(inclusion), _next(next)
+    {
+        _next.Attach(this);
+    }
+
+    const Cache& GetCache() const
+    {
+        return _cache;
+    }
+
+    const LevelStats& GetStats() const
+    {
+        return _stats;
+    }
+
+    size_t ReadLine(Word lineAddr, Word* words, size_t count) override
+    {
+        size_t latency = _cache.Config().hitLatency;
+        if (Cache::Way* way = _cache.Find(lineAddr))
+        {
+            _stats.hits++;
+            _cache.Touch(*way);
+            std::copy_n(way->words, count, words);
+            if (_inclusion == Inclusion::Exclusive)
+            {
+                // The line goes up clean, so its data has to be below
+                if (way->state == LineState::Modified)
+                    writeBack(lineAddr, way->words);
+                way->state = LineState::Invalid;
+                _cache.Invalidated(*way);
+            }
+            return latency;
+        }
+
+        _stats.misses++;
+        if (_inclusion == Inclusion::Exclusive)
+            return latency + _next.ReadLine(lineAddr, words, count);
+
+        Cache::Way& way = replace(lineAddr);
+        latency += _next.ReadLine(lineAddr, way.words, count);
+        std::copy_n(way.words, count, words);
+        return latency;
+    }
+
+    void EvictLine(Word lineAddr, const Word* words, size_t count, bool dirty) override
+    {
+        Cache::Way* way = _cache.Find(lineAddr);
+        if (way == nullptr)
+        {
+            // Only an exclusive level takes the clean lines
+            if (!dirty && _inclusion != Inclusion::Exclusive)
+            {
+                _next.EvictLine(lineAddr, words, count, false);
+                return;
+            }
+            way = &replace(lineAddr);
+        }
+        else if (!dirty)
+        {
+            return;
+        }
+
+        std::copy_n(words, count, way->words);
+        if (dirty)
+            way->state = LineState::Modified;
+    }
+
+    void WriteLine(Word lineAddr, const Word* words, size_t count) override
+    {
+        Cache::Way* way = _cache.Find(lineAddr);
+        if (way == nullptr)
+        {
+            _next.WriteLine(lineAddr, words, count);
+            return;
+        }
+
+        std::copy_n(words, count, way->words);
+        way->state = LineState::Modified;
+    }
+
+    void Attach(IUpperLevel* upper) override
+    {
+        _uppers.push_back(upper);
+    }
+
+    // The copies above are newer than the one here
+    bool BackInvalidate(Word lineAddr, Word* words, bool& dirty) override
+    {
+        bool copy = false;
+        if (Cache::Way* way = _cache.Find(lineAddr))
+        {
+            if (way->state == LineState::Modified)
+            {
+                std::copy_n(way->words, _cache.LineWords(), words);
+                dirty = true;
+            }
+            way->state = LineState::Invalid;
+            _cache.Invalidated(*way);
+            copy = true;
+        }
+        for (IUpperLevel* upper : _uppers)
+            copy |= upper->BackInvalidate(lineAddr, words, dirty);
+        return copy;
+    }
+
+private:
+    Cache _cache;
+    Inclusion _inclusion;
+    IMemoryLevel& _next;
+    std::vector<IUpperLevel*> _uppers;
+    LevelStats _stats;
+
+    void writeBack(Word lineAddr, const Word* words)
+    {
+        _stats.writebacks++;
+        _next.WriteLine(lineAddr, words, _cache.LineWords());
+    }
+
+    // A clean way for the line. The line replaced there goes down, an inclusive
+    // level takes its copies from above first.
+    Cache::Way& replace(Word lineAddr)
+    {
+        Cache::Way& way = _cache.Victim(lineAddr);
+        if (way.state != LineState::Invalid)
+        {
+            Word victimAddr = _cache.LineAddr(way);
+            bool dirty = way.state == LineState::Modified;
+            if (_inclusion == Inclusion::Inclusive)
+            {
+                bool copy = false;
+                for (IUpperLevel* upper : _uppers)
+                    copy |= upper->BackInvalidate(victimAddr, way.words, dirty);
+                if (copy)
+                    _stats.backInvalidations++;
+            }
+            if (dirty)
+                _stats.writebacks++;
+            _next.EvictLine(victimAddr, way.words, _cache.LineWords(), dirty);
+        }
+
+        way.tag = _cache.Tag(lineAddr);
+        way.state = LineState::Exclusive;
+        return way;
+    }
+};
+
+#endif //RISCV_SIM_MEMORYLEVEL_H
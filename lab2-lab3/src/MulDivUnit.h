@@ -0,0 +1,65 @@
+#ifndef RISCV_SIM_MULDIVUNIT_H
+#define RISCV_SIM_MULDIVUNIT_H
+
+#include "Instruction.h"
+
+#include <algorithm>
+
+struct MulDivConfig
+{
+    size_t mulLatency = 4;      // cycles in execute, an ALU operation takes 1
+    size_t divLatency = 32;
+    bool pipelined = false;     // an iterative unit takes one operation at a time
+};
+
+// Multiplier and divider of the M extension shared by all operations of a core
+class MulDivUnit
+{
+public:
+    explicit MulDivUnit(const MulDivConfig& config = MulDivConfig())
+            : _config(config)
+    {
+
+    }
+
+    size_t Latency(const Instruction& instr) const
+    {
+        return std::max<size_t>(1, instr.IsDiv() ? _config.divLatency : _config.mulLatency);
+    }
+
+    bool CanStart() const
+    {
+        return _config.pipelined || _busyCycles == 0;
+    }
+
+    // Returns the number of cycles until the result is ready
+    size_t Start(const Instruction& instr)
+    {
+        size_t latency = Latency(instr);
+        if (!_config.pipelined)
+            _busyCycles = latency;
+        return latency;
+    }
+
+    void Clock()
+    {
+        if (_busyCycles > 0)
+            _busyCycles--;
+    }
+
+    void SkipCycles(size_t cycles)
+    {
+        _busyCycles -= std::min(cycles, _busyCycles);
+    }
+
+    void Reset()
+    {
+        _busyCycles = 0;
+    }
+
+private:
+    MulDivConfig _config;
+    size_t _busyCycles = 0;
+};
+
+#endif //RISCV_SIM_MULDIVUNIT_H
@@ -0,0 +1,888 @@
+#ifndef RISCV_SIM_OOOCPU_H
+#define RISCV_SIM_OOOCPU_H
+
+#include "Memory.h"
+#include "DecodeCache.h"
+#include "RegisterFile.h"
+#include "CsrFile.h"
+#include "Executor.h"
+#include "BranchPredictor.h"
+#include "MulDivUnit.h"
+#include "FpUnit.h"
+#include "Fusion.h"
+#include "VectorUnit.h"
+
+#include <deque>
+#include <limits>
+
+struct OooConfig
+{
+    size_t fetchWidth = 4;
+    size_t issueWidth = 4;
+    size_t commitWidth = 4;
+    size_t robSize = 64;
+    size_t iqSize = 32;
+    size_t lsqSize = 32;
+    size_t physRegs = 128;     // the first archRegs hold the committed x and f registers
+    size_t dataPorts = 4;       // outstanding data cache accesses
+    bool fusion = false;        // macro-op fusion of the pairs in Fusion.h
+
+    // Every structure holds at least one entry and some physical registers are left for renaming
+    bool IsValid() const
+    {
+        return fetchWidth > 0 && issueWidth > 0 && commitWidth > 0 && robSize > 0 && iqSize > 0 &&
+               lsqSize > 0 && dataPorts > 0 && physRegs > archRegs;
+    }
+};
+
+// Cycles spent at each occupancy of a structure
+struct Histogram
+{
+    std::vector<uint64_t> cycles;
+
+    explicit Histogram(size_t capacity)
+            : cycles(capacity + 1)
+    {
+
+    }
+
+    void Sample(size_t occupancy, uint64_t count = 1)
+    {
+        cycles[occupancy] += count;
+    }
+};
+
+struct OooStats
+{
+    explicit OooStats(const OooConfig& config)
+            : fetchQueue(2 * config.fetchWidth), rob(config.robSize), iq(config.iqSize),
+              lsq(config.lsqSize), physRegs(config.physRegs - archRegs)
+    {
+
+    }
+
+    uint64_t cycles = 0;
+    uint64_t committed = 0;
+    uint64_t mispredicts = 0;
+    uint64_t squashed = 0;
+    uint64_t forwardedLoads = 0;
+    std::array<uint64_t, static_cast<size_t>(FusionKind::Count)> fused{};     // committed pairs
+    Histogram fetchQueue;
+    Histogram rob;
+    Histogram iq;
+    Histogram lsq;
+    Histogram physRegs;         // renamed registers not committed yet
+};
+
+// Superscalar out-of-order core. Instructions are fetched along the predicted
+// path, renamed onto a physical register file, issued from the issue queue when
+// their operands are ready and committed in order from the reorder buffer,
+// which is where RegisterFile and CsrFile are updated. Branches are resolved
+// after execution and squash everything younger on a mispredict.
+// Loads go to the memory once the addresses of all older stores are known, or
+// take the data of an older store that wrote all of their bytes. A load that
+// would need bytes from both a store and the memory waits for the store to drain.
+// Stores write the memory after commit. LR, SC and AMOs go to the memory at the
+// head of the ROB once the older stores have drained, younger loads wait for them.
+// Every data port of the memory may have its own miss outstanding.
+// CSR instructions, traps, returns from them and WFI are executed when they reach
+// the head of the ROB. Interrupts are taken at the head too, in place of the
+// instruction there, which is fetched again after the handler.
+// Multiplies and divides share one unit, which may or may not be pipelined.
+// FP operations go to the FP unit, they read frm when they issue, so committing
+// a write to frm or fcsr squashes everything younger.
+// Vector instructions run on the vector unit one at a time at the head of the ROB.
+// Vector loads and stores are in the LSQ like atomics, they wait for the older
+// stores to drain and use the first data port, nothing younger passes them.
+// With fusion on, a fused pair takes a single slot everywhere from dispatch to commit.
+class OooCpu
+{
+public:
+
+    OooCpu(IMem& mem, IBranchPredictor& bpred, const OooConfig& config = OooConfig(),
+           const MulDivConfig& mulDiv = MulDivConfig(), const VectorConfig& vector = VectorConfig(),
+           const FpuConfig& fpu = FpuConfig())
+            : _mem(mem), _bpred(bpred), _config(config), _mulDiv(mulDiv), _fpu(fpu), _vector(vector), _stats(config),
+              _prf(config.physRegs), _prfReady(config.physRegs), _ports(mem.DataPorts())
+    {
+        _mem.SetCounters(&_csrf.Counters());
+
+    }
+
+    void Clock()
+    {
+        _csrf.Clock();
+        _mulDiv.Clock();
+        _fpu.Clock();
+        _changed = false;
+
+        commit();
+        memory();
+        complete();
+        issue();
+        dispatch();
+        fetch();
+
+        _idle = !_changed;
+        sample(1);
+    }
+
+    // A cycle without any change is repeated until the memory or the vector unit is done
+    size_t CyclesToNextEvent() const
+    {
+        return _idle ? _vector.CyclesToNextEvent() : 0;
+    }
+
+    void SkipCycles(size_t cycles)
+    {
+        _csrf.Clock(cycles);
+        _mulDiv.SkipCycles(cycles);
+        _fpu.SkipCycles(cycles);
+        _vector.SkipCycles(cycles);
+        sample(cycles);
+    }
+
+    void Reset(Word ip, Word hartId = 0, Word harts = 1)
+    {
+        _csrf.Reset(hartId, harts);
+        flushAll(ip);
+    }
+
+    // Continues from the architectural state reached by another model,
+    // e.g. after fast-forwarding with FunctionalCpu
+    void Restore(Word ip, const RegisterFile& rf, const CsrFile& csrf, const VectorRegisterFile& vrf)
+    {
+        _rf = rf;
+        _csrf = csrf;
+        _vector.Restore(vrf);
+        flushAll(ip);
+    }
+
+    std::optional<CpuToHostData> GetMessage()
+    {
+        return _csrf.GetMessage();
+    }
+
+    const OooStats& GetStats() const
+    {
+        return _stats;
+    }
+
+    const VectorStats& GetVectorStats() const
+    {
+        return _vector.GetStats();
+    }
+
+    // Timer and software interrupts come from the CLINT
+    void SetClint(Clint* clint)
+    {
+        _csrf.SetClint(clint);
+        _mem.SetClint(clint);
+    }
+
+private:
+    using PhysReg = uint16_t;
+
+    struct Fetched
+    {
+        Word ip;
+        Word word;
+        Prediction prediction;
+    };
+
+    enum class State : uint8_t
+    {
+        Waiting,        // in the issue queue
+        Executing,
+        Memory,         // address known, waiting for the data
+        Done,
+    };
+
+    struct RobEntry
+    {
+        Instruction instr;
+        Word ip;
+        Word nextIp;
+        Prediction prediction;
+        uint64_t seq;
+        PhysReg dst;
+        PhysReg prevDst;
+        PhysReg src1;
+        PhysReg src2;
+        State state;
+        PhysReg src3 = 0;       // the addend of a fused multiply-add
+        FusionKind fusion = FusionKind::None;
+        Instruction first{};    // of a fused pair, instr is the second one and src1 is read by this one
+    };
+
+    struct LsqEntry
+    {
+        uint64_t seq;
+        Instruction instr;
+        bool addrReady = false;
+        bool committed = false;
+        bool issued = false;        // sent to the memory
+    };
+
+    struct Port
+    {
+        bool busy = false;
+        bool squashed = false;      // the load has been squashed, only the response is awaited
+        uint64_t seq = 0;
+        Instruction instr;
+    };
+
+    struct Executing
+    {
+        uint64_t seq;
+        size_t cycles;
+    };
+
+    IMem& _mem;
+    IBranchPredictor& _bpred;
+    OooConfig _config;
+    MulDivUnit _mulDiv;
+    FpUnit _fpu;
+    VectorUnit _vector;
+    OooStats _stats;
+    DecodeCache _decodeCache;
+    RegisterFile _rf;               // committed state
+    CsrFile _csrf;
+
+    std::vector<Word> _prf;
+    std::vector<bool> _prfReady;
+    std::array<PhysReg, archRegs> _renameMap{};
+    std::vector<PhysReg> _freeList;
+
+    std::deque<Fetched> _fetchQueue;
+    std::deque<RobEntry> _rob;
+    std::vector<uint64_t> _iq;      // oldest first
+    std::deque<LsqEntry> _lsq;
+    std::vector<Executing> _executing;
+    std::vector<Port> _ports;
+    uint64_t _nextSeq = 0;
+
+    Word _fetchIp = 0;
+    bool _fetchPending = false;
+    bool _fetchSquashed = false;
+
+    bool _changed = false;
+    bool _idle = false;
+
+    static bool isMemAccess(IType type)
+    {
+        return type == IType::Ld || type == IType::St || type == IType::Lr || type == IType::Sc ||
+               type == IType::Amo;
+    }
+
+    static bool isSystem(IType type)
+    {
+        return type == IType::Csrr || type == IType::Csrw || type == IType::Csrrw || type == IType::Trap ||
+               type == IType::Mret || type == IType::Wfi;
+    }
+
+    RobEntry& robEntry(uint64_t seq)
+    {
+        return _rob[seq - _rob.front().seq];
+    }
+
+    LsqEntry* lsqEntry(uint64_t seq)
+    {
+        for (LsqEntry& entry : _lsq)
+        {
+            if (entry.seq == seq)
+                return &entry;
+        }
+        return nullptr;
+    }
+
+    void writeResult(const RobEntry& entry)
+    {
+        _prf[entry.dst] = entry.instr._data;
+        _prfReady[entry.dst] = true;
+        _prf[0] = 0;
+    }
+
+    void sample(uint64_t cycles)
+    {
+        _stats.cycles += cycles;
+        _stats.fetchQueue.Sample(_fetchQueue.size(), cycles);
+        _stats.rob.Sample(_rob.size(), cycles);
+        _stats.iq.Sample(_iq.size(), cycles);
+        _stats.lsq.Sample(_lsq.size(), cycles);
+        _stats.physRegs.Sample(_config.physRegs - archRegs - _freeList.size(), cycles);
+    }
+
+    void commit()
+    {
+        for (size_t i = 0; i < _config.commitWidth && !_rob.empty(); i++)
+        {
+            RobEntry& head = _rob.front();
+
+            // A WFI completes before the interrupt it waits for is taken.
+            // An atomic that has reached the memory can't be taken back, nor can a started vector instruction.
+            if (head.instr._type == IType::Wfi)
+            {
+                if (_csrf.WaitsForInterrupt())
+                    break;
+            }
+            else if (!(head.instr.IsAtomic() && lsqEntry(head.seq)->issued) &&
+                     !(head.instr.IsVector() && head.state != State::Waiting))
+            {
+                if (auto cause = _csrf.PendingInterrupt())
+                {
+                    Word epc = head.fusion != FusionKind::None ? head.ip - head.first.Length() : head.ip;
+                    Word handler = _csrf.Trap(*cause, epc);
+                    _bpred.Recover(epc, Instruction(), handler, head.prediction);
+                    squash(head.seq);
+                    redirect(handler);
+                    _changed = true;
+                    break;
+                }
+            }
+
+            if (isSystem(head.instr._type) && head.state == State::Waiting)
+            {
+                readOperands(head);
+                _csrf.Read(head.instr);
+                head.nextIp = Executor::Execute(head.instr, head.ip);
+                writeResult(head);
+                head.state = State::Done;
+                _iq.erase(std::find(_iq.begin(), _iq.end(), head.seq));
+                resolve(head);
+            }
+
+            if (head.instr.IsVector() && !executeVector(head))
+                break;
+
+            if (head.state != State::Done)
+                break;
+
+            if (head.fusion != FusionKind::None)
+            {
+                _rf.Write(head.first);
+                _csrf.InstructionExecuted();
+                _stats.committed++;
+                _stats.fused[size_t(head.fusion)]++;
+            }
+
+            if (head.instr._type == IType::St)
+                lsqEntry(head.seq)->committed = true;
+            else if (head.instr._type == IType::Ld || head.instr.IsAtomic() || head.instr.IsVectorMem())
+                _lsq.erase(std::find_if(_lsq.begin(), _lsq.end(),
+                                        [&head](const LsqEntry& entry) { return entry.seq == head.seq; }));
+
+            _bpred.Update(head.ip, head.instr, head.nextIp, head.prediction);
+            _rf.Write(head.instr);
+            _csrf.Write(head.instr);
+            _csrf.InstructionExecuted();
+            if (head.dst != 0)
+                _freeList.push_back(head.prevDst);
+
+            bool message = head.instr._type == IType::Csrw || head.instr._type == IType::Csrrw;
+            bool frmWritten = message && (head.instr.Csr() == CsrIdx::Frm || head.instr.Csr() == CsrIdx::Fcsr);
+            if (frmWritten)
+                _bpred.Recover(head.ip, head.instr, head.nextIp, head.prediction);
+            uint64_t seq = head.seq;
+            Word nextIp = head.nextIp;
+            _rob.pop_front();
+            _stats.committed++;
+            _changed = true;
+
+            // The FP operations issued after it may have used the old rounding mode
+            if (frmWritten)
+            {
+                squash(seq + 1);
+                redirect(nextIp);
+            }
+
+            // There is room for one message for the host per cycle
+            if (message)
+                break;
+        }
+    }
+
+    // Starts the vector instruction at the head of the ROB or goes on with it,
+    // returns true once it is done
+    bool executeVector(RobEntry& head)
+    {
+        if (head.state == State::Waiting)
+        {
+            if (head.instr.IsVectorMem() && (_lsq.front().seq != head.seq || _ports[0].busy))
+                return false;
+
+            readOperands(head);
+            head.nextIp = Executor::Execute(head.instr, head.ip);
+            _vector.Start(head.instr);
+            if (head.instr._type == IType::Vst)
+                _decodeCache.Invalidate(head.instr, _vector.Registers());
+            head.state = State::Executing;
+            _iq.erase(std::find(_iq.begin(), _iq.end(), head.seq));
+            _changed = true;
+        }
+
+        if (!_vector.Clock(_mem))
+            return false;
+
+        head.state = State::Done;
+        writeResult(head);
+        _changed = true;
+        return true;
+    }
+
+    void memory()
+    {
+        // Responses
+        for (size_t port = 0; port < _ports.size(); port++)
+        {
+            Port& p = _ports[port];
+            if (!p.busy || !_mem.Response(p.instr, port))
+                continue;
+
+            p.busy = false;
+            _changed = true;
+            if (p.squashed)
+                continue;
+
+            if (p.instr._type == IType::St)
+            {
+                _decodeCache.Invalidate(p.instr.Addr());
+                _lsq.pop_front();
+                continue;
+            }
+
+            if (p.instr.IsAtomic())
+                _decodeCache.Invalidate(p.instr.Addr());
+
+            RobEntry& entry = robEntry(p.seq);
+            entry.instr._data = p.instr._data;
+            entry.state = State::Done;
+            writeResult(entry);
+        }
+
+        // The oldest store drains once it has committed, one at a time to keep the order
+        if (!_lsq.empty() && _lsq.front().committed && !_lsq.front().issued)
+            access(_lsq.front());
+
+        // Loads may pass older stores with known and different addresses.
+        // An atomic waits until it is the oldest instruction and every older store has
+        // drained, nothing younger passes it. The same goes for vector loads and stores.
+        for (LsqEntry& entry : _lsq)
+        {
+            if (entry.instr.IsVectorMem())
+                break;
+
+            if (entry.instr.IsAtomic())
+            {
+                if (entry.addrReady && !entry.issued && &entry == &_lsq.front() && _rob.front().seq == entry.seq)
+                    access(entry);
+                break;
+            }
+
+            if (entry.instr._type == IType::St)
+            {
+                if (!entry.addrReady)
+                    break;
+                continue;
+            }
+
+            if (!entry.addrReady || entry.issued)
+                continue;
+
+            RobEntry& rob = robEntry(entry.seq);
+            const LsqEntry* store = olderStore(entry);
+            if (store && !covers(*store, entry))
+            {
+                // Only some of the bytes would come from the store, wait until it has drained
+                continue;
+            }
+            else if (store)
+            {
+                Word word = StoreLane(store->instr.Addr(), store->instr._flags, store->instr._data);
+                rob.instr._data = LoadLane(entry.instr.Addr(), entry.instr._flags, word);
+                rob.state = State::Done;
+                writeResult(rob);
+                entry.issued = true;
+                _stats.forwardedLoads++;
+                _changed = true;
+            }
+            else if (entry.instr.Addr() >= memSize * sizeof(Word) && !_mem.IsMmio(entry.instr.Addr()))
+            {
+                // Only on a wrong path, the value does not matter
+                rob.instr._data = 0;
+                rob.state = State::Done;
+                writeResult(rob);
+                entry.issued = true;
+                _changed = true;
+            }
+            else if (!access(entry))
+                break;
+        }
+    }
+
+    static Word accessMask(const LsqEntry& entry)
+    {
+        return AccessMask(entry.instr.Addr(), entry.instr._flags);
+    }
+
+    static bool covers(const LsqEntry& store, const LsqEntry& load)
+    {
+        return (accessMask(store) & accessMask(load)) == accessMask(load);
+    }
+
+    // The youngest older store writing any of the bytes the load reads
+    const LsqEntry* olderStore(const LsqEntry& load) const
+    {
+        const LsqEntry* found = nullptr;
+        for (const LsqEntry& entry : _lsq)
+        {
+            if (&entry == &load)
+                break;
+            if (entry.instr._type == IType::St && ToWordAddr(entry.instr.Addr()) == ToWordAddr(load.instr.Addr()) &&
+                (accessMask(entry) & accessMask(load)) != 0)
+                found = &entry;
+        }
+        return found;
+    }
+
+    // Sends the access to a free port, returns false if there is none
+    bool access(LsqEntry& entry)
+    {
+        for (size_t port = 0; port < _ports.size(); port++)
+        {
+            Port& p = _ports[port];
+            if (p.busy)
+                continue;
+
+            p = Port{true, false, entry.seq, entry.instr};
+            entry.issued = true;
+            _changed = true;
+            _mem.Request(p.instr, port);
+
+            if (_mem.Response(p.instr, port))
+            {
+                p.busy = false;
+                if (p.instr._type == IType::St)
+                {
+                    _decodeCache.Invalidate(p.instr.Addr());
+                    _lsq.pop_front();
+                }
+                else
+                {
+                    if (p.instr.IsAtomic())
+                        _decodeCache.Invalidate(p.instr.Addr());
+                    RobEntry& rob = robEntry(p.seq);
+                    rob.instr._data = p.instr._data;
+                    rob.state = State::Done;
+                    writeResult(rob);
+                }
+            }
+            return true;
+        }
+        return false;
+    }
+
+    void complete()
+    {
+        if (!_executing.empty())
+            _changed = true;
+
+        std::vector<uint64_t> resolved;
+        for (auto it = _executing.begin(); it != _executing.end();)
+        {
+            if (--it->cycles > 0)
+            {
+                ++it;
+                continue;
+            }
+
+            RobEntry& entry = robEntry(it->seq);
+            if (isMemAccess(entry.instr._type))
+            {
+                LsqEntry* lsq = lsqEntry(entry.seq);
+                lsq->instr = entry.instr;
+                lsq->addrReady = true;
+                entry.state = entry.instr._type == IType::St ? State::Done : State::Memory;
+            }
+            else
+            {
+                entry.state = State::Done;
+                writeResult(entry);
+            }
+
+            resolved.push_back(it->seq);
+            it = _executing.erase(it);
+        }
+
+        // The oldest mispredict squashes the others
+        std::sort(resolved.begin(), resolved.end());
+        for (uint64_t seq : resolved)
+        {
+            if (!_rob.empty() && seq <= _rob.back().seq && resolve(robEntry(seq)))
+                break;
+        }
+    }
+
+    // Returns true on a mispredict
+    bool resolve(RobEntry& entry)
+    {
+        if (entry.nextIp == entry.prediction.nextIp)
+            return false;
+
+        _bpred.Recover(entry.ip, entry.instr, entry.nextIp, entry.prediction);
+        _stats.mispredicts++;
+        _csrf.Counters().Count(PerfEvent::BranchMispredict);
+        squash(entry.seq + 1);
+        redirect(entry.nextIp);
+        return true;
+    }
+
+    // Drops seq and everything younger
+    void squash(uint64_t seq)
+    {
+        while (!_rob.empty() && _rob.back().seq >= seq)
+        {
+            RobEntry& entry = _rob.back();
+            if (entry.dst != 0)
+            {
+                _renameMap[entry.instr._dst] = entry.prevDst;
+                _freeList.push_back(entry.dst);
+            }
+            _stats.squashed += entry.fusion != FusionKind::None ? 2 : 1;
+            _rob.pop_back();
+        }
+
+        while (!_lsq.empty() && _lsq.back().seq >= seq)
+            _lsq.pop_back();
+
+        auto squashed = [seq](uint64_t s) { return s >= seq; };
+        _iq.erase(std::remove_if(_iq.begin(), _iq.end(), squashed), _iq.end());
+        _executing.erase(std::remove_if(_executing.begin(), _executing.end(),
+                                        [seq](const Executing& e) { return e.seq >= seq; }), _executing.end());
+
+        for (Port& p : _ports)
+        {
+            if (p.busy && p.instr._type == IType::Ld && p.seq >= seq)
+                p.squashed = true;
+        }
+
+        _stats.squashed += _fetchQueue.size();
+        _fetchQueue.clear();
+        _nextSeq = seq;
+    }
+
+    void readOperands(RobEntry& entry)
+    {
+        if (entry.fusion == FusionKind::None)
+        {
+            entry.instr._src1Val = _prf[entry.src1];
+            entry.instr._src2Val = _prf[entry.src2];
+            if (entry.instr.IsFma())
+                entry.instr._data = _prf[entry.src3];
+            return;
+        }
+
+        // The second instruction takes the result of the first one in place of the fused register
+        Instruction& first = entry.first;
+        first._src1Val = _prf[entry.src1];
+        Executor::Execute(first, entry.ip - first.Length());
+        Word other = _prf[entry.src2];
+        entry.instr._src1Val = entry.instr._src1 == first._dst ? first._data : other;
+        entry.instr._src2Val = entry.instr._src2 == first._dst ? first._data : other;
+    }
+
+    void issue()
+    {
+        size_t issued = 0;
+        for (auto it = _iq.begin(); it != _iq.end() && issued < _config.issueWidth;)
+        {
+            RobEntry& entry = robEntry(*it);
+            if (isSystem(entry.instr._type) || entry.instr.IsVector() || !_prfReady[entry.src1] ||
+                !_prfReady[entry.src2] || !_prfReady[entry.src3])
+            {
+                ++it;
+                continue;
+            }
+
+            size_t cycles = 1;
+            if (entry.instr.IsMulDiv())
+            {
+                if (!_mulDiv.CanStart())
+                {
+                    ++it;
+                    continue;
+                }
+                cycles = _mulDiv.Start(entry.instr);
+            }
+            else if (entry.instr._type == IType::Fpu)
+            {
+                if (!_fpu.CanStart(entry.instr))
+                {
+                    ++it;
+                    continue;
+                }
+                cycles = _fpu.Start(entry.instr);
+                _csrf.Read(entry.instr);
+            }
+
+            readOperands(entry);
+            entry.nextIp = Executor::Execute(entry.instr, entry.ip);
+            entry.state = State::Executing;
+            _executing.push_back({entry.seq, cycles});
+
+            it = _iq.erase(it);
+            issued++;
+            _changed = true;
+        }
+    }
+
+    void dispatch()
+    {
+        for (size_t i = 0; i < _config.fetchWidth && !_fetchQueue.empty(); i++)
+        {
+            const Fetched* fetched = &_fetchQueue.front();
+            Instruction instr = _decodeCache.Decode(fetched->ip, fetched->word);
+            Instruction first = instr;
+            FusionKind fusion = fusible(first, instr);
+            if (fusion != FusionKind::None)
+                fetched = &_fetchQueue[1];
+
+            bool needsLsq = isMemAccess(instr._type) || instr.IsVectorMem();
+            if (_rob.size() == _config.robSize || _iq.size() == _config.iqSize ||
+                (needsLsq && _lsq.size() == _config.lsqSize) || (instr._dst != 0 && _freeList.empty()))
+                break;
+
+            RobEntry entry{instr, fetched->ip, fetched->ip + instr.Length(), fetched->prediction, _nextSeq++,
+                           0, 0, _renameMap[instr._src1], _renameMap[instr._src2], State::Waiting};
+            if (fusion != FusionKind::None)
+            {
+                RId other = instr._src1 != first._dst ? instr._src1 : instr._src2 != first._dst ? instr._src2 : 0;
+                entry.src1 = _renameMap[first._src1];
+                entry.src2 = _renameMap[other];
+                entry.fusion = fusion;
+                entry.first = first;
+            }
+            entry.src3 = _renameMap[instr.Src3()];
+            if (instr._dst != 0)
+            {
+                entry.dst = _freeList.back();
+                _freeList.pop_back();
+                entry.prevDst = _renameMap[instr._dst];
+                _renameMap[instr._dst] = entry.dst;
+                _prfReady[entry.dst] = false;
+            }
+
+            if (instr._type == IType::Unsupported)
+            {
+                entry.state = State::Done;
+                _rob.push_back(entry);
+                _fetchQueue.pop_front();
+                _changed = true;
+                if (resolve(_rob.back()))
+                    break;
+                continue;
+            }
+
+            _rob.push_back(entry);
+            _iq.push_back(entry.seq);
+            if (needsLsq)
+                _lsq.push_back(LsqEntry{entry.seq, instr});
+
+            _fetchQueue.pop_front();
+            if (fusion != FusionKind::None)
+                _fetchQueue.pop_front();
+            _changed = true;
+        }
+    }
+
+    // Replaces instr with the next instruction in the fetch queue if the two are fused
+    FusionKind fusible(const Instruction& first, Instruction& instr)
+    {
+        if (!_config.fusion || _fetchQueue.size() < 2 || _fetchQueue[1].ip != _fetchQueue[0].ip + first.Length())
+            return FusionKind::None;
+
+        Instruction second = _decodeCache.Decode(_fetchQueue[1].ip, _fetchQueue[1].word);
+        FusionKind fusion = FusionOf(first, second);
+        if (fusion != FusionKind::None)
+            instr = second;
+        return fusion;
+    }
+
+    void fetch()
+    {
+        if (_fetchPending)
+            pollFetch();
+
+        if (!_fetchPending && _fetchQueue.size() + _config.fetchWidth <= 2 * _config.fetchWidth)
+        {
+            _mem.Request(_fetchIp);
+            _fetchPending = true;
+            _changed = true;
+            pollFetch();
+        }
+    }
+
+    // Takes up to fetchWidth instructions up to the first predicted taken branch
+    void pollFetch()
+    {
+        std::array<Word, lineSizeBytes / 2> words{};
+        size_t count = _mem.ResponseBlock(words.data(), std::min(_config.fetchWidth, words.size()));
+        if (count == 0)
+            return;
+
+        _fetchPending = false;
+        _changed = true;
+        if (_fetchSquashed)
+        {
+            _fetchSquashed = false;
+            return;
+        }
+
+        Word ip = _fetchIp;
+        for (size_t i = 0; i < count; i++)
+        {
+            Word length = InstructionLength(words[i]);
+            Prediction prediction = _bpred.Predict(ip, length);
+            _fetchQueue.push_back({ip, words[i], prediction});
+            ip = prediction.nextIp;
+            if (ip != _fetchQueue.back().ip + length)
+                break;
+        }
+        _fetchIp = ip;
+    }
+
+    void redirect(Word ip)
+    {
+        if (_fetchPending)
+            _fetchSquashed = true;
+        _fetchIp = ip;
+    }
+
+    void flushAll(Word ip)
+    {
+        _fetchIp = ip;
+        _fetchPending = false;
+        _fetchSquashed = false;
+        _fetchQueue.clear();
+        _rob.clear();
+        _iq.clear();
+        _lsq.clear();
+        _executing.clear();
+        _mulDiv.Reset();
+        _fpu.Reset();
+        std::fill(_ports.begin(), _ports.end(), Port());
+
+        // The architectural registers start in the first physical ones, p0 is always zero
+        _freeList.clear();
+        for (size_t reg = _config.physRegs - 1; reg >= archRegs; reg--)
+            _freeList.push_back(PhysReg(reg));
+        for (size_t reg = 0; reg < archRegs; reg++)
+        {
+            _renameMap[reg] = PhysReg(reg);
+            _prf[reg] = _rf.Data()[reg];
+        }
+        std::fill(_prfReady.begin(), _prfReady.end(), true);
+    }
+};
+
+#endif //RISCV_SIM_OOOCPU_H
@@ -0,0 +1,37 @@
+#ifndef RISCV_SIM_PERFCOUNTERS_H
+#define RISCV_SIM_PERFCOUNTERS_H
+
+#include <array>
+#include <cstdint>
+
+// Events a hardware performance counter can be mapped to, the value written to mhpmevent
+enum class PerfEvent : uint8_t
+{
+    None,
+    ICacheMiss,
+    DCacheMiss,         // including stores to shared lines
+    Writeback,          // dirty data lines written to the memory
+    BranchMispredict,
+    StallCycle,         // cycles in which no instruction retired, counted by CsrFile
+    Count,
+};
+
+// Event totals of one hart, incremented by the core and its caches
+class PerfCounters
+{
+public:
+    void Count(PerfEvent event, uint64_t n = 1)
+    {
+        _counts[static_cast<size_t>(event)] += n;
+    }
+
+    uint64_t Get(PerfEvent event) const
+    {
+        return _counts[static_cast<size_t>(event)];
+    }
+
+private:
+    std::array<uint64_t, static_cast<size_t>(PerfEvent::Count)> _counts{};
+};
+
+#endif //RISCV_SIM_PERFCOUNTERS_H
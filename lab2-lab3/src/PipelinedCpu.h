@@ -0,0 +1,508 @@
+#ifndef RISCV_SIM_PIPELINEDCPU_H
+#define RISCV_SIM_PIPELINEDCPU_H
+
+#include "Memory.h"
+#include "DecodeCache.h"
+#include "RegisterFile.h"
+#include "CsrFile.h"
+#include "Executor.h"
+#include "BranchPredictor.h"
+#include "MulDivUnit.h"
+#include "FpUnit.h"
+#include "VectorUnit.h"
+
+#include <array>
+#include <deque>
+#include <limits>
+#include <map>
+
+enum class Stage : uint8_t
+{
+    If,
+    Id,
+    Ex,
+    Mem,
+    Wb,
+    Count,
+};
+
+struct BranchStats
+{
+    IType type;
+    uint64_t executed = 0;
+    uint64_t taken = 0;
+    uint64_t mispredicted = 0;
+};
+
+struct PipelineStats
+{
+    // Cycles in which a stage held an instruction it could not pass on.
+    // For IF: cycles after which the decoder had nothing to work on.
+    std::array<uint64_t, static_cast<size_t>(Stage::Count)> stalls{};
+    uint64_t loadUseStalls = 0;         // included in the EX stalls
+    uint64_t mulDivStalls = 0;          // included in the EX stalls
+    uint64_t fpStalls = 0;              // included in the EX stalls
+    uint64_t vectorStalls = 0;          // included in the EX stalls
+    uint64_t branchFlushes = 0;
+    uint64_t flushedInstructions = 0;
+    std::map<Word, BranchStats> branches;   // per static branch or jump
+};
+
+// Classic in-order IF/ID/EX/MEM/WB pipeline. Fetch follows the branch predictor,
+// branches and jumps are resolved in EX and flush the two younger stages on a mispredict.
+// ALU results are forwarded to EX from the instruction leaving MEM, WB writes the
+// register file before EX reads it, a load followed by a user stalls for a cycle.
+// Instruction fetch and data access use separate memory ports, so both may be
+// outstanding at the same time. A fetch takes the following instructions in the same
+// line along with the requested one, up to the first predicted taken branch, into a
+// fetch buffer; the next fetch is requested while the buffer still feeds ID.
+// A multiply, divide or FP operation keeps EX for its whole latency, so does a vector
+// instruction, which uses the data port while MEM stays empty.
+// CSRs are read in EX and written in WB, an instruction reading them waits in EX
+// while an older one that writes them is still in flight: FP operations with the
+// dynamic rounding mode read frm, those that raise exceptions write fflags.
+// Interrupts replace the instruction about to leave EX, which is then fetched again
+// after the handler.
+class PipelinedCpu
+{
+public:
+
+    PipelinedCpu(IMem& mem, IBranchPredictor& bpred, const MulDivConfig& mulDiv = MulDivConfig(),
+                 const VectorConfig& vector = VectorConfig(), const FpuConfig& fpu = FpuConfig())
+            : _mem(mem), _bpred(bpred), _mulDiv(mulDiv), _fpu(fpu), _vector(vector)
+    {
+        _mem.SetCounters(&_csrf.Counters());
+
+    }
+
+    // Stages go from the last to the first, so each one sees the latch
+    // in front of it already freed in this cycle
+    void Clock()
+    {
+        _csrf.Clock();
+
+        writeBack();
+        memory();
+        execute();
+        decode();
+        fetch();
+    }
+
+    // Nothing changes until the memory responds if every stage is either
+    // empty, waiting for the memory or the vector unit or blocked by the stage in front of it
+    size_t CyclesToNextEvent() const
+    {
+        if (_memWb || _exCycles > 0)
+            return 0;
+        if (_exMem && !(isMemAccess(_exMem->_type) && _accessRequested))
+            return 0;
+        bool vectorBusy = _vector.Busy();
+        if (_idEx && !_exMem && !vectorBusy && !(_idEx->instr._type == IType::Wfi && _csrf.WaitsForInterrupt()))
+            return 0;
+        if (_ifId && !_idEx)
+            return 0;
+        if (!_ifId && !_fetchBuffer.empty())
+            return 0;
+        if (!_fetchPending && _fetchBuffer.size() < fetchBufferSize)
+            return 0;
+
+        return vectorBusy ? _vector.CyclesToNextEvent() : std::numeric_limits<size_t>::max();
+    }
+
+    void SkipCycles(size_t cycles)
+    {
+        _csrf.Clock(cycles);
+        if (_vector.Busy())
+        {
+            _vector.SkipCycles(cycles);
+            _stats.vectorStalls += cycles;
+        }
+
+        if (_exMem)
+            _stats.stalls[size_t(Stage::Mem)] += cycles;
+        if (_idEx)
+            _stats.stalls[size_t(Stage::Ex)] += cycles;
+        if (_ifId)
+            _stats.stalls[size_t(Stage::Id)] += cycles;
+        else
+            _stats.stalls[size_t(Stage::If)] += cycles;
+    }
+
+    void Reset(Word ip, Word hartId = 0, Word harts = 1)
+    {
+        _csrf.Reset(hartId, harts);
+        flushAll(ip);
+    }
+
+    // Continues from the architectural state reached by another model,
+    // e.g. after fast-forwarding with FunctionalCpu
+    void Restore(Word ip, const RegisterFile& rf, const CsrFile& csrf, const VectorRegisterFile& vrf)
+    {
+        _rf = rf;
+        _csrf = csrf;
+        _vector.Restore(vrf);
+        flushAll(ip);
+    }
+
+    std::optional<CpuToHostData> GetMessage()
+    {
+        return _csrf.GetMessage();
+    }
+
+    const PipelineStats& GetStats() const
+    {
+        return _stats;
+    }
+
+    const VectorStats& GetVectorStats() const
+    {
+        return _vector.GetStats();
+    }
+
+    // Timer and software interrupts come from the CLINT
+    void SetClint(Clint* clint)
+    {
+        _csrf.SetClint(clint);
+        _mem.SetClint(clint);
+    }
+
+private:
+    struct Fetched
+    {
+        Word ip;
+        Word word;
+        Prediction prediction;
+    };
+
+    struct Decoded
+    {
+        Instruction instr;
+        Word ip;
+        Prediction prediction;
+        bool executed = false;
+    };
+
+    static constexpr size_t fetchBufferSize = 8;
+
+    IMem& _mem;
+    IBranchPredictor& _bpred;
+    MulDivUnit _mulDiv;
+    FpUnit _fpu;
+    VectorUnit _vector;
+    DecodeCache _decodeCache;
+    RegisterFile _rf;
+    CsrFile _csrf;
+    PipelineStats _stats;
+
+    Word _fetchIp = 0;                  // next address to fetch from
+    Word _pendingIp = 0;                // address of the outstanding fetch
+    bool _fetchPending = false;
+    bool _fetchSquashed = false;        // the outstanding fetch is on a wrong path
+    bool _accessRequested = false;      // the instruction in MEM has sent its request
+    size_t _exCycles = 0;               // left until the multiply, divide or FP operation in EX is done
+
+    std::deque<Fetched> _fetchBuffer;   // fetched while IF/ID was still occupied
+    std::optional<Fetched> _ifId;
+    std::optional<Decoded> _idEx;
+    std::optional<Instruction> _exMem;
+    std::optional<Instruction> _memWb;
+
+    static bool isMemAccess(IType type)
+    {
+        return type == IType::Ld || type == IType::St || type == IType::Lr || type == IType::Sc ||
+               type == IType::Amo;
+    }
+
+    static bool readsCsrs(const Instruction& instr)
+    {
+        return instr._type == IType::Csrr || instr._type == IType::Csrrw || instr._type == IType::Trap ||
+               instr._type == IType::Mret || (instr._type == IType::Fpu && instr.Rm() == Word(RoundingMode::Dyn));
+    }
+
+    // Messages for the host do not change anything the others read
+    static bool writesCsrs(const Instruction& instr)
+    {
+        return ((instr._type == IType::Csrw || instr._type == IType::Csrrw) && instr.Csr() != CsrIdx::Mtohost) ||
+               instr._type == IType::Trap || instr._type == IType::Mret;
+    }
+
+    void stall(Stage stage)
+    {
+        _stats.stalls[size_t(stage)]++;
+    }
+
+    void writeBack()
+    {
+        if (!_memWb)
+            return;
+
+        _rf.Write(*_memWb);
+        _csrf.Write(*_memWb);
+        _csrf.InstructionExecuted();
+        _memWb.reset();
+    }
+
+    void memory()
+    {
+        if (!_exMem)
+            return;
+
+        if (!_accessRequested)
+        {
+            _mem.Request(*_exMem);
+            _accessRequested = true;
+        }
+
+        if (!_mem.Response(*_exMem))
+        {
+            stall(Stage::Mem);
+            return;
+        }
+
+        _accessRequested = false;
+        if (_exMem->_type == IType::St || _exMem->IsAtomic())
+            _decodeCache.Invalidate(_exMem->Addr());
+
+        _memWb = _exMem;
+        _exMem.reset();
+    }
+
+    void execute()
+    {
+        if (!_idEx)
+            return;
+
+        if (_exCycles > 0 && --_exCycles > 0)
+        {
+            stall(Stage::Ex);
+            (_idEx->instr._type == IType::Fpu ? _stats.fpStalls : _stats.mulDivStalls)++;
+            return;
+        }
+
+        if (_vector.Busy() && !_vector.Clock(_mem))
+        {
+            stall(Stage::Ex);
+            _stats.vectorStalls++;
+            return;
+        }
+
+        if (_exMem)
+        {
+            stall(Stage::Ex);
+            return;
+        }
+
+        if (_idEx->executed)
+        {
+            _exMem = _idEx->instr;
+            _idEx.reset();
+            return;
+        }
+
+        Instruction& instr = _idEx->instr;
+
+        // MEM is empty, so the only older instruction is the one that has just left it
+        bool csrWritePending = _memWb && writesCsrs(*_memWb);
+        bool fpFlagsPending = _memWb && _memWb->_type == IType::Fpu && _memWb->FpFlags() != 0;
+        if ((csrWritePending && readsCsrs(instr)) ||
+            (fpFlagsPending && (instr._type == IType::Csrr || instr._type == IType::Csrrw)))
+        {
+            stall(Stage::Ex);
+            return;
+        }
+
+        // A WFI completes before the interrupt it waits for is taken
+        if (!csrWritePending && instr._type != IType::Wfi)
+        {
+            if (auto cause = _csrf.PendingInterrupt())
+            {
+                Word handler = _csrf.Trap(*cause, _idEx->ip);
+                _bpred.Recover(_idEx->ip, Instruction(), handler, _idEx->prediction);
+                _idEx.reset();
+                redirect(handler);
+                return;
+            }
+        }
+        if (instr._type == IType::Wfi && _csrf.WaitsForInterrupt())
+        {
+            stall(Stage::Ex);
+            return;
+        }
+
+        // Everything older except the instruction that has just left MEM is
+        // in the register file already. Its result is forwarded unless it
+        // is a load, whose data only arrives at the end of MEM.
+        bool forward = _memWb && _memWb->_dst != 0 &&
+                       (_memWb->_dst == instr._src1 || _memWb->_dst == instr._src2 || _memWb->_dst == instr.Src3());
+        if (forward && (_memWb->_type == IType::Ld || _memWb->IsAtomic()))
+        {
+            stall(Stage::Ex);
+            _stats.loadUseStalls++;
+            return;
+        }
+
+        _csrf.Read(instr);
+        _rf.Read(instr);
+        if (forward)
+        {
+            if (instr._src1 == _memWb->_dst)
+                instr._src1Val = _memWb->_data;
+            if (instr._src2 == _memWb->_dst)
+                instr._src2Val = _memWb->_data;
+            if (instr.Src3() == _memWb->_dst)
+                instr._data = _memWb->_data;
+        }
+
+        Word ip = _idEx->ip;
+        Word nextIp = Executor::Execute(instr, ip);
+        bool mispredicted = nextIp != _idEx->prediction.nextIp;
+        if (mispredicted)
+        {
+            _bpred.Recover(ip, instr, nextIp, _idEx->prediction);
+            _csrf.Counters().Count(PerfEvent::BranchMispredict);
+        }
+        _bpred.Update(ip, instr, nextIp, _idEx->prediction);
+
+        if (instr._type == IType::Br || instr._type == IType::J || instr._type == IType::Jr)
+        {
+            BranchStats& branch = _stats.branches.emplace(ip, BranchStats{instr._type}).first->second;
+            branch.executed++;
+            branch.taken += nextIp != ip + instr.Length() ? 1 : 0;
+            branch.mispredicted += mispredicted ? 1 : 0;
+        }
+
+        if (mispredicted)
+            redirect(nextIp);
+
+        if (instr.IsMulDiv() || instr._type == IType::Fpu)
+        {
+            _idEx->executed = true;
+            _exCycles = (instr.IsMulDiv() ? _mulDiv.Latency(instr) : _fpu.Latency(instr)) - 1;
+            if (_exCycles > 0)
+            {
+                stall(Stage::Ex);
+                (instr._type == IType::Fpu ? _stats.fpStalls : _stats.mulDivStalls)++;
+                return;
+            }
+        }
+
+        if (instr.IsVector())
+        {
+            _idEx->executed = true;
+            _vector.Start(instr);
+            if (instr._type == IType::Vst)
+                _decodeCache.Invalidate(instr, _vector.Registers());
+            if (!_vector.Clock(_mem))
+            {
+                stall(Stage::Ex);
+                _stats.vectorStalls++;
+                return;
+            }
+        }
+
+        _exMem = instr;
+        _idEx.reset();
+    }
+
+    void decode()
+    {
+        if (!_ifId)
+            return;
+
+        if (_idEx)
+        {
+            stall(Stage::Id);
+            return;
+        }
+
+        _idEx = Decoded{_decodeCache.Decode(_ifId->ip, _ifId->word), _ifId->ip, _ifId->prediction};
+        _ifId.reset();
+    }
+
+    void fetch()
+    {
+        if (!_ifId && !_fetchBuffer.empty())
+        {
+            _ifId = _fetchBuffer.front();
+            _fetchBuffer.pop_front();
+        }
+
+        // A squashed fetch still occupies the port until it completes
+        if (_fetchPending)
+            pollFetch();
+
+        if (!_fetchPending && _fetchBuffer.size() < fetchBufferSize)
+        {
+            _mem.Request(_fetchIp);
+            _pendingIp = _fetchIp;
+            _fetchPending = true;
+            pollFetch();
+        }
+
+        if (!_ifId)
+            stall(Stage::If);
+    }
+
+    // Takes the instructions that fit in the buffer up to the first predicted taken branch
+    void pollFetch()
+    {
+        std::array<Word, fetchBufferSize> words{};
+        size_t count = _mem.ResponseBlock(words.data(), fetchBufferSize - _fetchBuffer.size());
+        if (count == 0)
+            return;
+
+        _fetchPending = false;
+        if (_fetchSquashed)
+        {
+            _fetchSquashed = false;
+            return;
+        }
+
+        // The length of an instruction is known from its first bits, the fall-through follows it
+        Word ip = _pendingIp;
+        for (size_t i = 0; i < count; i++)
+        {
+            Word length = InstructionLength(words[i]);
+            Prediction prediction = _bpred.Predict(ip, length);
+            Fetched fetched{ip, words[i], prediction};
+            if (_ifId || !_fetchBuffer.empty())
+                _fetchBuffer.push_back(fetched);
+            else
+                _ifId = fetched;
+
+            ip = prediction.nextIp;
+            if (ip != fetched.ip + length)
+                break;
+        }
+        _fetchIp = ip;
+    }
+
+    // Drops everything younger than the instruction in EX
+    void redirect(Word ip)
+    {
+        _stats.branchFlushes++;
+        _stats.flushedInstructions += (_ifId ? 1 : 0) + _fetchBuffer.size();
+
+        _ifId.reset();
+        _fetchBuffer.clear();
+        if (_fetchPending)
+            _fetchSquashed = true;
+        _fetchIp = ip;
+    }
+
+    void flushAll(Word ip)
+    {
+        _fetchIp = ip;
+        _fetchPending = false;
+        _fetchSquashed = false;
+        _accessRequested = false;
+        _exCycles = 0;
+        _fetchBuffer.clear();
+        _ifId.reset();
+        _idEx.reset();
+        _exMem.reset();
+        _memWb.reset();
+    }
+};
+
+#endif //RISCV_SIM_PIPELINEDCPU_H
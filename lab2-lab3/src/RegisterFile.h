@@ -12,21 +12,24 @@ public:
         _r.fill(0);
     }
 
-    void Read(InstructionPtr& instr)
+    void Read(Instruction& instr)
     {
-        if (instr->_src1)
-            instr->_src1Val = _r.at(instr->_src1.value());
-
-        if (instr->_src2)
-            instr->_src2Val = _r.at(instr->_src2.value());
+        instr._src1Val = _r[instr._src1];
+        instr._src2Val = _r[instr._src2];
+        if (instr.IsFma())
+            instr._data = _r[instr.Src3()];
+    }
+    void Write(const Instruction& instr)
+    {
+        _r[instr._dst] = instr._data;
+        _r[0] = 0;
     }
-    void Write(InstructionPtr& instr)
+    Word* Data()
     {
-        if (instr->_dst)
-            _r.at(instr->_dst.value()) = instr->_data;
+        return _r.data();
     }
 private:
-    std::array<Word, 32> _r;
+    std::array<Word, archRegs> _r;     // x0-x31, then f0-f31
 };
 
 
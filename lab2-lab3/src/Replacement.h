@@ -0,0 +1,317 @@
+#ifndef RISCV_SIM_REPLACEMENT_H
+#define RISCV_SIM_REPLACEMENT_H
+
+#include "BaseTypes.h"
+
+#include <memory>
+#include <optional>
+#include <random>
+#include <vector>
+
+enum class ReplacementPolicy : uint8_t
+{
+    Fifo,
+    Lru,
+    Plru,       // tree pseudo-LRU, needs a power of two ways
+    Srrip,      // static re-reference interval prediction
+    Brrip,      // bimodal RRIP: most new lines are predicted to be reused in the distant future
+    Random,
+};
+
+// Chooses the way to replace within a set of a cache. All ways start empty, and
+// every policy fills them before replacing any of them.
+class IReplacementPolicy
+{
+public:
+    IReplacementPolicy() = default;
+    virtual ~IReplacementPolicy() = default;
+    IReplacementPolicy(const IReplacementPolicy &) = delete;
+    IReplacementPolicy(IReplacementPolicy &&) = delete;
+
+    IReplacementPolicy& operator=(const IReplacementPolicy&) = delete;
+    IReplacementPolicy& operator=(IReplacementPolicy&&) = delete;
+
+    // The way whose line goes next, a new line is inserted there right after
+    virtual size_t Victim(size_t set) = 0;
+    virtual void Insert(size_t set, size_t way) = 0;
+
+    // A hit on the line in the way
+    virtual void Touch(size_t set, size_t way) = 0;
+
+    // The line in the way has been invalidated, it is a good one to replace
+    virtual void Invalidate(size_t set, size_t way) = 0;
+};
+
+
+// Replaces the lines of a set in the order they came in, hits and invalidations don't matter
+class FifoPolicy : public IReplacementPolicy
+{
+public:
+    FifoPolicy(size_t sets, size_t ways)
+            : _ways(ways), _next(sets)
+    {
+
+    }
+
+    size_t Victim(size_t set) override
+    {
+        return _next[set];
+    }
+
+    void Insert(size_t set, size_t way) override
+    {
+        _next[set] = (way + 1) % _ways;
+    }
+
+    void Touch(size_t, size_t) override
+    {
+
+    }
+
+    void Invalidate(size_t, size_t) override
+    {
+
+    }
+
+private:
+    size_t _ways;
+    std::vector<size_t> _next;
+};
+
+
+// True LRU with the recency rank of every way, 0 for the most recently used
+class LruPolicy : public IReplacementPolicy
+{
+public:
+    LruPolicy(size_t sets, size_t ways)
+            : _ways(ways), _ranks(sets * ways)
+    {
+        // Way 0 is filled first
+        for (size_t i = 0; i < _ranks.size(); i++)
+            _ranks[i] = uint16_t(ways - 1 - i % ways);
+    }
+
+    size_t Victim(size_t set) override
+    {
+        const uint16_t* ranks = &_ranks[set * _ways];
+        for (size_t way = 0; way < _ways; way++)
+        {
+            if (ranks[way] == _ways - 1)
+                return way;
+        }
+        return 0;
+    }
+
+    void Insert(size_t set, size_t way) override
+    {
+        Touch(set, way);
+    }
+
+    void Touch(size_t set, size_t way) override
+    {
+        moveTo(set, way, 0);
+    }
+
+    void Invalidate(size_t set, size_t way) override
+    {
+        moveTo(set, way, uint16_t(_ways - 1));
+    }
+
+private:
+    size_t _ways;
+    std::vector<uint16_t> _ranks;
+
+    // The ways between the old and the new rank move by one towards the old one
+    void moveTo(size_t set, size_t way, uint16_t rank)
+    {
+        uint16_t* ranks = &_ranks[set * _ways];
+        uint16_t old = ranks[way];
+        for (size_t i = 0; i < _ways; i++)
+        {
+            if (rank < old && ranks[i] >= rank && ranks[i] < old)
+                ranks[i]++;
+            else if (rank > old && ranks[i] > old && ranks[i] <= rank)
+                ranks[i]--;
+        }
+        ranks[way] = rank;
+    }
+};
+
+
+// A binary tree over the ways with ways - 1 bits per set, packed into one word.
+// Every node points to the half that was used less recently, the victim is found
+// by following them.
+class PlruPolicy : public IReplacementPolicy
+{
+public:
+    static constexpr size_t maxWays = 64;
+
+    PlruPolicy(size_t sets, size_t ways)
+            : _ways(ways), _bits(sets)
+    {
+
+    }
+
+    size_t Victim(size_t set) override
+    {
+        uint64_t bits = _bits[set];
+        size_t node = 1;
+        while (node < _ways)
+            node = 2 * node + ((bits >> node) & 1u);
+        return node - _ways;
+    }
+
+    void Insert(size_t set, size_t way) override
+    {
+        Touch(set, way);
+    }
+
+    void Touch(size_t set, size_t way) override
+    {
+        pointAt(set, way, false);
+    }
+
+    void Invalidate(size_t set, size_t way) override
+    {
+        pointAt(set, way, true);
+    }
+
+private:
+    size_t _ways;
+    std::vector<uint64_t> _bits;    // bit i is node i, its children are 2i and 2i + 1, the leaves are the ways
+
+    // Sets the nodes on the path to the way to point towards it or away from it
+    void pointAt(size_t set, size_t way, bool towards)
+    {
+        uint64_t& bits = _bits[set];
+        for (size_t node = way + _ways; node > 1; node /= 2)
+        {
+            uint64_t mask = uint64_t(1) << (node / 2);
+            bool right = (node & 1u) != 0;
+            bits = right == towards ? bits | mask : bits & ~mask;
+        }
+    }
+};
+
+
+// A 2-bit re-reference prediction value per way. A hit predicts a near re-reference,
+// the victim is an empty way or one predicted to be reused in the distant future.
+// If there is none, all ways age until there is.
+class RripPolicy : public IReplacementPolicy
+{
+public:
+    // A bimodal policy inserts one line out of 32 like the static one, the others as distant
+    RripPolicy(size_t sets, size_t ways, bool bimodal, uint32_t seed)
+            : _ways(ways), _bimodal(bimodal), _rrpv(sets * ways, empty), _random(seed)
+    {
+
+    }
+
+    size_t Victim(size_t set) override
+    {
+        uint8_t* rrpv = &_rrpv[set * _ways];
+        while (true)
+        {
+            std::optional<size_t> victim;
+            for (size_t way = 0; way < _ways; way++)
+            {
+                if (rrpv[way] == empty)
+                    return way;
+                if (rrpv[way] == distant && !victim)
+                    victim = way;
+            }
+            if (victim)
+                return victim.value();
+            for (size_t way = 0; way < _ways; way++)
+                rrpv[way]++;
+        }
+    }
+
+    void Insert(size_t set, size_t way) override
+    {
+        bool longInterval = !_bimodal || _random() % bimodalThrottle == 0;
+        _rrpv[set * _ways + way] = longInterval ? distant - 1 : distant;
+    }
+
+    void Touch(size_t set, size_t way) override
+    {
+        _rrpv[set * _ways + way] = 0;
+    }
+
+    void Invalidate(size_t set, size_t way) override
+    {
+        _rrpv[set * _ways + way] = empty;
+    }
+
+private:
+    static constexpr uint8_t distant = 3;
+    static constexpr uint8_t empty = distant + 1;
+    static constexpr uint32_t bimodalThrottle = 32;
+
+    size_t _ways;
+    bool _bimodal;
+    std::vector<uint8_t> _rrpv;
+    std::minstd_rand _random;
+};
+
+
+// Fills the empty ways of a set in order, then replaces the way invalidated last
+// if there is one and any of them otherwise. The same seed gives the same choices
+// in every run.
+class RandomPolicy : public IReplacementPolicy
+{
+public:
+    RandomPolicy(size_t sets, size_t ways, uint32_t seed)
+            : _ways(ways), _filled(sets), _invalid(sets, ways), _random(seed)
+    {
+
+    }
+
+    size_t Victim(size_t set) override
+    {
+        if (_filled[set] < _ways)
+            return _filled[set];
+        return _invalid[set] < _ways ? _invalid[set] : _random() % _ways;
+    }
+
+    void Insert(size_t set, size_t way) override
+    {
+        if (_filled[set] < _ways)
+            _filled[set]++;
+        if (_invalid[set] == way)
+            _invalid[set] = _ways;
+    }
+
+    void Touch(size_t, size_t) override
+    {
+
+    }
+
+    void Invalidate(size_t set, size_t way) override
+    {
+        _invalid[set] = way;
+    }
+
+private:
+    size_t _ways;
+    std::vector<size_t> _filled;
+    std::vector<size_t> _invalid;   // ways when there is none
+    std::minstd_rand _random;
+};
+
+
+static std::unique_ptr<IReplacementPolicy> MakeReplacementPolicy(ReplacementPolicy policy, size_t sets, size_t ways,
+                                                                 uint32_t seed)
+{
+    switch (policy)
+    {
+        case ReplacementPolicy::Lru:    return std::make_unique<LruPolicy>(sets, ways);
+        case ReplacementPolicy::Plru:   return std::make_unique<PlruPolicy>(sets, ways);
+        case ReplacementPolicy::Srrip:  return std::make_unique<RripPolicy>(sets, ways, false, seed);
+        case ReplacementPolicy::Brrip:  return std::make_unique<RripPolicy>(sets, ways, true, seed);
+        case ReplacementPolicy::Random: return std::make_unique<RandomPolicy>(sets, ways, seed);
+        default:                        return std::make_unique<FifoPolicy>(sets, ways);
+    }
+}
+
+#endif //RISCV_SIM_REPLACEMENT_H
@@ -0,0 +1,178 @@
+#ifndef RISCV_SIM_SIMULATION_H
+#define RISCV_SIM_SIMULATION_H
+
+#include "Memory.h"
+#include "BranchPredictor.h"
+#include "Clint.h"
+#include "BaseTypes.h"
+
+#include <algorithm>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+class Host
+{
+public:
+    explicit Host(std::ofstream& out)
+            : _out(out)
+    {
+
+    }
+
+    // Returns the exit code once the program has finished.
+    // Only hart 0 writes the results, the others print whole lines tagged with their id.
+    // The program fails when any hart has, with the code of the first one that failed.
+    std::optional<int> Handle(CpuToHostData msg, size_t hart = 0)
+    {
+        if (hart != 0)
+            return handleSecondary(msg, hart);
+
+        auto type = msg.unpacked.type;
+        auto data = msg.unpacked.data;
+
+        if (type == CpuToHostType::ExitCode)
+        {
+            if (data == 0 && _secondaryFailure)
+            {
+                fprintf(stderr, "FAILED: hart %zu failed\n", _secondaryFailure->first);
+                return _secondaryFailure->second;
+            }
+            else if (data == 0)
+            {
+                fprintf(stderr, "PASSED\n");
+                _out << "PASSED" << std::endl;
+                _out.close();
+                return 0;
+            }
+            else
+            {
+                fprintf(stderr, "FAILED: exit code = %d\n", data);
+                return data;
+            }
+        } else if (type == CpuToHostType::PrintChar) {
+            fprintf(stderr, "%c", (char)data);
+            _out << (char)data;
+        } else if (type == CpuToHostType::PrintIntLow) {
+            _printInt = uint32_t(data);
+        } else if(type == CpuToHostType::PrintIntHigh) {
+            _printInt |= uint32_t(data) << 16;
+            fprintf(stderr, "%d", _printInt);
+            _out << _printInt;
+        }
+
+        return std::nullopt;
+    }
+
+private:
+    std::ofstream& _out;
+    int32_t _printInt = 0;
+    std::map<size_t, std::string> _lines;
+    std::map<size_t, int32_t> _printInts;
+    std::optional<std::pair<size_t, int>> _secondaryFailure;    // the first hart that failed, its exit code
+
+    std::optional<int> handleSecondary(CpuToHostData msg, size_t hart)
+    {
+        auto type = msg.unpacked.type;
+        auto data = msg.unpacked.data;
+        std::string& line = _lines[hart];
+
+        if (type == CpuToHostType::ExitCode)
+        {
+            if (!line.empty())
+                fprintf(stderr, "hart %zu: %s\n", hart, line.c_str());
+            if (data != 0)
+            {
+                fprintf(stderr, "hart %zu: FAILED: exit code = %d\n", hart, data);
+                if (!_secondaryFailure)
+                    _secondaryFailure = std::make_pair(hart, int(data));
+            }
+            line.clear();
+            return data;
+        } else if (type == CpuToHostType::PrintChar) {
+            if ((char)data != '\n')
+                line += (char)data;
+            else
+            {
+                fprintf(stderr, "hart %zu: %s\n", hart, line.c_str());
+                line.clear();
+            }
+        } else if (type == CpuToHostType::PrintIntLow) {
+            _printInts[hart] = uint32_t(data);
+        } else if(type == CpuToHostType::PrintIntHigh) {
+            line += std::to_string(_printInts[hart] | int32_t(uint32_t(data) << 16));
+        }
+
+        return std::nullopt;
+    }
+};
+
+// A core with its private caches
+template <typename Core>
+struct Hart
+{
+    std::unique_ptr<CachedMem> mem;
+    std::unique_ptr<IBranchPredictor> bpred;
+    std::unique_ptr<Core> cpu;
+    bool halted = false;
+};
+
+// All harts are clocked in lockstep and always in the same order, so every run
+// of a program gives the same result. The program has finished when hart 0 exits.
+// The CLINT timer goes on after the harts in each cycle.
+template <typename Core>
+static int Simulate(std::vector<Hart<Core>>& harts, Host& host, Clint& clint)
+{
+    while (true)
+    {
+        // Jump straight to the next cycle in which something happens, at the
+        // latest the one in which a timer goes off
+        size_t idleCycles = clint.CyclesToTimer();
+        for (const Hart<Core>& hart : harts)
+        {
+            if (!hart.halted)
+                idleCycles = std::min({idleCycles, hart.cpu->CyclesToNextEvent(), hart.mem->CyclesToNextEvent()});
+        }
+
+        if (idleCycles == std::numeric_limits<size_t>::max())
+        {
+            fprintf(stderr, "FAILED: every hart waits for an interrupt that never comes\n");
+            return 1;
+        }
+        clint.Clock(idleCycles);
+
+        for (size_t id = 0; id < harts.size(); id++)
+        {
+            Hart<Core>& hart = harts[id];
+            if (hart.halted)
+                continue;
+
+            if (idleCycles > 0)
+            {
+                hart.cpu->SkipCycles(idleCycles);
+                hart.mem->SkipCycles(idleCycles);
+            }
+
+            hart.cpu->Clock();
+            hart.mem->Clock();
+            std::optional<CpuToHostData> msg = hart.cpu->GetMessage();
+            if (!msg)
+                continue;
+
+            if (auto exitCode = host.Handle(msg.value(), id))
+            {
+                if (id == 0)
+                    return exitCode.value();
+                hart.halted = true;
+            }
+        }
+        clint.Clock();
+    }
+}
+
+#endif //RISCV_SIM_SIMULATION_H
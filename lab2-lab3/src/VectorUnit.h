@@ -0,0 +1,306 @@
+#ifndef RISCV_SIM_VECTORUNIT_H
+#define RISCV_SIM_VECTORUNIT_H
+
+#include "Instruction.h"
+#include "Memory.h"
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+// The word of an element within a line access
+static Word ToLineOffset(Word addr) { return ToWordAddr(addr) & (lineSizeWords - 1); }
+
+struct VectorConfig
+{
+    size_t vlen = 256;      // bits in a vector register, a multiple of 32
+    size_t lanes = 4;       // elements an arithmetic operation processes per cycle
+};
+
+struct VectorStats
+{
+    uint64_t instructions = 0;
+    uint64_t elements = 0;          // processed by all of them
+    uint64_t lineAccesses = 0;
+    uint64_t busyCycles = 0;
+};
+
+// Architectural state of the V extension subset: 32-bit elements and LMUL = 1
+// only. Any other vtype sets vill and vl = 0, so no element is processed.
+class VectorRegisterFile
+{
+public:
+    explicit VectorRegisterFile(size_t vlen = VectorConfig().vlen)
+            : _vlmax(Word(vlen / 32)), _v(32 * _vlmax)
+    {
+
+    }
+
+    Word Vl() const
+    {
+        return _vl;
+    }
+
+    // vsetvli, the new vl is the result
+    void SetVl(Instruction& instr)
+    {
+        Word vtype = instr._imm;
+        bool supported = (vtype & vtypeSewLmul) == vtypeE32M1 && (vtype & ~vtypeKnown) == 0;
+        _vtype = supported ? vtype : vtypeVill;
+
+        // rs1 = x0 keeps vl with rd = x0, otherwise asks for the maximum
+        Word avl = instr._src1 != 0 ? instr._src1Val : instr._dst != 0 ? ~Word(0) : _vl;
+        _vl = supported ? std::min(avl, _vlmax) : 0;
+        instr._data = _vl;
+    }
+
+    // vadd, vmul and vredsum with rs1 or the immediate already read
+    void Execute(const Instruction& instr)
+    {
+        const Word* vs2 = reg(instr.Vs2());
+        Word* vd = reg(instr.Vd());
+
+        if (instr._flags & flagReduce)
+        {
+            if (_vl == 0)
+                return;
+
+            Word sum = reg(instr.Vs1())[0];
+            for (Word i = 0; i < _vl; i++)
+                sum += vs2[i];
+            vd[0] = sum;
+            return;
+        }
+
+        for (Word i = 0; i < _vl; i++)
+        {
+            Word b = (instr._flags & flagImm) ? instr.VImm() :
+                     (instr._flags & flagScalar) ? instr._src1Val : reg(instr.Vs1())[i];
+            vd[i] = instr._aluFunc == AluFunc::Mul ? vs2[i] * b : vs2[i] + b;
+        }
+    }
+
+    // Unit-stride or strided, every element is an aligned word
+    Word ElementAddr(const Instruction& instr, Word i) const
+    {
+        Word stride = (instr._flags & flagStrided) ? instr._src2Val : sizeof(Word);
+        return instr._src1Val + i * stride;
+    }
+
+    Word& Element(RId v, Word i)
+    {
+        return reg(v)[i];
+    }
+
+    // A vector load or store done at once, for the functional model
+    void Access(const Instruction& instr, MemoryStorage& mem)
+    {
+        for (Word i = 0; i < _vl; i++)
+        {
+            Word addr = ElementAddr(instr, i);
+            if (instr._type == IType::Vld)
+                Element(instr.Vd(), i) = mem.Read(addr);
+            else
+                mem.Write(addr, Element(instr.Vd(), i));
+        }
+    }
+
+private:
+    static constexpr Word vtypeE32M1 = 0b010000;    // vsew = 2, vlmul = 0
+    static constexpr Word vtypeSewLmul = 0b111111;
+    static constexpr Word vtypeKnown = 0xff;        // vma, vta, vsew, vlmul
+    static constexpr Word vtypeVill = Word(1) << 31u;
+
+    Word _vlmax;
+    Word _vl = 0;
+    Word _vtype = vtypeVill;
+    std::vector<Word> _v;
+
+    Word* reg(RId v)
+    {
+        return &_v[v * _vlmax];
+    }
+};
+
+// Vector unit of a timing model, one instruction at a time. An arithmetic
+// instruction takes a cycle per group of lanes elements, a reduction adds an
+// adder tree on top of that. Loads and stores go to a data port of the memory
+// by lines, one line access at a time: the elements in the same line share it.
+class VectorUnit
+{
+public:
+    explicit VectorUnit(const VectorConfig& config = VectorConfig())
+            : _config(config), _vrf(config.vlen)
+    {
+
+    }
+
+    // The scalar operands have been read. vsetvli is done at once, its result is in _data.
+    void Start(Instruction& instr)
+    {
+        _stats.instructions++;
+        _busy = true;
+        _cycles = 0;
+        _lines.clear();
+        _next = 0;
+        _requested = false;
+
+        switch (instr._type)
+        {
+            case IType::Vset:
+                _vrf.SetVl(instr);
+                _busy = false;
+                return;
+            case IType::Valu:
+                _vrf.Execute(instr);
+                _cycles = std::max<size_t>(1, (_vrf.Vl() + _config.lanes - 1) / _config.lanes);
+                if (instr._flags & flagReduce)
+                    _cycles += treeDepth();
+                break;
+            default:
+                _instr = instr;
+                startAccess();
+                break;
+        }
+        _stats.elements += _vrf.Vl();
+    }
+
+    // Returns true once the instruction is done
+    bool Clock(IMem& mem, size_t port = 0)
+    {
+        if (!_busy)
+            return true;
+
+        _stats.busyCycles++;
+        if (_cycles > 0)
+        {
+            _busy = --_cycles > 0;
+            return !_busy;
+        }
+
+        while (_next < _lines.size())
+        {
+            LineAccess& line = _lines[_next].access;
+            if (!_requested)
+            {
+                mem.Request(line, port);
+                _requested = true;
+                _stats.lineAccesses++;
+            }
+            if (!mem.Response(line, port))
+                return false;
+
+            finishLine(_lines[_next]);
+            _requested = false;
+            _next++;
+        }
+
+        _busy = false;
+        return true;
+    }
+
+    bool Busy() const
+    {
+        return _busy;
+    }
+
+    // While it waits for the memory the memory tells when anything happens
+    size_t CyclesToNextEvent() const
+    {
+        if (!_busy)
+            return std::numeric_limits<size_t>::max();
+        return _cycles > 0 ? _cycles - 1 : std::numeric_limits<size_t>::max();
+    }
+
+    void SkipCycles(size_t cycles)
+    {
+        if (!_busy)
+            return;
+        _stats.busyCycles += cycles;
+        _cycles -= std::min(cycles, _cycles);
+    }
+
+    VectorRegisterFile& Registers()
+    {
+        return _vrf;
+    }
+
+    const VectorRegisterFile& Registers() const
+    {
+        return _vrf;
+    }
+
+    void Restore(const VectorRegisterFile& vrf)
+    {
+        _vrf = vrf;
+        _busy = false;
+    }
+
+    const VectorStats& GetStats() const
+    {
+        return _stats;
+    }
+
+private:
+    struct LineElements
+    {
+        LineAccess access;
+        std::vector<Word> elements;     // element i uses word ToLineOffset of its address
+    };
+
+    VectorConfig _config;
+    VectorRegisterFile _vrf;
+    VectorStats _stats;
+    Instruction _instr;
+    std::vector<LineElements> _lines;
+    size_t _next = 0;                   // the line being accessed
+    size_t _cycles = 0;                 // left of an arithmetic instruction
+    bool _requested = false;
+    bool _busy = false;
+
+    size_t treeDepth() const
+    {
+        size_t depth = 0;
+        while ((size_t(1) << depth) < _config.lanes)
+            depth++;
+        return depth;
+    }
+
+    // Consecutive elements in the same line make one access
+    void startAccess()
+    {
+        bool write = _instr._type == IType::Vst;
+        for (Word i = 0; i < _vrf.Vl(); i++)
+        {
+            Word addr = _vrf.ElementAddr(_instr, i);
+            Word offset = ToLineOffset(addr);
+            if (_lines.empty() || _lines.back().access.lineAddr != ToLineAddr(addr) ||
+                (_lines.back().access.mask >> offset) & 1u)
+            {
+                _lines.push_back(LineElements{});
+                _lines.back().access.lineAddr = ToLineAddr(addr);
+                _lines.back().access.write = write;
+            }
+
+            LineElements& line = _lines.back();
+            line.access.mask |= uint32_t(1) << offset;
+            line.elements.push_back(i);
+            if (write)
+                line.access.words[offset] = _vrf.Element(_instr.Vd(), i);
+        }
+
+        if (_lines.empty())
+            _busy = false;
+    }
+
+    void finishLine(const LineElements& line)
+    {
+        if (line.access.write)
+            return;
+
+        for (Word i : line.elements)
+            _vrf.Element(_instr.Vd(), i) = line.access.words[ToLineOffset(_vrf.ElementAddr(_instr, i))];
+    }
+};
+
+#endif //RISCV_SIM_VECTORUNIT_H
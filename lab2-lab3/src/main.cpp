@@ -1,56 +1,578 @@
 #include "Cpu.h"
+#include "PipelinedCpu.h"
+#include "OooCpu.h"
+#include "FunctionalCpu.h"
+#include "Simulation.h"
 #include "Memory.h"
 #include "BaseTypes.h"
 
 #include <optional>
 #include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
 
-int main()
+static constexpr size_t functionalBatchSize = 1 << 16;
+
+// A cache of the hierarchy as given by the options. The inclusion is the one of the
+// levels below the first, towards the caches above them.
+struct CacheOptions
+{
+    CacheConfig config;
+    std::string policyName = "fifo";
+    std::string inclusionName = "nine";
+    Inclusion inclusion = Inclusion::Nine;
+};
+
+struct Options
+{
+    bool functional = false;
+    bool jit = false;
+    bool superblocks = false;
+    bool pipelined = false;
+    bool ooo = false;
+    bool stats = false;
+    OooConfig oooConfig;
+    MulDivConfig mulDiv;
+    FpuConfig fpu;
+    VectorConfig vector;
+    CacheOptions icache{codeCacheConfig};
+    CacheOptions dcache{dataCacheConfig};
+    CacheOptions l2{CacheConfig{0, 8, lineSizeBytes, 12}};         // there is no L2 or L3 until it gets a size
+    CacheOptions l3{CacheConfig{0, 16, lineSizeBytes, 40}};
+    size_t memLatency = memoryLatency;
+    std::string bpred = "bht";
+    size_t fastForward = 0;
+    size_t harts = 1;
+    std::string coherence;      // none, msi or mesi, by default mesi for several harts
+};
+
+// Skips the beginning of the program functionally, the timing model continues from there.
+// Returns the exit code if the program has finished before that.
+template <typename Core>
+static std::optional<int> FastForward(Core& cpu, MemoryStorage& mem, Clint& clint, Host& host, size_t instructions,
+                                      const Options& options)
+{
+    FunctionalCpu functionalCpu{mem, options.jit, options.superblocks, options.vector};
+    functionalCpu.Reset(0x200);
+    functionalCpu.SetClint(&clint);
+
+    size_t executed = 0;
+    while (executed < instructions)
+    {
+        executed += functionalCpu.Run(instructions - executed);
+        std::optional<CpuToHostData> msg = functionalCpu.GetMessage();
+        if (!msg)
+            continue;
+
+        if (auto exitCode = host.Handle(msg.value()))
+            return exitCode;
+    }
+
+    cpu.Restore(functionalCpu.GetIp(), functionalCpu.GetRegisters(), functionalCpu.GetCsrs(),
+                functionalCpu.GetVectorRegisters());
+    return std::nullopt;
+}
+
+
+static void PrintStats(const PipelineStats& stats)
+{
+    static const char* stageNames[] = {"IF", "ID", "EX", "MEM", "WB"};
+
+    for (size_t i = 0; i < stats.stalls.size(); i++)
+        fprintf(stderr, "%s stalls = %llu\n", stageNames[i], (unsigned long long)stats.stalls[i]);
+    fprintf(stderr, "Load-use stalls = %llu, multiply/divide stalls = %llu, FP stalls = %llu\n",
+            (unsigned long long)stats.loadUseStalls, (unsigned long long)stats.mulDivStalls,
+            (unsigned long long)stats.fpStalls);
+    fprintf(stderr, "Branch flushes = %llu, flushed instructions = %llu\n",
+            (unsigned long long)stats.branchFlushes, (unsigned long long)stats.flushedInstructions);
+
+    uint64_t executed = 0;
+    uint64_t mispredicted = 0;
+    fprintf(stderr, "%10s %4s %10s %10s %10s %9s\n", "ip", "type", "executed", "taken", "mispred", "accuracy");
+    for (const auto& [ip, branch] : stats.branches)
+    {
+        const char* type = branch.type == IType::Br ? "br" : branch.type == IType::J ? "j" : "jr";
+        fprintf(stderr, "%#10x %4s %10llu %10llu %10llu %8.2f%%\n", ip, type,
+                (unsigned long long)branch.executed, (unsigned long long)branch.taken,
+                (unsigned long long)branch.mispredicted,
+                100.0 * double(branch.executed - branch.mispredicted) / double(branch.executed));
+        executed += branch.executed;
+        mispredicted += branch.mispredicted;
+    }
+    if (executed > 0)
+        fprintf(stderr, "Prediction accuracy = %.2f%%\n", 100.0 * double(executed - mispredicted) / double(executed));
+}
+
+static void PrintHistogram(const char* name, const Histogram& histogram)
+{
+    static constexpr size_t buckets = 8;
+
+    uint64_t cycles = 0;
+    double sum = 0;
+    for (size_t i = 0; i < histogram.cycles.size(); i++)
+    {
+        cycles += histogram.cycles[i];
+        sum += double(i) * double(histogram.cycles[i]);
+    }
+    if (cycles == 0)
+        return;
+
+    size_t capacity = histogram.cycles.size() - 1;
+    size_t width = std::max<size_t>(1, (capacity + buckets) / buckets);
+    fprintf(stderr, "%-12s mean %6.2f / %zu:", name, sum / double(cycles), capacity);
+    for (size_t from = 0; from <= capacity; from += width)
+    {
+        uint64_t bucket = 0;
+        for (size_t i = from; i < from + width && i <= capacity; i++)
+            bucket += histogram.cycles[i];
+        fprintf(stderr, " [%zu..%zu] %5.1f%%", from, std::min(from + width - 1, capacity),
+                100.0 * double(bucket) / double(cycles));
+    }
+    fprintf(stderr, "\n");
+}
+
+static void PrintStats(const OooStats& stats)
+{
+    fprintf(stderr, "IPC = %.3f (%llu instructions, %llu cycles)\n",
+            double(stats.committed) / double(stats.cycles),
+            (unsigned long long)stats.committed, (unsigned long long)stats.cycles);
+    fprintf(stderr, "Mispredicts = %llu, squashed instructions = %llu, forwarded loads = %llu\n",
+            (unsigned long long)stats.mispredicts, (unsigned long long)stats.squashed,
+            (unsigned long long)stats.forwardedLoads);
+    static const char* fusionNames[] = {"", "lui+addi", "auipc+jalr", "auipc+load", "slli+add"};
+    uint64_t fused = 0;
+    for (uint64_t pairs : stats.fused)
+        fused += pairs;
+    if (fused > 0)
+    {
+        fprintf(stderr, "Fused pairs = %llu, fusion rate = %.2f%%:", (unsigned long long)fused,
+                100.0 * double(2 * fused) / double(stats.committed));
+        for (size_t kind = 1; kind < stats.fused.size(); kind++)
+            fprintf(stderr, " %s %llu", fusionNames[kind], (unsigned long long)stats.fused[kind]);
+        fprintf(stderr, "\n");
+    }
+    PrintHistogram("Fetch queue", stats.fetchQueue);
+    PrintHistogram("ROB", stats.rob);
+    PrintHistogram("IQ", stats.iq);
+    PrintHistogram("LSQ", stats.lsq);
+    PrintHistogram("Phys regs", stats.physRegs);
+}
+
+static void PrintStats(const FunctionalStats& stats, uint64_t instructions)
+{
+    fprintf(stderr, "Dispatches = %llu, %.1f instructions per dispatch\n", (unsigned long long)stats.dispatches,
+            double(instructions) / double(stats.dispatches));
+    fprintf(stderr, "Superblocks = %llu (%llu dropped), %.1f%% of instructions, side exits = %llu\n",
+            (unsigned long long)stats.superblocks, (unsigned long long)stats.droppedSuperblocks,
+            100.0 * double(stats.superblockInstructions) / double(instructions),
+            (unsigned long long)stats.sideExits);
+}
+
+static void PrintStats(const VectorStats& stats)
+{
+    if (stats.instructions == 0)
+        return;
+
+    fprintf(stderr, "Vector instructions = %llu, %.1f elements per instruction\n",
+            (unsigned long long)stats.instructions, double(stats.elements) / double(stats.instructions));
+    fprintf(stderr, "Vector busy cycles = %llu, line accesses = %llu\n",
+            (unsigned long long)stats.busyCycles, (unsigned long long)stats.lineAccesses);
+}
+
+static void PrintStats(const CoherenceStats& stats)
+{
+    static const char* stateNames[] = {"I", "S", "E", "M"};
+
+    fprintf(stderr, "Bus reads = %llu, read-exclusives = %llu, upgrades = %llu\n",
+            (unsigned long long)stats.busReads, (unsigned long long)stats.busReadsExclusive,
+            (unsigned long long)stats.busUpgrades);
+    fprintf(stderr, "Snoop flushes = %llu, snoop invalidations = %llu, coherence misses = %llu\n",
+            (unsigned long long)stats.snoopFlushes, (unsigned long long)stats.snoopInvalidations,
+            (unsigned long long)stats.coherenceMisses);
+    for (size_t from = 0; from < CoherenceStats::states; from++)
+    {
+        for (size_t to = 0; to < CoherenceStats::states; to++)
+        {
+            if (stats.transitions[from][to] != 0)
+                fprintf(stderr, "%s->%s = %llu\n", stateNames[from], stateNames[to],
+                        (unsigned long long)stats.transitions[from][to]);
+        }
+    }
+}
+
+static void PrintStats(const char* level, const LevelStats& stats)
+{
+    uint64_t accesses = stats.hits + stats.misses;
+    fprintf(stderr, "%s hits = %llu, misses = %llu (%.2f%%), writebacks = %llu, back-invalidations = %llu\n", level,
+            (unsigned long long)stats.hits, (unsigned long long)stats.misses,
+            accesses ? 100.0 * stats.misses / accesses : 0.0, (unsigned long long)stats.writebacks,
+            (unsigned long long)stats.backInvalidations);
+}
+
+static std::unique_ptr<IBranchPredictor> MakeBranchPredictor(const std::string& name)
+{
+    if (name == "nottaken")
+        return std::make_unique<NotTakenPredictor>();
+    if (name == "bht")
+        return std::make_unique<BhtPredictor>();
+    if (name == "gshare")
+        return std::make_unique<GsharePredictor>();
+    return nullptr;
+}
+
+static std::optional<Inclusion> ParseInclusion(const std::string& name)
+{
+    if (name == "nine")
+        return Inclusion::Nine;
+    if (name == "inclusive")
+        return Inclusion::Inclusive;
+    if (name == "exclusive")
+        return Inclusion::Exclusive;
+    return std::nullopt;
+}
+
+// Parses --<name>-size=, -ways=, -line=, -latency=, -policy= and -inclusion=.
+// Returns false if the option is not one of them.
+static bool ParseCacheOption(const std::string& arg, const std::string& name, CacheOptions& cache)
+{
+    std::string prefix = "--" + name + "-";
+    size_t equals = arg.find('=');
+    if (arg.rfind(prefix, 0) != 0 || equals == std::string::npos)
+        return false;
+
+    std::string key = arg.substr(prefix.size(), equals - prefix.size());
+    std::string value = arg.substr(equals + 1);
+    if (key == "size")
+        cache.config.sizeBytes = std::stoull(value);
+    else if (key == "ways")
+        cache.config.ways = std::stoull(value);
+    else if (key == "line")
+        cache.config.lineBytes = std::stoull(value);
+    else if (key == "latency")
+        cache.config.hitLatency = std::stoull(value);
+    else if (key == "policy")
+        cache.policyName = value;
+    else if (key == "inclusion" && name != "icache" && name != "dcache")
+        cache.inclusionName = value;
+    else
+        return false;
+    return true;
+}
+
+// Looks the symbol up in the symbol table of a 32-bit ELF file
+static bool ElfDefines(const std::string& fileName, const std::string& symbol)
+{
+    std::ifstream file(fileName, std::ios::in | std::ios::binary);
+    std::vector<char> buf((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (buf.size() < sizeof(Elf32_Ehdr) || buf[EI_CLASS] != ELFCLASS32)
+        return false;
+
+    auto* ehdr = reinterpret_cast<const Elf32_Ehdr*>(buf.data());
+    if (ehdr->e_shoff + size_t(ehdr->e_shnum) * sizeof(Elf32_Shdr) > buf.size())
+        return false;
+
+    auto* shdrs = reinterpret_cast<const Elf32_Shdr*>(buf.data() + ehdr->e_shoff);
+    for (size_t i = 0; i < ehdr->e_shnum; i++)
+    {
+        const Elf32_Shdr& symtab = shdrs[i];
+        if (symtab.sh_type != SHT_SYMTAB || symtab.sh_link >= ehdr->e_shnum ||
+            symtab.sh_offset + symtab.sh_size > buf.size())
+            continue;
+
+        const Elf32_Shdr& strtab = shdrs[symtab.sh_link];
+        auto* syms = reinterpret_cast<const Elf32_Sym*>(buf.data() + symtab.sh_offset);
+        for (size_t j = 0; j < symtab.sh_size / sizeof(Elf32_Sym); j++)
+        {
+            size_t name = strtab.sh_offset + syms[j].st_name;
+            if (syms[j].st_shndx != SHN_UNDEF && name < buf.size() &&
+                strncmp(buf.data() + name, symbol.c_str(), buf.size() - name) == 0)
+                return true;
+        }
+    }
+    return false;
+}
+
+static std::optional<ReplacementPolicy> ParseReplacementPolicy(const std::string& name)
+{
+    if (name == "fifo")
+        return ReplacementPolicy::Fifo;
+    if (name == "lru")
+        return ReplacementPolicy::Lru;
+    if (name == "plru")
+        return ReplacementPolicy::Plru;
+    if (name == "srrip")
+        return ReplacementPolicy::Srrip;
+    if (name == "brrip")
+        return ReplacementPolicy::Brrip;
+    if (name == "random")
+        return ReplacementPolicy::Random;
+    return std::nullopt;
+}
+
+// Runs a timing model from the start of the program, or after fast-forwarding.
+// Every hart gets its own core and caches, all of them share the memory storage.
+// The data caches are kept coherent by a snooping bus unless it is turned off.
+template <typename Core, typename MakeCore>
+static int Run(MemoryStorage& storage, Host& host, const Options& options, MakeCore makeCore)
+{
+    std::optional<CoherenceBus> bus;
+    if (options.coherence == "msi")
+        bus.emplace(Protocol::Msi);
+    else if (options.coherence == "mesi")
+        bus.emplace(Protocol::Mesi);
+
+    // The levels below the first-level caches are shared by all harts
+    MainMemory memory{storage, options.memLatency};
+    IMemoryLevel* next = &memory;
+    std::optional<CacheLevel> l3;
+    if (options.l3.config.sizeBytes != 0)
+        next = &l3.emplace(options.l3.config, options.l3.inclusion, *next);
+    std::optional<CacheLevel> l2;
+    if (options.l2.config.sizeBytes != 0)
+        next = &l2.emplace(options.l2.config, options.l2.inclusion, *next);
+
+    Clint clint{options.harts};
+    std::vector<Hart<Core>> harts(options.harts);
+    for (size_t id = 0; id < harts.size(); id++)
+    {
+        Hart<Core>& hart = harts[id];
+        hart.mem = std::make_unique<CachedMem>(storage, options.ooo ? options.oooConfig.dataPorts : 1,
+                                               bus ? &bus.value() : nullptr, options.icache.config,
+                                               options.dcache.config, next);
+        hart.bpred = MakeBranchPredictor(options.bpred);
+        hart.cpu = makeCore(*hart.mem, *hart.bpred);
+        hart.cpu->Reset(0x200, id, harts.size());
+        hart.cpu->SetClint(&clint);
+    }
+
+    if (options.fastForward > 0)
+    {
+        if (auto exitCode = FastForward(*harts[0].cpu, storage, clint, host, options.fastForward, options))
+            return exitCode.value();
+    }
+
+    int exitCode = Simulate(harts, host, clint);
+
+    for (size_t id = 0; options.stats && id < harts.size(); id++)
+    {
+        if (harts.size() > 1)
+            fprintf(stderr, "hart %zu:\n", id);
+        if constexpr (!std::is_same_v<Core, Cpu>)
+            PrintStats(harts[id].cpu->GetStats());
+        PrintStats(harts[id].cpu->GetVectorStats());
+        if (bus)
+            PrintStats(harts[id].mem->GetCoherenceStats());
+    }
+    if (options.stats && l2)
+        PrintStats("L2", l2->GetStats());
+    if (options.stats && l3)
+        PrintStats("L3", l3->GetStats());
+
+    return exitCode;
+}
+
+int main(int argc, char* argv[])
 {
+    Options options;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        std::string value = arg.substr(arg.find('=') + 1);
+        if (arg == "--functional")
+            options.functional = true;
+        else if (arg == "--jit")
+            options.jit = true;
+        else if (arg == "--superblocks")
+            options.superblocks = true;
+        else if (arg == "--pipelined")
+            options.pipelined = true;
+        else if (arg == "--ooo")
+            options.ooo = true;
+        else if (arg.rfind("--fetch-width=", 0) == 0)
+            options.oooConfig.fetchWidth = std::stoull(value);
+        else if (arg.rfind("--issue-width=", 0) == 0)
+            options.oooConfig.issueWidth = std::stoull(value);
+        else if (arg.rfind("--commit-width=", 0) == 0)
+            options.oooConfig.commitWidth = std::stoull(value);
+        else if (arg.rfind("--rob-size=", 0) == 0)
+            options.oooConfig.robSize = std::stoull(value);
+        else if (arg == "--fusion")
+            options.oooConfig.fusion = true;
+        else if (arg.rfind("--mul-latency=", 0) == 0)
+            options.mulDiv.mulLatency = std::stoull(value);
+        else if (arg.rfind("--div-latency=", 0) == 0)
+            options.mulDiv.divLatency = std::stoull(value);
+        else if (arg == "--muldiv-pipelined")
+            options.mulDiv.pipelined = true;
+        else if (arg.rfind("--fadd-latency=", 0) == 0)
+            options.fpu.addLatency = std::stoull(value);
+        else if (arg.rfind("--fmul-latency=", 0) == 0)
+            options.fpu.mulLatency = std::stoull(value);
+        else if (arg.rfind("--fdiv-latency=", 0) == 0)
+            options.fpu.divLatency = std::stoull(value);
+        else if (arg.rfind("--vlen=", 0) == 0)
+            options.vector.vlen = std::stoull(value);
+        else if (arg.rfind("--vector-lanes=", 0) == 0)
+            options.vector.lanes = std::stoull(value);
+        else if (ParseCacheOption(arg, "icache", options.icache) || ParseCacheOption(arg, "dcache", options.dcache) ||
+                 ParseCacheOption(arg, "l2", options.l2) || ParseCacheOption(arg, "l3", options.l3))
+            continue;
+        else if (arg.rfind("--cache-seed=", 0) == 0)
+        {
+            for (CacheOptions* cache : {&options.icache, &options.dcache, &options.l2, &options.l3})
+                cache->config.seed = uint32_t(std::stoul(value));
+        }
+        else if (arg.rfind("--memory-latency=", 0) == 0)
+            options.memLatency = std::stoull(value);
+        else if (arg == "--stats")
+            options.stats = true;
+        else if (arg.rfind("--bpred=", 0) == 0)
+            options.bpred = value;
+        else if (arg.rfind("--fast-forward=", 0) == 0)
+            options.fastForward = std::stoull(value);
+        else if (arg.rfind("--harts=", 0) == 0)
+            options.harts = std::stoull(value);
+        else if (arg.rfind("--coherence=", 0) == 0)
+            options.coherence = value;
+        else
+        {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    if (!MakeBranchPredictor(options.bpred))
+    {
+        fprintf(stderr, "Unknown branch predictor: %s\n", options.bpred.c_str());
+        return 1;
+    }
+    if (options.coherence.empty())
+        options.coherence = options.harts > 1 ? "mesi" : "none";
+    if (options.coherence != "none" && options.coherence != "msi" && options.coherence != "mesi")
+    {
+        fprintf(stderr, "Unknown coherence protocol: %s\n", options.coherence.c_str());
+        return 1;
+    }
+    if (options.harts == 0 || (options.harts > 1 && (options.functional || options.fastForward > 0)))
+    {
+        fprintf(stderr, "Several harts are only supported by the timing models without fast-forwarding\n");
+        return 1;
+    }
+
+    if (options.vector.vlen == 0 || options.vector.vlen % 32 != 0 || options.vector.lanes == 0)
+    {
+        fprintf(stderr, "VLEN must be a positive multiple of 32 and there must be at least one vector lane\n");
+        return 1;
+    }
+
+    if (!options.oooConfig.IsValid())
+    {
+        fprintf(stderr, "The fetch, issue and commit widths and the ROB size must be positive, "
+                        "and there must be more physical registers than the %u architectural ones\n", unsigned(archRegs));
+        return 1;
+    }
+
+    if (options.l3.config.sizeBytes != 0 && options.l2.config.sizeBytes == 0)
+    {
+        fprintf(stderr, "An L3 needs an L2\n");
+        return 1;
+    }
+
+    std::vector<CacheOptions*> caches{&options.icache, &options.dcache};
+    for (CacheOptions* level : {&options.l2, &options.l3})
+    {
+        if (level->config.sizeBytes != 0)
+            caches.push_back(level);
+    }
+    for (CacheOptions* cache : caches)
+    {
+        auto policy = ParseReplacementPolicy(cache->policyName);
+        if (!policy)
+        {
+            fprintf(stderr, "Unknown replacement policy: %s\n", cache->policyName.c_str());
+            return 1;
+        }
+        cache->config.policy = policy.value();
+
+        auto inclusion = ParseInclusion(cache->inclusionName);
+        if (!inclusion)
+        {
+            fprintf(stderr, "Unknown inclusion policy: %s\n", cache->inclusionName.c_str());
+            return 1;
+        }
+        cache->inclusion = inclusion.value();
+
+        if (!cache->config.IsValid())
+        {
+            fprintf(stderr, "A cache line must be a power of two of at least 4 bytes, the cache a power of two sets "
+                            "of whole lines, and pseudo-LRU needs a power of two ways, at most %zu\n", PlruPolicy::maxWays);
+            return 1;
+        }
+
+        // Lines move between the levels whole
+        if (caches.size() > 2 && cache->config.lineBytes != options.icache.config.lineBytes)
+        {
+            fprintf(stderr, "All caches need the same line size when there is an L2\n");
+            return 1;
+        }
+    }
+
+    // A program for several harts has its own thread_entry, which gives each hart its share of
+    // the work. Every hart would run main of the others, as in the binaries built before it existed.
+    if (options.harts > 1 && !ElfDefines("program", "thread_entry"))
+    {
+        fprintf(stderr, "The program has no thread_entry, so it runs on one hart only\n");
+        return 1;
+    }
+
     MemoryStorage mem ;
     mem.LoadElf("program");
-    std::unique_ptr<IMem> memModelPtr(new CachedMem (mem));
-    Cpu cpu{*memModelPtr};
-    cpu.Reset(0x200);
 
     std::ofstream out;
     out.open("CachedResults.txt", std::ios::app);
+    Host host{out};
 
-    int32_t print_int = 0;
-    while (true)
+    if (options.functional)
     {
-        cpu.Clock();
-        memModelPtr->Clock();
-        std::optional<CpuToHostData> msg = cpu.GetMessage();
-        if (!msg)
-            continue;
+        Clint clint;
+        FunctionalCpu cpu{mem, options.jit, options.superblocks, options.vector};
+        cpu.Reset(0x200);
+        cpu.SetClint(&clint);
 
-        auto type = msg.value().unpacked.type;
-        auto data = msg.value().unpacked.data;
-
-        if (type == CpuToHostType::ExitCode)
+        uint64_t executed = 0;
+        while (true)
         {
-            if (data == 0)
-            {
-                fprintf(stderr, "PASSED\n");
-                out << "PASSED" << std::endl;
-                out.close();
-                return 0;
-            }
-            else
+            executed += cpu.Run(functionalBatchSize);
+            std::optional<CpuToHostData> msg = cpu.GetMessage();
+            if (!msg)
+                continue;
+
+            if (auto exitCode = host.Handle(msg.value()))
             {
-                fprintf(stderr, "FAILED: exit code = %d\n", data);
-                return data;
+                if (options.stats)
+                    PrintStats(cpu.GetStats(), executed);
+                return exitCode.value();
             }
-        } else if (type == CpuToHostType::PrintChar) {
-            fprintf(stderr, "%c", (char)data);
-            out << (char)data;
-        } else if (type == CpuToHostType::PrintIntLow) {
-            print_int = uint32_t(data);
-        } else if(type == CpuToHostType::PrintIntHigh) {
-            print_int |= uint32_t(data) << 16;
-            fprintf(stderr, "%d", print_int);
-            out << print_int;
         }
     }
+
+    if (options.ooo)
+    {
+        return Run<OooCpu>(mem, host, options, [&options](IMem& imem, IBranchPredictor& bpred) {
+            return std::make_unique<OooCpu>(imem, bpred, options.oooConfig, options.mulDiv, options.vector,
+                                            options.fpu);
+        });
+    }
+
+    if (options.pipelined)
+    {
+        return Run<PipelinedCpu>(mem, host, options, [&options](IMem& imem, IBranchPredictor& bpred) {
+            return std::make_unique<PipelinedCpu>(imem, bpred, options.mulDiv, options.vector, options.fpu);
+        });
+    }
+
+    return Run<Cpu>(mem, host, options, [&options](IMem& imem, IBranchPredictor&) {
+        return std::make_unique<Cpu>(imem, options.mulDiv, options.vector, options.fpu);
+    });
 }
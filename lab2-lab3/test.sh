@@ -29,8 +29,10 @@ case $testResponse in
 	         srl srli
 	         sub
 	         xor xori
-	         bpred_bht bpred_j bpred_ras
+	         bpred_bht bpred_j bpred_j_noloop bpred_ras
 	         cache
+	         vvadd_vec multiply_vec
+	         vvadd_mt median_mt
 	     );
        vmh_dir=programs/build/assembly/bin;;
     2) asm_tests=(
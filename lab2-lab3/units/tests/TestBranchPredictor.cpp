@@ -0,0 +1,58 @@
+#include <gtest/gtest.h>
+
+#include <BranchPredictor.h>
+#include <Decoder.h>
+#include <BaseTypes.h>
+
+namespace units
+{
+    static const Word BEQ_X0_X0_8  = 0x00000463;    // beq x0, x0, 8
+    static const Word JAL_RA_100   = 0x100000ef;    // jal ra, 0x100
+    static const Word JR_RA        = 0x00008067;    // jalr x0, 0(ra)
+    static const Word BRANCH_IP    = 0x200;
+    static const Word CALL_IP      = 0x300;
+    static const Word RETURN_IP    = 0x400;
+
+    // Predicts and resolves one instruction, returns true if the prediction was right
+    static bool Resolve(IBranchPredictor& bpred, Word ip, Word word, Word nextIp)
+    {
+        Decoder decoder;
+        Instruction instr = decoder.Decode(word);
+        Prediction prediction = bpred.Predict(ip);
+        if (prediction.nextIp != nextIp)
+            bpred.Recover(ip, instr, nextIp, prediction);
+        bpred.Update(ip, instr, nextIp, prediction);
+        return prediction.nextIp == nextIp;
+    }
+
+    TEST(BranchPredictorTest, TestBhtLearnsTakenBranch)
+    {
+        BhtPredictor bpred;
+
+        ASSERT_FALSE(Resolve(bpred, BRANCH_IP, BEQ_X0_X0_8, BRANCH_IP + 8));
+        ASSERT_TRUE(Resolve(bpred, BRANCH_IP, BEQ_X0_X0_8, BRANCH_IP + 8));
+        ASSERT_TRUE(Resolve(bpred, BRANCH_IP, BEQ_X0_X0_8, BRANCH_IP + 8));
+    }
+
+    TEST(BranchPredictorTest, TestRasPredictsReturn)
+    {
+        BhtPredictor bpred;
+
+        // The first pass only fills the BTB
+        Resolve(bpred, CALL_IP, JAL_RA_100, CALL_IP + 0x100);
+        Resolve(bpred, RETURN_IP, JR_RA, CALL_IP + 4);
+
+        // A call from another place is not in the BTB yet, but it is still pushed,
+        // so the return target comes from the stack rather than from the BTB
+        ASSERT_FALSE(Resolve(bpred, CALL_IP + 8, JAL_RA_100, CALL_IP + 8 + 0x100));
+        ASSERT_TRUE(Resolve(bpred, RETURN_IP, JR_RA, CALL_IP + 8 + 4));
+    }
+
+    TEST(BranchPredictorTest, TestNotTaken)
+    {
+        NotTakenPredictor bpred;
+
+        ASSERT_FALSE(Resolve(bpred, BRANCH_IP, BEQ_X0_X0_8, BRANCH_IP + 8));
+        ASSERT_FALSE(Resolve(bpred, BRANCH_IP, BEQ_X0_X0_8, BRANCH_IP + 8));
+    }
+}
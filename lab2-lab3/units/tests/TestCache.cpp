@@ -0,0 +1,176 @@
+#include <gtest/gtest.h>
+
+#include <Memory.h>
+#include <BaseTypes.h>
+
+#include <set>
+
+namespace units
+{
+    // 1 KiB of 64-byte lines in two ways: 8 sets, the index is in bits 6-8
+    static const CacheConfig TWO_WAY{1024, 2, 64, 2};
+
+    TEST(CacheTest, TestGeometry)
+    {
+        Cache cache{TWO_WAY};
+        ASSERT_EQ(TWO_WAY.Sets(), 8u);
+        ASSERT_EQ(cache.LineWords(), 16u);
+        ASSERT_EQ(cache.LineAddr(0x1234), 0x1200u);
+        ASSERT_EQ(cache.SetIndex(0x1240), 1u);
+        ASSERT_EQ(cache.Tag(0x1240), 0x1240u >> 9u);
+
+        Cache::Way& way = cache.Victim(0x1240);
+        way.tag = cache.Tag(0x1240);
+        way.state = LineState::Exclusive;
+        ASSERT_EQ(cache.LineAddr(way), 0x1240u);
+        ASSERT_EQ(cache.Find(0x127c), &way);
+        ASSERT_EQ(cache.Find(0x1040), nullptr);         // same set, another tag
+
+        ASSERT_EQ(codeCacheConfig.Sets(), 1u);
+        ASSERT_EQ(codeCacheConfig.Ways(), codeCacheSizeLines);
+        ASSERT_FALSE((CacheConfig{1024, 3, 128, 1}.IsValid()));
+        ASSERT_FALSE((CacheConfig{1024, 1, 96, 1}.IsValid()));
+        ASSERT_FALSE((CacheConfig{1024, 2, 2, 1}.IsValid()));
+    }
+
+    // A third line in a set replaces the oldest one, the other sets keep theirs
+    TEST(CacheTest, TestSetConflict)
+    {
+        MemoryStorage storage;
+        CashMemoryStorage cache{storage, nullptr, codeCacheConfig, TWO_WAY};
+        const Word setStride = 8 * 64;
+
+        ASSERT_EQ(cache.StoreInstruction(0x1000, 5), memoryLatency);
+        ASSERT_EQ(cache.LoadInstruction(0x1000 + setStride).second, memoryLatency);
+        ASSERT_EQ(cache.LoadInstruction(0x1040).second, memoryLatency);
+        ASSERT_EQ(cache.LoadInstruction(0x1000).second, 0u);
+        ASSERT_EQ(storage.Read(0x1000), 0u);
+
+        // The dirty line goes back to the memory when it is replaced
+        ASSERT_EQ(cache.LoadInstruction(0x1000 + 2 * setStride).second, memoryLatency);
+        ASSERT_EQ(storage.Read(0x1000), 5u);
+        ASSERT_EQ(cache.LoadInstruction(0x1000).second, memoryLatency);
+        ASSERT_EQ(cache.LoadInstruction(0x1040).second, 0u);
+    }
+
+    // The hit latency and the line size come from the configuration
+    TEST(CacheTest, TestCachedMemConfig)
+    {
+        MemoryStorage storage;
+        for (Word addr = 0x1000; addr < 0x1020; addr += 4)
+            storage.Write(addr, 0x00a00513);                // addi x10, x0, 10
+        CachedMem mem{storage, 1, nullptr, CacheConfig{256, 1, 16, 1}, TWO_WAY};
+
+        mem.Request(0x1000);
+        ASSERT_EQ(mem.CyclesToNextEvent(), 1u);
+        mem.SkipCycles(1);
+        ASSERT_FALSE(mem.Response().has_value());       // the miss is found after the hit latency
+        mem.SkipCycles(memoryLatency);
+        std::array<Word, 8> words{};
+        ASSERT_EQ(mem.ResponseBlock(words.data(), words.size()), 4u);    // the rest of the 16-byte line
+        ASSERT_EQ(words[0], 0x00a00513u);
+    }
+
+    // A hit keeps the line under LRU, FIFO replaces it anyway
+    TEST(CacheTest, TestLruHit)
+    {
+        MemoryStorage storage;
+        CacheConfig lru = TWO_WAY;
+        lru.policy = ReplacementPolicy::Lru;
+        CashMemoryStorage cache{storage, nullptr, codeCacheConfig, lru};
+        const Word setStride = 8 * 64;
+
+        cache.LoadInstruction(0x1000);
+        cache.LoadInstruction(0x1000 + setStride);
+        ASSERT_EQ(cache.LoadInstruction(0x1000).second, 0u);
+        ASSERT_EQ(cache.LoadInstruction(0x1000 + 2 * setStride).second, memoryLatency);
+        ASSERT_EQ(cache.LoadInstruction(0x1000).second, 0u);
+        ASSERT_EQ(cache.LoadInstruction(0x1000 + setStride).second, memoryLatency);
+    }
+
+    // Every policy fills the empty ways before it replaces a line, a used way goes last
+    TEST(CacheTest, TestPolicies)
+    {
+        for (auto policy : {ReplacementPolicy::Fifo, ReplacementPolicy::Lru, ReplacementPolicy::Plru,
+                            ReplacementPolicy::Srrip, ReplacementPolicy::Brrip, ReplacementPolicy::Random})
+        {
+            auto replacement = MakeReplacementPolicy(policy, 2, 4, 1);
+            std::set<size_t> filled;
+            for (size_t i = 0; i < 4; i++)
+            {
+                size_t way = replacement->Victim(1);
+                replacement->Insert(1, way);
+                filled.insert(way);
+            }
+            ASSERT_EQ(filled.size(), 4u) << int(policy);
+            ASSERT_EQ(replacement->Victim(0), 0u) << int(policy);      // the other set is still empty
+        }
+
+        PlruPolicy plru{1, 4};
+        for (size_t way : {0, 2, 1, 3})
+        {
+            ASSERT_EQ(plru.Victim(0), way);
+            plru.Insert(0, way);
+        }
+        plru.Touch(0, 0);
+        ASSERT_EQ(plru.Victim(0), 2u);
+        plru.Invalidate(0, 1);
+        ASSERT_EQ(plru.Victim(0), 1u);
+
+        // The tree of the widest set fills the whole word
+        PlruPolicy widest{2, PlruPolicy::maxWays};
+        for (size_t way = 0; way < PlruPolicy::maxWays; way++)
+            widest.Insert(1, widest.Victim(1));
+        widest.Invalidate(1, PlruPolicy::maxWays - 1);
+        ASSERT_EQ(widest.Victim(1), PlruPolicy::maxWays - 1);
+        ASSERT_EQ(widest.Victim(0), 0u);
+
+        LruPolicy lru{1, 4};
+        for (size_t way = 0; way < 4; way++)
+            lru.Insert(0, lru.Victim(0));
+        lru.Touch(0, 0);
+        ASSERT_EQ(lru.Victim(0), 1u);
+        lru.Invalidate(0, 3);
+        ASSERT_EQ(lru.Victim(0), 3u);
+        lru.Touch(0, 3);
+        ASSERT_EQ(lru.Victim(0), 1u);
+
+        // A hit line is predicted to be reused soon, the others age past it
+        RripPolicy srrip{1, 4, false, 1};
+        for (size_t way = 0; way < 4; way++)
+            srrip.Insert(0, srrip.Victim(0));
+        srrip.Touch(0, 0);
+        ASSERT_EQ(srrip.Victim(0), 1u);
+        srrip.Insert(0, 1);
+        ASSERT_EQ(srrip.Victim(0), 2u);
+    }
+
+    // The same seed replaces the same ways
+    TEST(CacheTest, TestRandomSeed)
+    {
+        RandomPolicy first{1, 8, 7};
+        RandomPolicy second{1, 8, 7};
+        bool replacedOther = false;
+        for (size_t i = 0; i < 64; i++)
+        {
+            size_t way = first.Victim(0);
+            ASSERT_EQ(second.Victim(0), way);
+            if (i < 8)
+            {
+                ASSERT_EQ(way, i);
+            }
+            replacedOther |= i >= 8 && way != 7;
+            first.Insert(0, way);
+            second.Insert(0, way);
+        }
+        ASSERT_TRUE(replacedOther);
+        first.Invalidate(0, 5);
+        ASSERT_EQ(first.Victim(0), 5u);
+        first.Insert(0, 5);
+        ASSERT_EQ(first.Victim(0), second.Victim(0));
+        ASSERT_TRUE((CacheConfig{1024, 0, 128, 1, ReplacementPolicy::Plru}.IsValid()));
+        ASSERT_FALSE((CacheConfig{768, 0, 128, 1, ReplacementPolicy::Plru}.IsValid()));
+        ASSERT_FALSE((CacheConfig{16384, 0, 128, 1, ReplacementPolicy::Plru}.IsValid()));
+        ASSERT_TRUE((CacheConfig{768, 0, 128, 1}.IsValid()));
+    }
+}
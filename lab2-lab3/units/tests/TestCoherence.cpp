@@ -0,0 +1,95 @@
+#include <gtest/gtest.h>
+
+#include <Memory.h>
+#include <BaseTypes.h>
+
+namespace units
+{
+    static const Word COHERENCE_ADDR = 0x1000;
+
+    static uint64_t Transitions(const CoherenceStats& stats, LineState from, LineState to)
+    {
+        return stats.transitions[size_t(from)][size_t(to)];
+    }
+
+    TEST(CoherenceTest, TestMesiReadWrite)
+    {
+        MemoryStorage storage;
+        CoherenceBus bus{Protocol::Mesi};
+        CashMemoryStorage first{storage, &bus};
+        CashMemoryStorage second{storage, &bus};
+
+        // The only copy is Exclusive and becomes Modified without a bus transaction
+        ASSERT_EQ(first.LoadInstruction(COHERENCE_ADDR).second, memoryLatency);
+        ASSERT_EQ(first.StoreInstruction(COHERENCE_ADDR, 7), 0u);
+        ASSERT_EQ(Transitions(first.GetCoherenceStats(), LineState::Exclusive, LineState::Modified), 1u);
+
+        // The dirty line is flushed for the other reader, both copies are Shared
+        ASSERT_EQ(second.LoadInstruction(COHERENCE_ADDR).first, 7u);
+        ASSERT_EQ(storage.Read(COHERENCE_ADDR), 7u);
+        ASSERT_EQ(first.GetCoherenceStats().snoopFlushes, 1u);
+        ASSERT_EQ(Transitions(first.GetCoherenceStats(), LineState::Modified, LineState::Shared), 1u);
+        ASSERT_EQ(Transitions(second.GetCoherenceStats(), LineState::Invalid, LineState::Shared), 1u);
+
+        // Writing a Shared line invalidates the other copy
+        ASSERT_EQ(second.StoreInstruction(COHERENCE_ADDR + 4, 9), upgradeLatency);
+        ASSERT_EQ(second.GetCoherenceStats().busUpgrades, 1u);
+        ASSERT_EQ(Transitions(first.GetCoherenceStats(), LineState::Shared, LineState::Invalid), 1u);
+
+        auto reload = first.LoadInstruction(COHERENCE_ADDR + 4);
+        ASSERT_EQ(reload.first, 9u);
+        ASSERT_EQ(reload.second, memoryLatency);
+        ASSERT_EQ(first.GetCoherenceStats().coherenceMisses, 1u);
+    }
+
+    TEST(CoherenceTest, TestMsiWriteMiss)
+    {
+        MemoryStorage storage;
+        CoherenceBus bus{Protocol::Msi};
+        CashMemoryStorage first{storage, &bus};
+        CashMemoryStorage second{storage, &bus};
+
+        // Without the Exclusive state even a private line needs an upgrade
+        first.LoadInstruction(COHERENCE_ADDR);
+        ASSERT_EQ(first.StoreInstruction(COHERENCE_ADDR, 3), upgradeLatency);
+
+        ASSERT_EQ(second.StoreInstruction(COHERENCE_ADDR, 4), memoryLatency);
+        ASSERT_EQ(second.GetCoherenceStats().busReadsExclusive, 1u);
+        ASSERT_EQ(Transitions(first.GetCoherenceStats(), LineState::Modified, LineState::Invalid), 1u);
+        ASSERT_EQ(first.LoadInstruction(COHERENCE_ADDR).first, 4u);
+    }
+
+    static Instruction Atomic(IType type, Word data, AluFunc func = AluFunc::None)
+    {
+        Instruction instr;
+        instr._type = type;
+        instr._aluFunc = func;
+        instr._src1Val = COHERENCE_ADDR;
+        instr._data = data;
+        return instr;
+    }
+
+    TEST(CoherenceTest, TestAtomics)
+    {
+        MemoryStorage storage;
+        CoherenceBus bus{Protocol::Mesi};
+        CashMemoryStorage first{storage, &bus};
+        CashMemoryStorage second{storage, &bus};
+
+        // An AMO takes the line from the other cache
+        first.StoreInstruction(COHERENCE_ADDR, 1);
+        auto amo = second.AtomicInstruction(Atomic(IType::Amo, 2, AluFunc::Add));
+        ASSERT_EQ(amo.first, 1u);
+        ASSERT_EQ(amo.second, memoryLatency);
+        ASSERT_EQ(first.LoadInstruction(COHERENCE_ADDR).first, 3u);
+
+        // A store of the other cache breaks the reservation
+        ASSERT_EQ(first.AtomicInstruction(Atomic(IType::Lr, 0)).first, 3u);
+        second.StoreInstruction(COHERENCE_ADDR + 4, 0);
+        ASSERT_EQ(first.AtomicInstruction(Atomic(IType::Sc, 4)).first, 1u);
+
+        ASSERT_EQ(first.AtomicInstruction(Atomic(IType::Lr, 0)).first, 3u);
+        ASSERT_EQ(first.AtomicInstruction(Atomic(IType::Sc, 4)).first, 0u);
+        ASSERT_EQ(second.LoadInstruction(COHERENCE_ADDR).first, 4u);
+    }
+}
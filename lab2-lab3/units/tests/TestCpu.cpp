@@ -0,0 +1,112 @@
+#include <gtest/gtest.h>
+
+#include <Cpu.h>
+#include <BaseTypes.h>
+
+namespace units
+{
+    static const Word SKIP_CODE_IP = 0x200;
+    static const Word SKIP_DATA_ADDR = 0x2000;
+    static const Word SKIP_DATA = 0x1234;
+    static const size_t SKIP_MAX_CYCLES = 10000;
+
+    // Sends the cycles a missing load takes as seen by mcycle, then the loaded word
+    static const std::vector<Word> MISS_PROGRAM{
+            0x000020b7,         // lui x1, 2
+            0xb00022f3,         // csrr x5, mcycle
+            0x0000a103,         // lw x2, 0(x1)
+            0xb0002373,         // csrr x6, mcycle
+            0x405301b3,         // sub x3, x6, x5
+            0x78019073,         // csrw mtohost, x3
+            0x78011073};        // csrw mtohost, x2
+
+    struct SkipResult
+    {
+        std::vector<Word> messages;
+        size_t cycles = 0;
+        size_t steps = 0;       // times the core was clocked
+    };
+
+    // Runs the program like the driver does, jumping over idle cycles if skip is set
+    static SkipResult RunMissProgram(bool skip)
+    {
+        MemoryStorage storage;
+        for (size_t i = 0; i < MISS_PROGRAM.size(); i++)
+            storage.Write(SKIP_CODE_IP + i * 4, MISS_PROGRAM[i]);
+        storage.Write(SKIP_DATA_ADDR, SKIP_DATA);
+
+        CachedMem mem{storage};
+        Cpu cpu{mem};
+        cpu.Reset(SKIP_CODE_IP);
+
+        SkipResult result;
+        while (result.messages.size() < 2 && result.cycles < SKIP_MAX_CYCLES)
+        {
+            size_t idle = skip ? std::min(cpu.CyclesToNextEvent(), mem.CyclesToNextEvent()) : 0;
+            if (idle > 0)
+            {
+                cpu.SkipCycles(idle);
+                mem.SkipCycles(idle);
+                result.cycles += idle;
+            }
+
+            cpu.Clock();
+            mem.Clock();
+            result.cycles++;
+            result.steps++;
+            if (auto msg = cpu.GetMessage())
+                result.messages.push_back(msg.value().payload);
+        }
+        return result;
+    }
+
+    // Skipping the wait for a miss in one jump gives the same mcycle and the same data
+    TEST(CpuTest, TestSkipCycles)
+    {
+        SkipResult clocked = RunMissProgram(false);
+        SkipResult skipped = RunMissProgram(true);
+
+        ASSERT_EQ(clocked.messages.size(), 2u);
+        ASSERT_EQ(skipped.messages, clocked.messages);
+        ASSERT_EQ(skipped.cycles, clocked.cycles);
+        ASSERT_GT(clocked.messages[0], memoryLatency);
+        ASSERT_EQ(clocked.messages[1], SKIP_DATA);
+        ASSERT_LT(skipped.steps + memoryLatency, clocked.steps);
+    }
+
+    // A data miss of CachedMem responds in the same cycle either way
+    TEST(CpuTest, TestSkipMemoryMiss)
+    {
+        MemoryStorage storage;
+        storage.Write(SKIP_DATA_ADDR, SKIP_DATA);
+        Instruction load;
+        load._type = IType::Ld;
+        load._src1Val = SKIP_DATA_ADDR;
+
+        CachedMem clockedMem{storage};
+        Instruction clockedLoad = load;
+        clockedMem.Request(clockedLoad);
+        size_t clockedCycles = 0;
+        while (!clockedMem.Response(clockedLoad))
+        {
+            clockedMem.Clock();
+            clockedCycles++;
+        }
+
+        CachedMem skippedMem{storage};
+        Instruction skippedLoad = load;
+        skippedMem.Request(skippedLoad);
+        size_t skippedCycles = 0;
+        while (!skippedMem.Response(skippedLoad))
+        {
+            size_t idle = skippedMem.CyclesToNextEvent();
+            skippedMem.SkipCycles(idle);
+            skippedCycles += idle;
+        }
+
+        ASSERT_EQ(skippedCycles, clockedCycles);
+        ASSERT_EQ(clockedCycles, cacheMemoryLatency + memoryLatency);
+        ASSERT_EQ(skippedLoad._data, SKIP_DATA);
+        ASSERT_EQ(clockedLoad._data, SKIP_DATA);
+    }
+}
@@ -0,0 +1,84 @@
+#include <gtest/gtest.h>
+
+#include <DecodeCache.h>
+#include <BaseTypes.h>
+
+namespace units
+{
+    static const Word ADDI_X1_X0_5  = 0x00500093;    // addi x1, x0, 5
+    static const Word ADDI_X2_X0_7  = 0x00700113;    // addi x2, x0, 7
+    static const Word CODE_IP       = 0x200;
+
+    TEST(DecodeCacheTest, TestDecodeCacheHit)
+    {
+        DecodeCache cache;
+        Instruction instr;
+
+        instr = cache.Decode(CODE_IP, ADDI_X1_X0_5);
+        ASSERT_EQ(instr._dst, 1);
+        ASSERT_EQ(instr._imm, 5u);
+
+        instr._data = 42;
+        instr = cache.Decode(CODE_IP, ADDI_X1_X0_5);
+        ASSERT_EQ(instr._dst, 1);
+        ASSERT_EQ(instr._data, 0u);
+    }
+
+    TEST(DecodeCacheTest, TestDecodeCacheWordMismatch)
+    {
+        DecodeCache cache;
+        Instruction instr;
+
+        instr = cache.Decode(CODE_IP, ADDI_X1_X0_5);
+        instr = cache.Decode(CODE_IP, ADDI_X2_X0_7);
+        ASSERT_EQ(instr._dst, 2);
+        ASSERT_EQ(instr._imm, 7u);
+    }
+
+    // Only the line of the invalidated address is decoded again
+    TEST(DecodeCacheTest, TestDecodeCacheInvalidate)
+    {
+        DecodeCache cache;
+        Instruction instr;
+
+        cache.Decode(CODE_IP, ADDI_X1_X0_5);
+        cache.Decode(CODE_IP + lineSizeBytes, ADDI_X2_X0_7);
+        cache.Invalidate(CODE_IP + 4);
+        ASSERT_EQ(cache.Decodes(), 2u);
+
+        instr = cache.Decode(CODE_IP, ADDI_X1_X0_5);
+        ASSERT_EQ(cache.Decodes(), 3u);
+        ASSERT_EQ(instr._dst, 1);
+        ASSERT_EQ(instr._imm, 5u);
+
+        cache.Decode(CODE_IP + lineSizeBytes, ADDI_X2_X0_7);
+        ASSERT_EQ(cache.Decodes(), 3u);
+    }
+
+    // A strided vector store drops the lines of all its elements
+    TEST(DecodeCacheTest, TestDecodeCacheInvalidateVector)
+    {
+        DecodeCache cache;
+        VectorRegisterFile vrf;
+        Instruction vset = Decoder().Decode(0x0d0070d7);      // vsetvli x1, x0, e32, m1, ta, ma
+        vrf.SetVl(vset);
+
+        Instruction store = Decoder().Decode(0x0a3160a7);     // vsse32.v v1, (x2), x3
+        store._src1Val = CODE_IP;
+        store._src2Val = lineSizeBytes;
+        ASSERT_GT(vrf.Vl(), 3u);
+
+        cache.Decode(CODE_IP + 3 * lineSizeBytes, ADDI_X1_X0_5);
+        cache.Decode(CODE_IP - lineSizeBytes, ADDI_X2_X0_7);
+        cache.Invalidate(store, vrf);
+        ASSERT_EQ(cache.Decodes(), 2u);
+
+        Instruction instr = cache.Decode(CODE_IP + 3 * lineSizeBytes, ADDI_X1_X0_5);
+        ASSERT_EQ(cache.Decodes(), 3u);
+        ASSERT_EQ(instr._dst, 1);
+        ASSERT_EQ(instr._imm, 5u);
+
+        cache.Decode(CODE_IP - lineSizeBytes, ADDI_X2_X0_7);
+        ASSERT_EQ(cache.Decodes(), 3u);
+    }
+}
@@ -19,12 +19,17 @@ namespace units
     bool checkLUIInstruction(Word imm, Word rd, Word rs1, const Instruction& inst)
     {
         return inst._dst == rd &&
-               inst._imm.value() == (imm << 12u) &&
+               inst._imm == (imm << 12u) &&
                inst._src1 == rs1 &&
                inst._type == IType::Alu &&
                inst._aluFunc == AluFunc::Add;
     }
 
+    bool isIllegal(const Instruction& inst)
+    {
+        return inst._type == IType::Trap && inst._imm == causeIllegalInstruction;
+    }
+
     class DataFixture: public ::testing::Test
     {
     public:
@@ -46,7 +51,7 @@ namespace units
 
         void SetUp() override
         {
-            instr = *_decoder.Decode(_data);
+            instr = _decoder.Decode(_data);
         }
 
         void SetUp(Word rd, Word imm)
@@ -75,7 +80,7 @@ namespace units
     {
         ASSERT_EQ(instr._dst, DEFAULT_RD);
         ASSERT_EQ(instr._aluFunc, AluFunc::Add);
-        ASSERT_EQ(instr._imm.value(), (DEFAULT_IMM << 12u));
+        ASSERT_EQ(instr._imm, (DEFAULT_IMM << 12u));
         ASSERT_EQ(instr._src1, DEFAULT_SRC1);
         ASSERT_EQ(instr._type, IType::Alu);
     }
@@ -105,4 +110,241 @@ namespace units
         SetUp(rd, imm);
         ASSERT_TRUE(checkLUIInstruction(imm, rd, DEFAULT_SRC1, instr));
     }
+
+    TEST(DecoderTest, TestDecoderMulDiv)
+    {
+        Decoder decoder;
+        ASSERT_EQ(decoder.Decode(0x002081b3)._aluFunc, AluFunc::Add);      // add x3, x1, x2
+        ASSERT_EQ(decoder.Decode(0x022081b3)._aluFunc, AluFunc::Mul);      // mul x3, x1, x2
+        ASSERT_EQ(decoder.Decode(0x0220c1b3)._aluFunc, AluFunc::Div);      // div x3, x1, x2
+
+        Instruction remu = decoder.Decode(0x0220f1b3);                      // remu x3, x1, x2
+        ASSERT_EQ(remu._aluFunc, AluFunc::Remu);
+        ASSERT_EQ(remu._dst, 3);
+        ASSERT_EQ(remu._src1, 1);
+        ASSERT_EQ(remu._src2, 2);
+        ASSERT_TRUE(remu.IsDiv());
+    }
+
+    TEST(DecoderTest, TestDecoderSubWord)
+    {
+        Decoder decoder;
+        Instruction lbu = decoder.Decode(0x40304183);                       // lbu x3, 0x403(x0)
+        ASSERT_EQ(lbu._type, IType::Ld);
+        ASSERT_EQ(lbu._flags, flagByte | flagUnsigned);
+        ASSERT_EQ(LoadLane(0x403, lbu._flags, 0x80000000), 0x80u);
+        ASSERT_EQ(LoadLane(0x403, flagByte, 0x80000000), 0xffffff80u);
+
+        Instruction sh = decoder.Decode(0x40001123);                        // sh x0, 0x402(x0)
+        ASSERT_EQ(sh._type, IType::St);
+        ASSERT_EQ(sh._flags, flagHalf);
+        ASSERT_EQ(AccessMask(0x402, sh._flags), 0xffff0000u);
+    }
+
+    TEST(DecoderTest, TestDecoderSystem)
+    {
+        Decoder decoder;
+        Instruction ecall = decoder.Decode(instrECALL);
+        ASSERT_EQ(ecall._type, IType::Trap);
+        ASSERT_EQ(ecall._imm, causeMachineEcall);
+        ASSERT_EQ(decoder.Decode(instrEBREAK)._imm, causeBreakpoint);
+        ASSERT_EQ(decoder.Decode(instrMRET)._type, IType::Mret);
+        ASSERT_EQ(decoder.Decode(instrERET)._type, IType::Mret);
+        ASSERT_EQ(decoder.Decode(instrWFI)._type, IType::Wfi);
+        ASSERT_EQ(decoder.Decode(0x0ff0000f)._type, IType::Alu);           // fence
+        ASSERT_EQ(decoder.Decode(0x0000100f)._dst, 0);                      // fence.i
+        ASSERT_TRUE(isIllegal(decoder.Decode(0x30204073)));                 // funct3 = 100 is reserved
+    }
+
+    TEST(DecoderTest, TestDecoderCsr)
+    {
+        Decoder decoder;
+        Instruction csrr = decoder.Decode(0x300022f3);                      // csrr x5, mstatus
+        ASSERT_EQ(csrr._type, IType::Csrr);
+        ASSERT_EQ(csrr._dst, 5);
+        ASSERT_EQ(csrr.Csr(), CsrIdx::Mstatus);
+        ASSERT_EQ(decoder.Decode(0x30002373)._type, IType::Csrr);           // csrrs x6, mstatus, x0
+        ASSERT_EQ(decoder.Decode(0x304073f3)._type, IType::Csrr);           // csrrci x7, mie, 0
+        ASSERT_EQ(decoder.Decode(0x30029073)._type, IType::Csrw);           // csrw mstatus, x5
+
+        Instruction csrwi = decoder.Decode(0x30045073);                     // csrwi mstatus, 8
+        ASSERT_EQ(csrwi._type, IType::Csrw);
+        ASSERT_EQ(csrwi.Csr(), CsrIdx::Mstatus);
+        ASSERT_EQ(csrwi.CsrOperand(), 8u);
+
+        Instruction csrs = decoder.Decode(0x3002a073);                      // csrs mstatus, x5
+        ASSERT_EQ(csrs._type, IType::Csrrw);
+        ASSERT_EQ(csrs._aluFunc, AluFunc::Or);
+        ASSERT_EQ(csrs._src1, 5);
+        ASSERT_EQ(csrs._dst, 0);
+
+        Instruction swap = decoder.Decode(0x34011173);                      // csrrw sp, mscratch, sp
+        ASSERT_EQ(swap._type, IType::Csrrw);
+        ASSERT_EQ(swap._aluFunc, AluFunc::Swap);
+        ASSERT_EQ(swap._dst, 2);
+        ASSERT_EQ(swap._src1, 2);
+        ASSERT_EQ(swap.Csr(), CsrIdx::Mscratch);
+
+        Instruction csrsi = decoder.Decode(0x30046073);                     // csrsi mstatus, 8
+        ASSERT_EQ(csrsi._type, IType::Csrrw);
+        ASSERT_EQ(csrsi._src1, 0);
+        ASSERT_EQ(csrsi.Csr(), CsrIdx::Mstatus);
+        ASSERT_EQ(csrsi.CsrOperand(), 8u);
+        ASSERT_EQ(decoder.Decode(0x3002b073)._aluFunc, AluFunc::And);       // csrc mstatus, x5
+
+        ASSERT_EQ(CsrValue(AluFunc::Swap, 0xf0, 0x3c), 0x3cu);
+        ASSERT_EQ(CsrValue(AluFunc::Or, 0xf0, 0x3c), 0xfcu);
+        ASSERT_EQ(CsrValue(AluFunc::And, 0xf0, 0x3c), 0xc0u);
+    }
+
+    TEST(DecoderTest, TestDecoderAtomics)
+    {
+        Decoder decoder;
+        Instruction amo = decoder.Decode(0xe020a1af);                       // amomaxu.w x3, x2, (x1)
+        ASSERT_EQ(amo._type, IType::Amo);
+        ASSERT_EQ(amo._aluFunc, AluFunc::Maxu);
+        ASSERT_EQ(amo._dst, 3);
+        ASSERT_EQ(amo._src1, 1);
+        ASSERT_EQ(amo._src2, 2);
+        ASSERT_EQ(AmoValue(amo._aluFunc, 7, 0xffffffff), 0xffffffffu);
+
+        Instruction lr = decoder.Decode(0x1000a1af);                        // lr.w x3, (x1)
+        ASSERT_EQ(lr._type, IType::Lr);
+        ASSERT_EQ(lr._src2, 0);
+        ASSERT_EQ(decoder.Decode(0x1820a22f)._type, IType::Sc);             // sc.w x4, x2, (x1)
+    }
+
+    TEST(DecoderTest, TestDecoderVector)
+    {
+        Decoder decoder;
+        Instruction vset = decoder.Decode(0x0d00f1d7);                      // vsetvli x3, x1, e32, m1, ta, ma
+        ASSERT_EQ(vset._type, IType::Vset);
+        ASSERT_EQ(vset._dst, 3);
+        ASSERT_EQ(vset._src1, 1);
+        ASSERT_EQ(vset._imm, 0xd0u);
+
+        Instruction vmul = decoder.Decode(0x9633a0d7);                      // vmul.vv v1, v3, v7
+        ASSERT_EQ(vmul._type, IType::Valu);
+        ASSERT_EQ(vmul._aluFunc, AluFunc::Mul);
+        ASSERT_EQ(vmul.Vd(), 1);
+        ASSERT_EQ(vmul.Vs1(), 7);
+        ASSERT_EQ(vmul.Vs2(), 3);
+
+        Instruction vaddi = decoder.Decode(0x023fb0d7);                     // vadd.vi v1, v3, -1
+        ASSERT_EQ(vaddi._flags, flagImm);
+        ASSERT_EQ(vaddi.VImm(), Word(-1));
+        ASSERT_EQ(decoder.Decode(0x0220a0d7)._flags, flagReduce);           // vredsum.vs v1, v2, v1
+
+        Instruction vlse = decoder.Decode(0x0a946207);                      // vlse32.v v4, (x8), x9
+        ASSERT_EQ(vlse._type, IType::Vld);
+        ASSERT_EQ(vlse._flags, flagStrided);
+        ASSERT_EQ(vlse._src1, 8);
+        ASSERT_EQ(vlse._src2, 9);
+        ASSERT_EQ(vlse.Vd(), 4);
+        ASSERT_EQ(decoder.Decode(0x020160a7)._type, IType::Vst);            // vse32.v v1, (x2)
+
+        ASSERT_TRUE(isIllegal(decoder.Decode(0x003380d7)));                 // vadd.vv v1, v3, v7, v0.t
+    }
+
+    TEST(DecoderTest, TestDecoderFloat)
+    {
+        Decoder decoder;
+        Instruction flw = decoder.Decode(0x00812087);                       // flw f1, 8(x2)
+        ASSERT_EQ(flw._type, IType::Ld);
+        ASSERT_EQ(flw._dst, fpRegBase + 1);
+        ASSERT_EQ(flw._src1, 2);
+        ASSERT_EQ(flw._imm, 8u);
+
+        Instruction fsw = decoder.Decode(0xfe32ae27);                       // fsw f3, -4(x5)
+        ASSERT_EQ(fsw._type, IType::St);
+        ASSERT_EQ(fsw._src2, fpRegBase + 3);
+        ASSERT_EQ(fsw._imm, Word(-4));
+
+        Instruction fadd = decoder.Decode(0x003170d3);                      // fadd.s f1, f2, f3
+        ASSERT_EQ(fadd._type, IType::Fpu);
+        ASSERT_EQ(fadd._aluFunc, AluFunc::FAdd);
+        ASSERT_EQ(fadd._dst, fpRegBase + 1);
+        ASSERT_EQ(fadd._src2, fpRegBase + 3);
+        ASSERT_EQ(fadd.Rm(), uint8_t(RoundingMode::Dyn));
+
+        Instruction fnmadd = decoder.Decode(0x3862f24f);                    // fnmadd.s f4, f5, f6, f7
+        ASSERT_EQ(fnmadd._aluFunc, AluFunc::FNmadd);
+        ASSERT_EQ(fnmadd.Src3(), fpRegBase + 7);
+
+        Instruction fcvt = decoder.Decode(0xc0009553);                      // fcvt.w.s x10, f1, rtz
+        ASSERT_EQ(fcvt._aluFunc, AluFunc::FCvtWS);
+        ASSERT_EQ(fcvt._dst, 10);
+        ASSERT_EQ(fcvt._src1, fpRegBase + 1);
+        ASSERT_EQ(fcvt._src2, 0);
+        ASSERT_EQ(fcvt.Rm(), uint8_t(RoundingMode::Rtz));
+
+        Instruction fmv = decoder.Decode(0xf00500d3);                       // fmv.w.x f1, x10
+        ASSERT_EQ(fmv._aluFunc, AluFunc::FMvWX);
+        ASSERT_EQ(fmv._dst, fpRegBase + 1);
+        ASSERT_EQ(fmv._src1, 10);
+        ASSERT_EQ(decoder.Decode(0xa020a553)._aluFunc, AluFunc::FEq);       // feq.s x10, f1, f2
+        ASSERT_EQ(decoder.Decode(0xe0009553)._aluFunc, AluFunc::FClass);    // fclass.s x10, f1
+
+        ASSERT_TRUE(isIllegal(decoder.Decode(0x003150d3)));                 // fadd.s f1, f2, f3 with rm = 101
+        ASSERT_TRUE(isIllegal(decoder.Decode(0x023170d3)));                 // fadd.d f1, f2, f3
+    }
+
+    TEST(DecoderTest, TestDecoderCompressed)
+    {
+        Decoder decoder;
+        Instruction addi = decoder.Decode(0xdead157d);                      // c.addi x10, -1, the upper half is the next one
+        ASSERT_EQ(addi._type, IType::Alu);
+        ASSERT_EQ(addi._aluFunc, AluFunc::Add);
+        ASSERT_EQ(addi._dst, 10);
+        ASSERT_EQ(addi._src1, 10);
+        ASSERT_EQ(addi._imm, Word(-1));
+        ASSERT_EQ(addi._flags, flagImm | flagCompressed);
+        ASSERT_EQ(addi.Length(), 2u);
+        ASSERT_EQ(decoder.Decode(0x00a00513).Length(), 4u);                 // addi x10, x0, 10
+
+        Instruction lw = decoder.Decode(0x41c8);                            // c.lw x10, 4(x11)
+        ASSERT_EQ(lw._type, IType::Ld);
+        ASSERT_EQ(lw._dst, 10);
+        ASSERT_EQ(lw._src1, 11);
+        ASSERT_EQ(lw._imm, 4u);
+        ASSERT_EQ(AccessSize(lw._flags), 4u);
+
+        Instruction fswsp = decoder.Decode(0xe40e);                         // c.fswsp f3, 8(x2)
+        ASSERT_EQ(fswsp._type, IType::St);
+        ASSERT_EQ(fswsp._src1, 2);
+        ASSERT_EQ(fswsp._src2, fpRegBase + 3);
+        ASSERT_EQ(fswsp._imm, 8u);
+
+        Instruction sub = decoder.Decode(0x8c1d);                           // c.sub x8, x15
+        ASSERT_EQ(sub._aluFunc, AluFunc::Sub);
+        ASSERT_EQ(sub._dst, 8);
+        ASSERT_EQ(sub._src2, 15);
+
+        Instruction beqz = decoder.Decode(0xdce5);                          // c.beqz x9, -8
+        ASSERT_EQ(beqz._type, IType::Br);
+        ASSERT_EQ(beqz._brFunc, BrFunc::Eq);
+        ASSERT_EQ(beqz._src1, 9);
+        ASSERT_EQ(beqz._src2, 0);
+        ASSERT_EQ(beqz._imm, Word(-8));
+
+        Instruction jalr = decoder.Decode(0x9602);                          // c.jalr x12
+        ASSERT_EQ(jalr._type, IType::Jr);
+        ASSERT_EQ(jalr._dst, 1);
+        ASSERT_EQ(jalr._src1, 12);
+        Word ip = 0x100;
+        jalr._src1Val = 0x200;
+        ASSERT_EQ(Executor::Execute(jalr, ip), 0x200u);
+        ASSERT_EQ(jalr._data, 0x102u);
+
+        Instruction srai = decoder.Decode(0x8695);                          // c.srai x13, 5
+        ASSERT_EQ(srai._aluFunc, AluFunc::Sra);
+        ASSERT_EQ(srai._imm, 5u);
+        ASSERT_EQ(decoder.Decode(0x7139)._imm, Word(-64));                  // c.addi16sp -64
+        ASSERT_EQ(decoder.Decode(0x7705)._imm, 0xfffe1000u);                // c.lui x14, 0xfffe1
+        ASSERT_EQ(decoder.Decode(0x9002)._imm, causeBreakpoint);            // c.ebreak
+
+        ASSERT_TRUE(isIllegal(decoder.Decode(0x2500)));                     // c.fld f8, 8(x10)
+        ASSERT_TRUE(isIllegal(decoder.Decode(0x0000)));
+        ASSERT_EQ(decoder.Decode(0x0000).Length(), 2u);
+    }
 }
@@ -1,13 +1,11 @@
 #include <gtest/gtest.h>
 
-#include <Instruction.cpp>
 #include <Instruction.h>
 #include <BaseTypes.h>
 #include <Executor.h>
 
 namespace units
 {
-    static const Word DEFAULT_ADDRESS = 0b1000;
     static const Word DEFAULT_SRC1VAL = 0;
     static const Word DEFAULT_IP = 0b0100;
     static const Word DEFAULT_SRC1 = 0;
@@ -20,57 +18,150 @@ namespace units
 
         InstructionFixture()
         {
-            instruction = std::make_unique<Instruction>();
-            instruction->_type = IType::Alu;
-            instruction->_aluFunc = AluFunc::Add;
-            instruction->_addr = DEFAULT_ADDRESS;
-            instruction->_src1 = DEFAULT_SRC1;
-            instruction->_src1Val = DEFAULT_SRC1VAL;
-            instruction->_imm = DEFAULT_IMM;
+            instruction = Instruction();
+            instruction._type = IType::Alu;
+            instruction._aluFunc = AluFunc::Add;
+            instruction._flags = flagImm;
+            instruction._src1 = DEFAULT_SRC1;
+            instruction._src1Val = DEFAULT_SRC1VAL;
+            instruction._imm = DEFAULT_IMM;
+            instruction._op = Executor::HandlerIndex(instruction);
         }
 
         void SetUp() override
         {
-            Executor::Execute(instruction, DEFAULT_IP);
+            nextIp = Executor::Execute(instruction, DEFAULT_IP);
         }
 
-        void SetUp(Word imm, Word ip, Word addr)
+        void SetUp(Word imm, Word ip)
         {
-            instruction = std::make_unique<Instruction>();
-            instruction->_type = IType::Alu;
-            instruction->_aluFunc = AluFunc::Add;
-            instruction->_addr = addr;
-            instruction->_src1 = DEFAULT_SRC1;
-            instruction->_src1Val = DEFAULT_SRC1VAL;
-            instruction->_imm = imm;
-
-            Executor::Execute(instruction, DEFAULT_IP);
+            instruction = Instruction();
+            instruction._type = IType::Alu;
+            instruction._aluFunc = AluFunc::Add;
+            instruction._flags = flagImm;
+            instruction._src1 = DEFAULT_SRC1;
+            instruction._src1Val = DEFAULT_SRC1VAL;
+            instruction._imm = imm;
+            instruction._op = Executor::HandlerIndex(instruction);
+
+            nextIp = Executor::Execute(instruction, ip);
         }
 
         void TearDown() override
         {
-            instruction.reset();
         }
 
-        InstructionPtr instruction;
+        Instruction instruction;
+        Word nextIp = 0;
     };
 
 
     TEST_F(InstructionFixture, TestExecutorLUI1)
     {
-        ASSERT_EQ(instruction->_data, DEFAULT_IMM);
-        ASSERT_EQ(instruction->_nextIp, DEFAULT_IP + 4);
-        ASSERT_EQ(instruction->_addr, DEFAULT_ADDRESS);
+        ASSERT_EQ(instruction._data, DEFAULT_IMM);
+        ASSERT_EQ(nextIp, DEFAULT_IP + 4);
+        ASSERT_EQ(instruction._src1Val, DEFAULT_SRC1VAL);
     }
 
     TEST_F(InstructionFixture, TestExecutorLUI2)
     {
-        Word ip = 0b0001, addr = 0b1001, imm = 0b00000000000000000000;
+        Word ip = 0b0001, imm = 0b00000000000000000000;
+
+        SetUp(imm, ip);
+
+        ASSERT_EQ(instruction._data, imm);
+        ASSERT_EQ(nextIp, ip + 4);
+        ASSERT_EQ(instruction._src1Val, DEFAULT_SRC1VAL);
+    }
+
+    static Word ExecuteMulDiv(AluFunc func, Word a, Word b)
+    {
+        Instruction instr;
+        instr._type = IType::Alu;
+        instr._aluFunc = func;
+        instr._src1Val = a;
+        instr._src2Val = b;
+        instr._op = Executor::HandlerIndex(instr);
+        Executor::Execute(instr, DEFAULT_IP);
+        return instr._data;
+    }
+
+    TEST(ExecutorTest, TestExecutorMulDiv)
+    {
+        ASSERT_EQ(ExecuteMulDiv(AluFunc::Mul, Word(-3), 7), Word(-21));
+        ASSERT_EQ(ExecuteMulDiv(AluFunc::Mulh, Word(-1), Word(-1)), 0u);
+        ASSERT_EQ(ExecuteMulDiv(AluFunc::Mulhsu, Word(-1), Word(-1)), Word(-1));
+        ASSERT_EQ(ExecuteMulDiv(AluFunc::Mulhu, Word(-1), Word(-1)), Word(-2));
+        ASSERT_EQ(ExecuteMulDiv(AluFunc::Div, Word(-7), 2), Word(-3));
+        ASSERT_EQ(ExecuteMulDiv(AluFunc::Rem, Word(-7), 2), Word(-1));
+        ASSERT_EQ(ExecuteMulDiv(AluFunc::Divu, 7, 2), 3u);
+        ASSERT_EQ(ExecuteMulDiv(AluFunc::Remu, 7, 2), 1u);
+
+        // No traps: division by zero and overflow have fixed results
+        ASSERT_EQ(ExecuteMulDiv(AluFunc::Div, 5, 0), Word(-1));
+        ASSERT_EQ(ExecuteMulDiv(AluFunc::Rem, 5, 0), 5u);
+        ASSERT_EQ(ExecuteMulDiv(AluFunc::Div, 0x80000000, Word(-1)), 0x80000000u);
+        ASSERT_EQ(ExecuteMulDiv(AluFunc::Rem, 0x80000000, Word(-1)), 0u);
+    }
+
+    TEST(ExecutorTest, TestExecutorFloat)
+    {
+        auto execute = [](AluFunc func, Word a, Word b, RoundingMode rm) {
+            Instruction instr;
+            instr._type = IType::Fpu;
+            instr._aluFunc = func;
+            instr._src1Val = a;
+            instr._src2Val = b;
+            instr._imm = Word(rm);
+            instr._op = Executor::HandlerIndex(instr);
+            Executor::Execute(instr, DEFAULT_IP);
+            return instr;
+        };
+
+        // 1 + 2^-24 is a tie, to even goes down, up goes to the next number
+        Instruction sum = execute(AluFunc::FAdd, 0x3f800000, 0x33800000, RoundingMode::Rne);
+        ASSERT_EQ(sum._data, 0x3f800000u);
+        ASSERT_EQ(sum.FpFlags(), fpInexact);
+        ASSERT_EQ(execute(AluFunc::FAdd, 0x3f800000, 0x33800000, RoundingMode::Rup)._data, 0x3f800001u);
+        ASSERT_EQ(execute(AluFunc::FAdd, 0x3f800000, 0x33800000, RoundingMode::Rmm)._data, 0x3f800001u);
+        ASSERT_EQ(execute(AluFunc::FSub, 0x3f800000, 0x3f800000, RoundingMode::Rdn)._data, fpSign);
+
+        // 1 / 3
+        ASSERT_EQ(execute(AluFunc::FDiv, 0x3f800000, 0x40400000, RoundingMode::Rne)._data, 0x3eaaaaabu);
+        ASSERT_EQ(execute(AluFunc::FDiv, 0x3f800000, 0x40400000, RoundingMode::Rtz)._data, 0x3eaaaaaau);
+        Instruction inf = execute(AluFunc::FDiv, 0x3f800000, 0, RoundingMode::Rne);
+        ASSERT_EQ(inf._data, 0x7f800000u);
+        ASSERT_EQ(inf.FpFlags(), fpDivByZero);
 
-        SetUp(imm, ip, addr);
+        // Overflow rounds to the largest finite number towards zero
+        Instruction big = execute(AluFunc::FMul, 0x7f000000, 0x40000000, RoundingMode::Rtz);
+        ASSERT_EQ(big._data, 0x7f7fffffu);
+        ASSERT_EQ(big.FpFlags(), fpOverflow | fpInexact);
+
+        // NaNs are canonical, conversions saturate
+        ASSERT_EQ(execute(AluFunc::FSqrt, 0xbf800000, 0, RoundingMode::Rne)._data, fpCanonicalNan);
+        Instruction saturated = execute(AluFunc::FCvtWS, 0x4f800000, 0, RoundingMode::Rne);    // 2^32
+        ASSERT_EQ(saturated._data, 0x7fffffffu);
+        ASSERT_EQ(saturated.FpFlags(), fpInvalid);
+        ASSERT_EQ(execute(AluFunc::FCvtWS, 0xbfc00000, 0, RoundingMode::Rne)._data, Word(-2));  // -1.5
+        ASSERT_EQ(execute(AluFunc::FCvtWS, 0xbfc00000, 0, RoundingMode::Rtz)._data, Word(-1));
+
+        // -0 is less than +0, a quiet NaN is no operand of min
+        ASSERT_EQ(execute(AluFunc::FMin, 0, fpSign, RoundingMode::Rne)._data, fpSign);
+        ASSERT_EQ(execute(AluFunc::FMax, 0x7fc00000, 0x3f800000, RoundingMode::Rne)._data, 0x3f800000u);
+    }
+
+    // An instruction that was never decoded runs the handler of Unsupported, not ADD
+    TEST(ExecutorTest, TestUndecodedInstruction)
+    {
+        Instruction instr;
+        ASSERT_EQ(instr._op, Executor::HandlerIndex(instr));
 
-        ASSERT_EQ(instruction->_data, imm);
-        ASSERT_EQ(instruction->_nextIp, ip + 4);
-        ASSERT_EQ(instruction->_addr, addr);
+        instr._type = IType::Alu;
+        instr._aluFunc = AluFunc::Add;
+        instr._src1Val = 3;
+        instr._src2Val = 4;
+        ASSERT_EQ(Executor::Execute(instr, DEFAULT_IP), DEFAULT_IP + 4);
+        ASSERT_EQ(instr._data, 0u);
     }
 }
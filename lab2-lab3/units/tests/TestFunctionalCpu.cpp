@@ -0,0 +1,228 @@
+#include <gtest/gtest.h>
+
+#include <FunctionalCpu.h>
+#include <BaseTypes.h>
+
+namespace units
+{
+    static const Word FUNCTIONAL_CODE_IP = 0x200;
+
+    // The loop body is split by a jump, both blocks end up in one superblock.
+    // It starts with the loop branch, which leaves it through a side exit at the end.
+    static const std::vector<Word> SUM_LOOP = {
+            0x00000093,     // addi x1, x0, 0
+            0x06400113,     // addi x2, x0, 100
+            0x002080b3,     // loop: add x1, x1, x2
+            0x0080006f,     // j next
+            0x3e808093,     // addi x1, x1, 1000
+            0xfff10113,     // next: addi x2, x2, -1
+            0xfe0118e3,     // bne x2, x0, loop
+            0x78009073};    // csrw mtohost, x1
+
+    static void TestSuperblocks(bool useJit)
+    {
+        MemoryStorage storage;
+        for (size_t i = 0; i < SUM_LOOP.size(); i++)
+            storage.Write(FUNCTIONAL_CODE_IP + i * 4, SUM_LOOP[i]);
+
+        FunctionalCpu cpu{storage, useJit, true};
+        cpu.Reset(FUNCTIONAL_CODE_IP);
+        size_t executed = cpu.Run(10000);
+
+        auto msg = cpu.GetMessage();
+        ASSERT_TRUE(msg.has_value());
+        ASSERT_EQ(msg->payload, 5050u);
+        ASSERT_EQ(executed, 2u + 100u * 4u + 1u);
+        ASSERT_EQ(cpu.GetStats().superblocks, 1u);
+        ASSERT_GT(cpu.GetStats().superblockInstructions, 0u);
+        ASSERT_EQ(cpu.GetStats().sideExits, 1u);
+    }
+
+    TEST(FunctionalCpuTest, TestSuperblockInterpreted)
+    {
+        TestSuperblocks(false);
+    }
+
+    TEST(FunctionalCpuTest, TestSuperblockJit)
+    {
+        TestSuperblocks(true);
+    }
+
+    static const Word TRAP_HANDLER_IP = 0x300;
+
+    // The handler reports mcause to the host
+    static const std::vector<Word> TRAP_HANDLER = {
+            0x34202173,     // csrr x2, mcause
+            0x78011073};    // csrw mtohost, x2
+
+    static Word RunWithHandler(const std::vector<Word>& program, Clint& clint)
+    {
+        MemoryStorage storage;
+        for (size_t i = 0; i < program.size(); i++)
+            storage.Write(FUNCTIONAL_CODE_IP + i * 4, program[i]);
+        for (size_t i = 0; i < TRAP_HANDLER.size(); i++)
+            storage.Write(TRAP_HANDLER_IP + i * 4, TRAP_HANDLER[i]);
+
+        FunctionalCpu cpu{storage};
+        cpu.Reset(FUNCTIONAL_CODE_IP);
+        cpu.SetClint(&clint);
+        cpu.Run(10000);
+
+        auto msg = cpu.GetMessage();
+        EXPECT_TRUE(msg.has_value());
+        return msg ? msg->payload : 0;
+    }
+
+    TEST(FunctionalCpuTest, TestEcall)
+    {
+        Clint clint;
+        Word cause = RunWithHandler({
+                0x30000093,     // addi x1, x0, 0x300
+                0x30509073,     // csrw mtvec, x1
+                0x00000073,     // ecall
+                0x78001073},    // csrw mtohost, x0
+                clint);
+        ASSERT_EQ(cause, causeMachineEcall);
+    }
+
+    // WFI moves the timer straight to mtimecmp
+    TEST(FunctionalCpuTest, TestTimerInterrupt)
+    {
+        Clint clint;
+        Word cause = RunWithHandler({
+                0x30000093,     // addi x1, x0, 0x300
+                0x30509073,     // csrw mtvec, x1
+                0x020041b7,     // lui x3, 0x2004 (mtimecmp)
+                0x03200213,     // addi x4, x0, 50
+                0x0041a023,     // sw x4, 0(x3)
+                0x0001a223,     // sw x0, 4(x3)
+                0x08000293,     // addi x5, x0, 0x80 (MTIE)
+                0x30429073,     // csrw mie, x5
+                0x00800293,     // addi x5, x0, 8 (MIE)
+                0x30029073,     // csrw mstatus, x5
+                0x10500073,     // wfi
+                0x0000006f},    // j .
+                clint);
+        ASSERT_EQ(cause, causeMachineTimer);
+        ASSERT_EQ(clint.Time(), 50u + TRAP_HANDLER.size());
+    }
+
+    // The swap returns the old value, the immediate clear takes the uimm field, not x0
+    TEST(FunctionalCpuTest, TestCsrReadModifyWrite)
+    {
+        const std::vector<Word> program = {
+                0x00500113,     // addi x2, x0, 5
+                0x34011073,     // csrw mscratch, x2
+                0x00700113,     // addi x2, x0, 7
+                0x34011173,     // csrrw x2, mscratch, x2: 5
+                0x340021f3,     // csrr x3, mscratch: 7
+                0x3401f273,     // csrrci x4, mscratch, 3: 7
+                0x340022f3,     // csrr x5, mscratch: 4
+                0x00419193,     // slli x3, x3, 4
+                0x00821213,     // slli x4, x4, 8
+                0x00c29293,     // slli x5, x5, 12
+                0x00310133,     // add x2, x2, x3
+                0x00410133,     // add x2, x2, x4
+                0x00510133,     // add x2, x2, x5
+                0x78011073};    // csrw mtohost, x2
+        MemoryStorage storage;
+        for (size_t i = 0; i < program.size(); i++)
+            storage.Write(FUNCTIONAL_CODE_IP + i * 4, program[i]);
+
+        FunctionalCpu cpu{storage};
+        cpu.Reset(FUNCTIONAL_CODE_IP);
+        cpu.Run(10000);
+
+        auto msg = cpu.GetMessage();
+        ASSERT_TRUE(msg.has_value());
+        ASSERT_EQ(msg->payload, 0x4775u);
+    }
+
+    TEST(FunctionalCpuTest, TestIllegalInstruction)
+    {
+        Clint clint;
+        Word cause = RunWithHandler({
+                0x30000093,     // addi x1, x0, 0x300
+                0x30509073,     // csrw mtvec, x1
+                0xffffffff,     // illegal
+                0x78001073},    // csrw mtohost, x0
+                clint);
+        ASSERT_EQ(cause, causeIllegalInstruction);
+    }
+
+    // Blocks end at control transfers, the block that has run links its successors
+    TEST(FunctionalCpuTest, TestBlockChaining)
+    {
+        MemoryStorage storage;
+        for (size_t i = 0; i < SUM_LOOP.size(); i++)
+            storage.Write(FUNCTIONAL_CODE_IP + i * 4, SUM_LOOP[i]);
+        BlockCache blocks{storage};
+
+        BasicBlock* entry = blocks.Lookup(FUNCTIONAL_CODE_IP);
+        ASSERT_EQ(entry->ops.size(), 4u);                          // up to j next
+        ASSERT_EQ(blocks.Lookup(FUNCTIONAL_CODE_IP), entry);
+
+        BasicBlock* next = blocks.Next(entry, FUNCTIONAL_CODE_IP + 0x14);
+        ASSERT_EQ(next->ops.size(), 2u);                           // addi, bne
+        ASSERT_EQ(entry->successors[0], next);
+
+        // The loop body starts within the entry block, so it is a block of its own
+        BasicBlock* loop = blocks.Next(next, FUNCTIONAL_CODE_IP + 8);
+        ASSERT_NE(loop, entry);
+        ASSERT_EQ(loop->ops.size(), 2u);
+        ASSERT_EQ(blocks.Next(next, FUNCTIONAL_CODE_IP + 8), loop);
+        ASSERT_EQ(next->exits[0], 2u);
+
+        BasicBlock* exit = blocks.Next(next, FUNCTIONAL_CODE_IP + 0x1c);
+        ASSERT_EQ(next->successors[1], exit);
+        ASSERT_EQ(next->successors[0], loop);
+
+        // Without superblocks every block and every chained successor is a dispatch
+        FunctionalCpu cpu{storage};
+        cpu.Reset(FUNCTIONAL_CODE_IP);
+        cpu.Run(10000);
+        auto msg = cpu.GetMessage();
+        ASSERT_TRUE(msg.has_value());
+        ASSERT_EQ(msg->payload, 5050u);
+        ASSERT_EQ(cpu.GetStats().dispatches, 2u + 99u * 2u + 1u);
+    }
+
+    // A translated block runs natively, stores and loads go to the memory storage
+    TEST(FunctionalCpuTest, TestJitTranslation)
+    {
+        MemoryStorage storage;
+        const std::vector<Word> block = {
+                0x00500093,     // addi x1, x0, 5
+                0x12345137,     // lui x2, 0x12345
+                0x40102023,     // sw x1, 0x400(x0)
+                0x40002183,     // lw x3, 0x400(x0)
+                0x00308233,     // add x4, x1, x3
+                0x401102b3,     // sub x5, x2, x1
+                0x00021863};    // bne x4, x0, 16
+        for (size_t i = 0; i < block.size(); i++)
+            storage.Write(FUNCTIONAL_CODE_IP + i * 4, block[i]);
+        storage.Write(FUNCTIONAL_CODE_IP + 0x40, 0x02208033);      // mul x0, x1, x2
+        storage.Write(FUNCTIONAL_CODE_IP + 0x44, 0x0000006f);      // j .
+        storage.Write(FUNCTIONAL_CODE_IP + 0x80, 0x78009073);      // csrw mtohost, x1
+
+        BlockCache blocks{storage};
+        Jit jit;
+        JitFunc native = jit.Compile(*blocks.Lookup(FUNCTIONAL_CODE_IP));
+        if (native == nullptr)
+            GTEST_SKIP() << "no JIT on this host";
+
+        RegisterFile rf;
+        JitContext ctx{&storage, &blocks, nullptr, 0, false};
+        ASSERT_EQ(native(rf.Data(), &ctx), FUNCTIONAL_CODE_IP + 24 + 16);
+        ASSERT_EQ(ctx.executed, block.size());
+        ASSERT_FALSE(ctx.codeModified);
+        ASSERT_EQ(storage.Read(0x400), 5u);
+        ASSERT_EQ(rf.Data()[3], 5u);
+        ASSERT_EQ(rf.Data()[4], 10u);
+        ASSERT_EQ(rf.Data()[5], 0x12345000u - 5u);
+
+        // Multiplications and CSR accesses are left to the interpreter
+        ASSERT_EQ(jit.Compile(*blocks.Lookup(FUNCTIONAL_CODE_IP + 0x40)), nullptr);
+        ASSERT_EQ(jit.Compile(*blocks.Lookup(FUNCTIONAL_CODE_IP + 0x80)), nullptr);
+    }
+}
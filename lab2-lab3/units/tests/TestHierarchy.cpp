@@ -0,0 +1,107 @@
+#include <gtest/gtest.h>
+
+#include <Memory.h>
+#include <BaseTypes.h>
+
+namespace units
+{
+    static const Word LINE_A = 0x2000;
+    static const size_t L2_LATENCY = 10;
+
+    // Fully associative L2 caches of 16, 8 and 2 lines
+    static const CacheConfig BIG_L2{2048, 0, lineSizeBytes, L2_LATENCY};
+    static const CacheConfig L2{1024, 0, lineSizeBytes, L2_LATENCY};
+    static const CacheConfig TINY_L2{256, 0, lineSizeBytes, L2_LATENCY};
+
+    // A miss in the L2 takes both latencies, a line another cache has brought in only the L2 one
+    TEST(HierarchyTest, TestSharedL2)
+    {
+        MemoryStorage storage;
+        MainMemory memory{storage};
+        CacheLevel l2{L2, Inclusion::Nine, memory};
+        CashMemoryStorage first{storage, nullptr, codeCacheConfig, dataCacheConfig, &l2};
+        CashMemoryStorage second{storage, nullptr, codeCacheConfig, dataCacheConfig, &l2};
+
+        ASSERT_EQ(first.LoadInstruction(LINE_A).second, L2_LATENCY + memoryLatency);
+        ASSERT_EQ(second.LoadInstruction(LINE_A).second, L2_LATENCY);
+        ASSERT_EQ(first.ReadInstruction(LINE_A).second, L2_LATENCY);      // the L2 holds code and data
+        ASSERT_EQ(first.LoadInstruction(LINE_A).second, 0u);
+        ASSERT_EQ(l2.GetStats().hits, 2u);
+        ASSERT_EQ(l2.GetStats().misses, 1u);
+    }
+
+    // A dirty line replaced in the L1 stays in a NINE L2, the memory gets it later
+    TEST(HierarchyTest, TestNineWriteback)
+    {
+        MemoryStorage storage;
+        MainMemory memory{storage};
+        CacheLevel l2{BIG_L2, Inclusion::Nine, memory};
+        CashMemoryStorage first{storage, nullptr, codeCacheConfig, dataCacheConfig, &l2};
+        CashMemoryStorage second{storage, nullptr, codeCacheConfig, dataCacheConfig, &l2};
+
+        first.StoreInstruction(LINE_A, 5);
+        for (Word i = 1; i <= dataCacheSizeLines; i++)
+            first.LoadInstruction(LINE_A + i * lineSizeBytes);
+        ASSERT_EQ(storage.Read(LINE_A), 0u);
+
+        auto reload = second.LoadInstruction(LINE_A);
+        ASSERT_EQ(reload.first, 5u);
+        ASSERT_EQ(reload.second, L2_LATENCY);
+    }
+
+    // Replacing a line in an inclusive L2 takes it from the L1 too, with its dirty data
+    TEST(HierarchyTest, TestInclusiveBackInvalidation)
+    {
+        MemoryStorage storage;
+        MainMemory memory{storage};
+        CacheLevel l2{TINY_L2, Inclusion::Inclusive, memory};
+        CashMemoryStorage cache{storage, nullptr, codeCacheConfig, dataCacheConfig, &l2};
+
+        cache.StoreInstruction(LINE_A, 5);
+        cache.LoadInstruction(LINE_A + lineSizeBytes);
+        cache.LoadInstruction(LINE_A + 2 * lineSizeBytes);
+        ASSERT_EQ(storage.Read(LINE_A), 5u);
+        ASSERT_EQ(l2.GetStats().backInvalidations, 1u);
+        ASSERT_EQ(l2.GetStats().writebacks, 1u);
+
+        auto reload = cache.LoadInstruction(LINE_A);
+        ASSERT_EQ(reload.first, 5u);
+        ASSERT_EQ(reload.second, L2_LATENCY + memoryLatency);
+        ASSERT_EQ(cache.GetCoherenceStats().coherenceMisses, 0u);
+    }
+
+    // A line moves up out of an exclusive L2 and comes back when the L1 replaces it
+    TEST(HierarchyTest, TestExclusive)
+    {
+        MemoryStorage storage;
+        MainMemory memory{storage};
+        CacheLevel l2{L2, Inclusion::Exclusive, memory};
+        CashMemoryStorage first{storage, nullptr, codeCacheConfig, dataCacheConfig, &l2};
+        CashMemoryStorage second{storage, nullptr, codeCacheConfig, dataCacheConfig, &l2};
+
+        ASSERT_EQ(first.LoadInstruction(LINE_A).second, L2_LATENCY + memoryLatency);
+        for (Word i = 1; i <= dataCacheSizeLines; i++)
+            first.LoadInstruction(LINE_A + i * lineSizeBytes);
+
+        ASSERT_EQ(second.LoadInstruction(LINE_A).second, L2_LATENCY);
+        ASSERT_EQ(first.LoadInstruction(LINE_A).second, L2_LATENCY + memoryLatency);
+    }
+
+    // A snoop flush goes to the shared L2, the other hart reads the new data from there
+    TEST(HierarchyTest, TestCoherentL2)
+    {
+        MemoryStorage storage;
+        MainMemory memory{storage};
+        CacheLevel l2{L2, Inclusion::Inclusive, memory};
+        CoherenceBus bus;
+        CashMemoryStorage first{storage, &bus, codeCacheConfig, dataCacheConfig, &l2};
+        CashMemoryStorage second{storage, &bus, codeCacheConfig, dataCacheConfig, &l2};
+
+        first.StoreInstruction(LINE_A, 7);
+        auto load = second.LoadInstruction(LINE_A);
+        ASSERT_EQ(load.first, 7u);
+        ASSERT_EQ(load.second, L2_LATENCY);
+        ASSERT_EQ(storage.Read(LINE_A), 0u);
+        ASSERT_EQ(first.GetCoherenceStats().snoopFlushes, 1u);
+    }
+}
@@ -0,0 +1,209 @@
+#include <gtest/gtest.h>
+
+#include <OooCpu.h>
+#include <BaseTypes.h>
+
+namespace units
+{
+    static const Word OOO_CODE_IP     = 0x200;
+    static const size_t OOO_MAX_CYCLES = 10000;
+
+    class OooCpuTest : public ::testing::Test
+    {
+    protected:
+        MemoryStorage _storage;
+        CachedMem _mem{_storage, OooConfig().dataPorts};
+        BhtPredictor _bpred;
+        OooCpu _cpu{_mem, _bpred};
+
+        void Load(const std::vector<Word>& program)
+        {
+            for (size_t i = 0; i < program.size(); i++)
+                _storage.Write(OOO_CODE_IP + i * 4, program[i]);
+            _cpu.Reset(OOO_CODE_IP);
+        }
+
+        // Runs until the first message for the host
+        Word Run()
+        {
+            for (size_t cycle = 0; cycle < OOO_MAX_CYCLES; cycle++)
+            {
+                _cpu.Clock();
+                _mem.Clock();
+                if (auto msg = _cpu.GetMessage())
+                    return msg.value().payload;
+            }
+            ADD_FAILURE() << "no message from the program";
+            return 0;
+        }
+    };
+
+    TEST_F(OooCpuTest, TestDependencies)
+    {
+        Load({0x00500093,       // addi x1, x0, 5
+              0x00308113,       // addi x2, x1, 3
+              0x78011073});     // csrw mtohost, x2
+        ASSERT_EQ(Run(), 8u);
+        ASSERT_EQ(_cpu.GetStats().committed, 3u);
+    }
+
+    TEST_F(OooCpuTest, TestStoreToLoadForwarding)
+    {
+        Load({0x00900093,       // addi x1, x0, 9
+              0x40102023,       // sw x1, 0x400(x0)
+              0x40002103,       // lw x2, 0x400(x0)
+              0x00110193,       // addi x3, x2, 1
+              0x78019073});     // csrw mtohost, x3
+        ASSERT_EQ(Run(), 10u);
+        ASSERT_EQ(_cpu.GetStats().forwardedLoads, 1u);
+    }
+
+    TEST_F(OooCpuTest, TestMispredictSquashes)
+    {
+        Load({0x00100093,       // addi x1, x0, 1
+              0x00000463,       // beq x0, x0, 8
+              0x00200093,       // addi x1, x0, 2
+              0x78009073});     // csrw mtohost, x1
+        ASSERT_EQ(Run(), 1u);
+        ASSERT_EQ(_cpu.GetStats().mispredicts, 1u);
+    }
+
+    TEST_F(OooCpuTest, TestPartialForwarding)
+    {
+        Load({0xffe00093,       // addi x1, x0, -2
+              0x40102023,       // sw x1, 0x400(x0)
+              0x400000a3,       // sb x0, 0x401(x0)
+              0x40001103,       // lh x2, 0x400(x0): waits for both stores to drain
+              0x40304183,       // lbu x3, 0x403(x0): forwarded from sw
+              0x00310233,       // add x4, x2, x3
+              0x78021073});     // csrw mtohost, x4
+        ASSERT_EQ(Run(), 0xfeu + 0xffu);
+        ASSERT_EQ(_cpu.GetStats().forwardedLoads, 1u);
+    }
+
+    TEST_F(OooCpuTest, TestLuiAddiFusion)
+    {
+        OooConfig config;
+        config.fusion = true;
+        OooCpu fusing{_mem, _bpred, config};
+        Load({0x123450b7,       // lui x1, 0x12345
+              0x67808093,       // addi x1, x1, 0x678
+              0x78009073});     // csrw mtohost, x1
+        fusing.Reset(OOO_CODE_IP);
+
+        std::optional<CpuToHostData> msg;
+        for (size_t cycle = 0; cycle < OOO_MAX_CYCLES && !msg; cycle++)
+        {
+            fusing.Clock();
+            _mem.Clock();
+            msg = fusing.GetMessage();
+        }
+        ASSERT_TRUE(msg.has_value());
+        ASSERT_EQ(msg->payload, 0x12345678u);
+        ASSERT_EQ(fusing.GetStats().fused[size_t(FusionKind::LuiAddi)], 1u);
+        ASSERT_EQ(fusing.GetStats().committed, 3u);
+    }
+
+    TEST_F(OooCpuTest, TestAtomics)
+    {
+        Load({0x40000093,       // addi x1, x0, 0x400
+              0x00500113,       // addi x2, x0, 5
+              0x0020a1af,       // amoadd.w x3, x2, (x1)
+              0x0020a1af,       // amoadd.w x3, x2, (x1)
+              0x1000a1af,       // retry: lr.w x3, (x1)
+              0x00118193,       // addi x3, x3, 1
+              0x1830a22f,       // sc.w x4, x3, (x1)
+              0xfe021ae3,       // bne x4, x0, retry
+              0x0000a283,       // lw x5, 0(x1)
+              0x1830a22f,       // sc.w x4, x3, (x1): fails without a reservation
+              0x004282b3,       // add x5, x5, x4
+              0x78029073});     // csrw mtohost, x5
+        ASSERT_EQ(Run(), 12u);
+    }
+
+    // Younger loads do not pass a vector store
+    TEST_F(OooCpuTest, TestVectorMemoryOrder)
+    {
+        Load({0x00001137,       // lui x2, 0x1
+              0x00700093,       // addi x1, x0, 7
+              0x0d0071d7,       // vsetvli x3, x0, e32, m1, ta, ma
+              0x0200c0d7,       // vadd.vx v1, v0, x1
+              0x020160a7,       // vse32.v v1, (x2)
+              0x01c12203,       // lw x4, 28(x2)
+              0x02016107,       // vle32.v v2, (x2)
+              0x022021d7,       // vredsum.vs v3, v2, v0
+              0x020161a7,       // vse32.v v3, (x2)
+              0x00012283,       // lw x5, 0(x2)
+              0x00520233,       // add x4, x4, x5
+              0x78021073});     // csrw mtohost, x4
+        ASSERT_EQ(Run(), 7u + 8u * 7u);
+        ASSERT_EQ(_cpu.GetVectorStats().lineAccesses, 3u);
+    }
+
+    // The second divide reads the rounding mode written just before it
+    TEST_F(OooCpuTest, TestFloatRoundingMode)
+    {
+        Load({0x00100093,       // addi x1, x0, 1
+              0x00300113,       // addi x2, x0, 3
+              0xd000f0d3,       // fcvt.s.w f1, x1
+              0xd0017153,       // fcvt.s.w f2, x2
+              0x1820f1d3,       // fdiv.s f3, f1, f2: rounded up to nearest
+              0x00100193,       // addi x3, x0, 1
+              0x00219073,       // fsrm x3: towards zero
+              0x1820f253,       // fdiv.s f4, f1, f2
+              0xe0018253,       // fmv.x.w x4, f3
+              0xe00202d3,       // fmv.x.w x5, f4
+              0x40520333,       // sub x6, x4, x5
+              0x001023f3,       // frflags x7
+              0x00439393,       // slli x7, x7, 4
+              0x00736333,       // or x6, x6, x7
+              0x78031073});     // csrw mtohost, x6
+        ASSERT_EQ(Run(), (Word(fpInexact) << 4u) | 1u);
+    }
+
+    // A call and a return between 16-bit instructions, the 32-bit CSR write is halfword aligned
+    TEST_F(OooCpuTest, TestCompressedCall)
+    {
+        Load({0x05156505,       // c.lui x10, 1; c.addi x10, 5
+              0x10732019,       // c.jal func; csrw mtohost, x10 (low half)
+              0x05067805,       // (high half); func: c.slli x10, 1
+              0x00008082});     // c.jr x1
+        ASSERT_EQ(Run(), 0x200au);
+        ASSERT_EQ(_cpu.GetStats().committed, 6u);
+    }
+
+    // The clear waits at the head for the swap before it reads the CSR
+    TEST_F(OooCpuTest, TestCsrReadModifyWrite)
+    {
+        Load({0x00500113,       // addi x2, x0, 5
+              0x34011073,       // csrw mscratch, x2
+              0x00700113,       // addi x2, x0, 7
+              0x34011173,       // csrrw x2, mscratch, x2: 5
+              0x3401f1f3,       // csrrci x3, mscratch, 3: 7
+              0x34002273,       // csrr x4, mscratch: 4
+              0x00419193,       // slli x3, x3, 4
+              0x00821213,       // slli x4, x4, 8
+              0x00310133,       // add x2, x2, x3
+              0x00410133,       // add x2, x2, x4
+              0x78011073});     // csrw mtohost, x2
+        ASSERT_EQ(Run(), 0x475u);
+    }
+
+    TEST(OooConfigTest, TestIsValid)
+    {
+        ASSERT_TRUE(OooConfig().IsValid());
+        for (size_t OooConfig::*size : {&OooConfig::fetchWidth, &OooConfig::issueWidth,
+                                        &OooConfig::commitWidth, &OooConfig::robSize})
+        {
+            OooConfig config;
+            config.*size = 0;
+            ASSERT_FALSE(config.IsValid());
+        }
+
+        OooConfig config;
+        config.physRegs = archRegs;
+        ASSERT_FALSE(config.IsValid());
+        config.physRegs = archRegs + 1;
+        ASSERT_TRUE(config.IsValid());
+    }
+}
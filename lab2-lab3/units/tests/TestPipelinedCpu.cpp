@@ -0,0 +1,243 @@
+#include <gtest/gtest.h>
+
+#include <PipelinedCpu.h>
+#include <BaseTypes.h>
+
+namespace units
+{
+    static const Word CODE_IP     = 0x200;
+    static const size_t MAX_CYCLES = 10000;
+
+    // Adds 176 to x3 four times, then sends x3 and the number of instruction cache misses.
+    // The loop takes 720 bytes of 32-bit instructions and 356 bytes of mostly 16-bit ones.
+    static std::vector<Word> CountingLoop(bool compressed)
+    {
+        std::vector<uint16_t> code;
+        auto add = [&code](Word instr) {
+            code.push_back(uint16_t(instr));
+            if (InstructionLength(instr) == 4)
+                code.push_back(uint16_t(instr >> 16u));
+        };
+
+        add(0x00400413);            // addi x8, x0, 4
+        add(0x00100113);            // addi x2, x0, 1
+        add(0x32311073);            // csrw mhpmevent3, x2: instruction cache misses
+        for (size_t i = 0; i < 176; i++)
+            add(compressed ? 0x0185 : 0x00118193);      // loop: c.addi x3, 1 or addi x3, x3, 1
+        add(compressed ? 0x147d : 0xfff40413);          // c.addi x8, -1 or addi x8, x8, -1
+        add(compressed ? 0xe8041fe3 : 0xd2041ee3);      // bne x8, x0, loop
+        add(0xb0302273);            // csrr x4, mhpmcounter3
+        add(0x78019073);            // csrw mtohost, x3
+        add(0x78021073);            // csrw mtohost, x4: on both sides of a line boundary when compressed
+        code.push_back(0);
+
+        std::vector<Word> program;
+        for (size_t i = 0; i + 1 < code.size(); i += 2)
+            program.push_back(code[i] | Word(code[i + 1]) << 16u);
+        return program;
+    }
+
+    class PipelinedCpuTest : public ::testing::Test
+    {
+    protected:
+        MemoryStorage _storage;
+        CachedMem _mem{_storage};
+        NotTakenPredictor _bpred;
+        PipelinedCpu _cpu{_mem, _bpred};
+        Clint _clint;
+
+        void Load(const std::vector<Word>& program)
+        {
+            for (size_t i = 0; i < program.size(); i++)
+                _storage.Write(CODE_IP + i * 4, program[i]);
+            _cpu.Reset(CODE_IP);
+            _cpu.SetClint(&_clint);
+        }
+
+        // Runs until the first message for the host
+        Word Run()
+        {
+            for (size_t cycle = 0; cycle < MAX_CYCLES; cycle++)
+            {
+                _cpu.Clock();
+                _mem.Clock();
+                _clint.Clock();
+                if (auto msg = _cpu.GetMessage())
+                    return msg.value().payload;
+            }
+            ADD_FAILURE() << "no message from the program";
+            return 0;
+        }
+    };
+
+    TEST_F(PipelinedCpuTest, TestForwarding)
+    {
+        Load({0x00500093,       // addi x1, x0, 5
+              0x00308113,       // addi x2, x1, 3
+              0x78011073});     // csrw mtohost, x2
+        ASSERT_EQ(Run(), 8u);
+        ASSERT_EQ(_cpu.GetStats().loadUseStalls, 0u);
+    }
+
+    TEST_F(PipelinedCpuTest, TestLoadUseStall)
+    {
+        Load({0x00900093,       // addi x1, x0, 9
+              0x40102023,       // sw x1, 0x400(x0)
+              0x40002103,       // lw x2, 0x400(x0)
+              0x00110193,       // addi x3, x2, 1
+              0x78019073});     // csrw mtohost, x3
+        ASSERT_EQ(Run(), 10u);
+        ASSERT_EQ(_cpu.GetStats().loadUseStalls, 1u);
+    }
+
+    TEST_F(PipelinedCpuTest, TestBranchFlush)
+    {
+        Load({0x00100093,       // addi x1, x0, 1
+              0x00000463,       // beq x0, x0, 8
+              0x00200093,       // addi x1, x0, 2
+              0x78009073,       // csrw mtohost, x1
+              // The zeros after the program would trap as illegal instructions in EX
+              0x00000013,       // nop
+              0x00000013});     // nop
+        ASSERT_EQ(Run(), 1u);
+        ASSERT_EQ(_cpu.GetStats().branchFlushes, 1u);
+    }
+
+    TEST_F(PipelinedCpuTest, TestMulDivLatency)
+    {
+        Load({0x00600093,       // addi x1, x0, 6
+              0x00700113,       // addi x2, x0, 7
+              0x022081b3,       // mul x3, x1, x2
+              0x78019073});     // csrw mtohost, x3
+        ASSERT_EQ(Run(), 42u);
+        ASSERT_EQ(_cpu.GetStats().mulDivStalls, MulDivConfig().mulLatency - 1);
+    }
+
+    TEST_F(PipelinedCpuTest, TestHpmCounter)
+    {
+        Load({0x00200093,       // addi x1, x0, 2
+              0x32309073,       // csrw mhpmevent3, x1: data cache misses
+              0x40002103,       // lw x2, 0x400(x0)
+              0xb03021f3,       // csrr x3, mhpmcounter3
+              0x78019073});     // csrw mtohost, x3
+        ASSERT_EQ(Run(), 1u);
+    }
+
+    // The interrupt is taken in the middle of an endless loop
+    TEST_F(PipelinedCpuTest, TestTimerInterrupt)
+    {
+        Load({0x30000093,       // addi x1, x0, 0x300
+              0x30509073,       // csrw mtvec, x1
+              0x020041b7,       // lui x3, 0x2004 (mtimecmp)
+              0x0001a223,       // sw x0, 4(x3)
+              0x0c800213,       // addi x4, x0, 200
+              0x0041a023,       // sw x4, 0(x3)
+              0x08000293,       // addi x5, x0, 0x80 (MTIE)
+              0x30429073,       // csrw mie, x5
+              0x00800293,       // addi x5, x0, 8 (MIE)
+              0x30029073,       // csrw mstatus, x5
+              0x0000006f});     // j .
+        _storage.Write(0x300, 0x34202173);      // csrr x2, mcause
+        _storage.Write(0x304, 0x78011073);      // csrw mtohost, x2
+        ASSERT_EQ(Run(), causeMachineTimer);
+        ASSERT_GE(_clint.Time(), 200u);
+    }
+
+    // Enabled by setting bits rather than writing the CSRs
+    TEST_F(PipelinedCpuTest, TestTimerInterruptSetBits)
+    {
+        Load({0x30000093,       // addi x1, x0, 0x300
+              0x30509073,       // csrw mtvec, x1
+              0x020041b7,       // lui x3, 0x2004 (mtimecmp)
+              0x0001a223,       // sw x0, 4(x3)
+              0x0c800213,       // addi x4, x0, 200
+              0x0041a023,       // sw x4, 0(x3)
+              0x08000293,       // addi x5, x0, 0x80 (MTIE)
+              0x3042a073,       // csrs mie, x5
+              0x30046073,       // csrsi mstatus, 8 (MIE)
+              0x0000006f});     // j .
+        _storage.Write(0x300, 0x34202173);      // csrr x2, mcause
+        _storage.Write(0x304, 0x78011073);      // csrw mtohost, x2
+        ASSERT_EQ(Run(), causeMachineTimer);
+    }
+
+    TEST_F(PipelinedCpuTest, TestIllegalInstruction)
+    {
+        Load({0x30000093,       // addi x1, x0, 0x300
+              0x30509073,       // csrw mtvec, x1
+              0xffffffff,       // illegal
+              0x78001073});     // csrw mtohost, x0
+        _storage.Write(0x300, 0x34202173);      // csrr x2, mcause
+        _storage.Write(0x304, 0x78011073);      // csrw mtohost, x2
+        ASSERT_EQ(Run(), causeIllegalInstruction);
+    }
+
+    // Strip-mined over 16 words with VLEN = 256, then a strided load of every other word
+    // stored by the loop
+    TEST_F(PipelinedCpuTest, TestVectorLoop)
+    {
+        for (Word i = 0; i < 16; i++)
+            _storage.Write(0x1000 + i * 4, i + 1);
+        Load({0x00001137,       // lui x2, 0x1
+              0x01000093,       // addi x1, x0, 16
+              0x00300213,       // addi x4, x0, 3
+              0x0d00f1d7,       // loop: vsetvli x3, x1, e32, m1, ta, ma
+              0x02016107,       // vle32.v v2, (x2)
+              0x0220b157,       // vadd.vi v2, v2, 1
+              0x96226157,       // vmul.vx v2, v2, x4
+              0x02210157,       // vadd.vv v2, v2, v2
+              0x0220a0d7,       // vredsum.vs v1, v2, v1
+              0x02016127,       // vse32.v v2, (x2)
+              0x00219293,       // slli x5, x3, 2
+              0x00510133,       // add x2, x2, x5
+              0x403080b3,       // sub x1, x1, x3
+              0xfc009ce3,       // bne x1, x0, loop
+              0x00001437,       // lui x8, 0x1
+              0x00800493,       // addi x9, x0, 8
+              0x0d0071d7,       // vsetvli x3, x0, e32, m1, ta, ma: vl = VLMAX
+              0x0a946207,       // vlse32.v v4, (x8), x9
+              0x0240a2d7,       // vredsum.vs v5, v4, v1
+              0x020462a7,       // vse32.v v5, (x8)
+              0x00042303,       // lw x6, 0(x8)
+              0x78031073});     // csrw mtohost, x6
+        ASSERT_EQ(Run(), 912u + 432u);
+        ASSERT_EQ(_cpu.GetVectorStats().instructions, 2u * 7u + 4u);
+        ASSERT_EQ(_cpu.GetVectorStats().lineAccesses, 6u);
+        ASSERT_GT(_cpu.GetStats().vectorStalls, 0u);
+    }
+
+    // Dependent fused multiply-adds, the second one takes its addend forwarded
+    TEST_F(PipelinedCpuTest, TestFloatFma)
+    {
+        Load({0x00100093,       // addi x1, x0, 1
+              0x00300113,       // addi x2, x0, 3
+              0xd000f0d3,       // fcvt.s.w f1, x1
+              0xd0017153,       // fcvt.s.w f2, x2
+              0x082172c3,       // fmadd.s f5, f2, f2, f1
+              0x2852f343,       // fmadd.s f6, f5, f5, f5
+              0x40602027,       // fsw f6, 0x400(x0)
+              0x40002387,       // flw f7, 0x400(x0)
+              0xc003f453,       // fcvt.w.s x8, f7
+              0x78041073});     // csrw mtohost, x8
+        ASSERT_EQ(Run(), 110u);
+        ASSERT_GT(_cpu.GetStats().fpStalls, 0u);
+    }
+
+    // The loop thrashes the instruction cache: its six lines miss in every iteration.
+    // The miss of the first line comes before the counter is set up.
+    TEST_F(PipelinedCpuTest, TestWideLoopMisses)
+    {
+        Load(CountingLoop(false));
+        ASSERT_EQ(Run(), 704u);
+        ASSERT_EQ(Run(), 4u * 6u - 1u);
+    }
+
+    // The same loop in 16-bit instructions takes three lines and only misses on the first pass.
+    // The fetch buffer runs ahead into the fourth line before the counter is read.
+    TEST_F(PipelinedCpuTest, TestCompressedLoopFits)
+    {
+        Load(CountingLoop(true));
+        ASSERT_EQ(Run(), 704u);
+        ASSERT_EQ(Run(), 4u - 1u);
+    }
+}
@@ -0,0 +1,122 @@
+#include <gtest/gtest.h>
+
+#include <Cpu.h>
+#include <OooCpu.h>
+#include <Simulation.h>
+#include <BaseTypes.h>
+
+namespace units
+{
+    static const Word HARTS_CODE_IP = 0x200;
+
+    // Every hart adds its id + 1 to the word at 0x2000 and exits. Hart 0 waits for
+    // the sum of two harts, up to 1000 loads, and exits with the sum xor 3.
+    static const std::vector<Word> HARTS_PROGRAM{
+            0xf10020f3,         // csrr x1, mhartid
+            0x00108113,         // addi x2, x1, 1
+            0x000021b7,         // lui x3, 2
+            0x0021a02f,         // amoadd.w x0, x2, (x3)
+            0x02009463,         // bnez x1, exit1
+            0x3e800313,         // li x6, 1000
+            0x0001a283,         // wait: lw x5, 0(x3)
+            0xfff30313,         // addi x6, x6, -1
+            0x00030663,         // beqz x6, done
+            0x00300393,         // li x7, 3
+            0xfe7298e3,         // bne x5, x7, wait
+            0x0032c293,         // done: xori x5, x5, 3
+            0x78029073,         // csrw mtohost, x5
+            0x0000006f,         // j .
+            0x78001073,         // exit1: csrw mtohost, x0
+            0x0000006f};        // j .
+
+    // Hart 1 exits with 5 at once, hart 0 exits with 0 after a loop of 100
+    static const std::vector<Word> FAILING_SECOND_PROGRAM{
+            0xf10020f3,         // csrr x1, mhartid
+            0x00008863,         // beqz x1, hart0
+            0x00500293,         // li x5, 5
+            0x78029073,         // csrw mtohost, x5
+            0x0000006f,         // j .
+            0x06400313,         // hart0: li x6, 100
+            0xfff30313,         // loop: addi x6, x6, -1
+            0xfe031ee3,         // bnez x6, loop
+            0x78001073,         // csrw mtohost, x0
+            0x0000006f};        // j .
+
+    // Runs the program on two harts like the driver does
+    template <typename Core, typename MakeCore>
+    static int RunTwoHarts(CoherenceBus* bus, MakeCore makeCore, bool& secondHalted,
+                           const std::vector<Word>& program = HARTS_PROGRAM)
+    {
+        MemoryStorage storage;
+        for (size_t i = 0; i < program.size(); i++)
+            storage.Write(HARTS_CODE_IP + i * 4, program[i]);
+
+        Clint clint{2};
+        std::vector<Hart<Core>> harts(2);
+        for (size_t id = 0; id < harts.size(); id++)
+        {
+            Hart<Core>& hart = harts[id];
+            hart.mem = std::make_unique<CachedMem>(storage, 1, bus);
+            hart.bpred = std::make_unique<NotTakenPredictor>();
+            hart.cpu = makeCore(*hart.mem, *hart.bpred);
+            hart.cpu->Reset(HARTS_CODE_IP, id, harts.size());
+            hart.cpu->SetClint(&clint);
+        }
+
+        std::ofstream out;
+        Host host{out};
+        int exitCode = Simulate(harts, host, clint);
+        secondHalted = harts[1].halted;
+        return exitCode;
+    }
+
+    // Hart 0 sees the add of hart 1 through the coherent caches, hart 1 exits first
+    TEST(SimulationTest, TestTwoHarts)
+    {
+        CoherenceBus bus;
+        bool secondHalted = false;
+        int exitCode = RunTwoHarts<Cpu>(&bus, [](IMem& mem, IBranchPredictor&) {
+            return std::make_unique<Cpu>(mem);
+        }, secondHalted);
+
+        ASSERT_EQ(exitCode, 0);
+        ASSERT_TRUE(secondHalted);
+    }
+
+    TEST(SimulationTest, TestTwoOooHarts)
+    {
+        CoherenceBus bus;
+        bool secondHalted = false;
+        int exitCode = RunTwoHarts<OooCpu>(&bus, [](IMem& mem, IBranchPredictor& bpred) {
+            return std::make_unique<OooCpu>(mem, bpred);
+        }, secondHalted);
+
+        ASSERT_EQ(exitCode, 0);
+        ASSERT_TRUE(secondHalted);
+    }
+
+    // Without coherence the add of hart 1 stays in its own data cache
+    TEST(SimulationTest, TestIncoherentHarts)
+    {
+        bool secondHalted = false;
+        int exitCode = RunTwoHarts<Cpu>(nullptr, [](IMem& mem, IBranchPredictor&) {
+            return std::make_unique<Cpu>(mem);
+        }, secondHalted);
+
+        ASSERT_NE(exitCode, 0);
+        ASSERT_TRUE(secondHalted);
+    }
+
+    // Hart 0 passes, but the run fails with the code of hart 1
+    TEST(SimulationTest, TestFailingSecondHart)
+    {
+        CoherenceBus bus;
+        bool secondHalted = false;
+        int exitCode = RunTwoHarts<Cpu>(&bus, [](IMem& mem, IBranchPredictor&) {
+            return std::make_unique<Cpu>(mem);
+        }, secondHalted, FAILING_SECOND_PROGRAM);
+
+        ASSERT_EQ(exitCode, 5);
+        ASSERT_TRUE(secondHalted);
+    }
+}